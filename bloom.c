@@ -0,0 +1,440 @@
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bloom.h"
+#include "log.h"
+#include "logrotate.h"
+
+/* longest part of a line carried over from one chunk of input to the next */
+#define BLOOM_LINE 4096
+
+/* bits set per token, and bits per distinct token, for about 1% false
+ * positives */
+#define BLOOM_HASHES 7
+#define BLOOM_BITS_PER_TOKEN 10
+
+#define BLOOM_MAGIC "LRBLOOM1"
+
+/*
+ * With bloom, the uncompressed data of a log is passed through bloomFeed()
+ * while it is compressed.  Every match of the configured extended regular
+ * expression is a token, without the literal string the expression starts
+ * with, if any: "request_id=[0-9a-f-]+" makes tokens of the ids only.  The
+ * hashes of all tokens go into a bloom filter written next to the
+ * compressed log, and bloomQuery() then tells the logs which cannot hold a
+ * token from those which may, without decompressing any of them.
+ *
+ * Subexpressions would be the obvious way to pick a token out of a match,
+ * but regexec() reporting them is slower than compressing the data.
+ * Without them, regexec() skips ahead to the first character of a match at
+ * a small fraction of that cost, especially if it is a literal.
+ *
+ * The filter is written as a line "LRBLOOM1 <hashes> <bits>", followed by
+ * the bits.  Bit i is bit i % 8 of byte i / 8, the bits of a token are
+ * (h + n * (h rotated by 32 bits | 1)) % bits for n < hashes, with h the
+ * 64-bit FNV-1a hash of the token.
+ */
+
+struct bloom {
+    regex_t re;
+    char *prefix;               /* literal all matches start with */
+    size_t prefixLen;
+    int simple;                 /* a literal and "[...]+", see compileSimple() */
+    unsigned char tokenChars[256];
+    uint64_t *hashes;
+    size_t count;
+    size_t alloc;
+    int failed;                 /* out of memory, nothing is written */
+    size_t carryLen;
+    char carry[BLOOM_LINE];     /* incomplete last line of the previous chunk */
+};
+
+/* compile pattern, returns 0 or fills error with the reason */
+int bloomCheckPattern(const char *pattern, char *error, size_t errorSize)
+{
+    regex_t re;
+    int rc = regcomp(&re, pattern, REG_EXTENDED | REG_NEWLINE);
+
+    if (rc != 0) {
+        regerror(rc, &re, error, errorSize);
+        return 1;
+    }
+    regfree(&re);
+    return 0;
+}
+
+/* Find the literal string every match of the extended regular expression
+ * pattern starts with and store it in bloom.  Returns the rest of pattern. */
+static const char *literalPrefix(struct bloom *bloom, const char *pattern)
+{
+    const char *p;
+
+    bloom->prefix = malloc(strlen(pattern) + 1);
+    if (bloom->prefix == NULL) {
+        message_OOM();
+        return NULL;
+    }
+    bloom->prefixLen = 0;
+
+    /* the alternatives might not share it */
+    if (strchr(pattern, '|'))
+        return pattern;
+
+    for (p = pattern; *p; p++) {
+        const char *start = p;
+
+        if (*p == '\\' && p[1] && !isalnum((unsigned char) p[1]))
+            p++;
+        else if (strchr("\\^$.[()*+?{", *p))
+            break;
+        /* a character followed by a quantifier is not always there once */
+        if (p[1] && strchr("*+?{", p[1]))
+            return start;
+        bloom->prefix[bloom->prefixLen++] = *p;
+    }
+    return p;
+}
+
+/* Most patterns are a literal followed by a bracket expression and "+",
+ * like "request_id=[0-9a-f-]+".  Their matches are found with memmem() and
+ * a table of the characters in the bracket expression instead of calling
+ * regexec() for each of them, which would cost more than compressing a log
+ * with many matches.  Returns 1 if rest, what follows the literal, is such a
+ * bracket expression. */
+static int compileSimple(struct bloom *bloom, const char *rest)
+{
+    const char *p = rest;
+    char *bracket;
+    regex_t re;
+    int c;
+
+    if (*p++ != '[')
+        return 0;
+    if (*p == '^')
+        p++;
+    if (*p == ']')
+        p++;
+    while (*p && *p != ']') {
+        if (*p == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+            const char delim = p[1];
+
+            for (p += 2; *p && !(*p == delim && p[1] == ']'); p++)
+                ;
+            if (*p == '\0')
+                return 0;
+            p++;
+        }
+        p++;
+    }
+    if (*p != ']' || strcmp(p + 1, "+") != 0)
+        return 0;
+
+    if (asprintf(&bracket, "^%.*s$", (int) (p + 1 - rest), rest) < 0) {
+        message_OOM();
+        return 0;
+    }
+    if (regcomp(&re, bracket, REG_EXTENDED | REG_NEWLINE | REG_NOSUB) != 0) {
+        free(bracket);
+        return 0;
+    }
+    for (c = 1; c < 256; c++) {
+        const char s[2] = { (char) c, '\0' };
+        bloom->tokenChars[c] = regexec(&re, s, 0, NULL, 0) == 0;
+    }
+    regfree(&re);
+    free(bracket);
+    return 1;
+}
+
+struct bloom *bloomNew(const char *pattern)
+{
+    struct bloom *bloom = calloc(1, sizeof(*bloom));
+    const char *rest;
+
+    if (bloom == NULL) {
+        message_OOM();
+        return NULL;
+    }
+    if (regcomp(&bloom->re, pattern, REG_EXTENDED | REG_NEWLINE) != 0) {
+        message(MESS_ERROR, "bad bloom pattern %s\n", pattern);
+        free(bloom);
+        return NULL;
+    }
+    rest = literalPrefix(bloom, pattern);
+    if (rest == NULL) {
+        bloomFree(bloom);
+        return NULL;
+    }
+    bloom->simple = compileSimple(bloom, rest);
+    return bloom;
+}
+
+static uint64_t hashToken(const char *token, size_t len)
+{
+    uint64_t h = UINT64_C(0xcbf29ce484222325);
+
+    while (len--) {
+        h ^= (unsigned char) *token++;
+        h *= UINT64_C(0x100000001b3);
+    }
+    return h;
+}
+
+static int compareHashes(const void *a, const void *b)
+{
+    const uint64_t x = *(const uint64_t *) a;
+    const uint64_t y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* drop the hashes of tokens seen more than once */
+static void uniqueHashes(struct bloom *bloom)
+{
+    size_t i, n = 0;
+
+    if (bloom->count == 0)
+        return;
+    qsort(bloom->hashes, bloom->count, sizeof(*bloom->hashes), compareHashes);
+    for (i = 1; i < bloom->count; i++) {
+        if (bloom->hashes[i] != bloom->hashes[n])
+            bloom->hashes[++n] = bloom->hashes[i];
+    }
+    bloom->count = n + 1;
+}
+
+static void addToken(struct bloom *bloom, const char *token, size_t len)
+{
+    if (bloom->count == bloom->alloc) {
+        uint64_t *hashes;
+        size_t alloc;
+
+        /* ids tend to show up in several lines, only grow for new ones */
+        uniqueHashes(bloom);
+        if (bloom->count < bloom->alloc / 2) {
+            bloom->hashes[bloom->count++] = hashToken(token, len);
+            return;
+        }
+        alloc = bloom->alloc ? bloom->alloc * 2 : 1024;
+        hashes = realloc(bloom->hashes, alloc * sizeof(*hashes));
+        if (hashes == NULL) {
+            message_OOM();
+            bloom->failed = 1;
+            return;
+        }
+        bloom->hashes = hashes;
+        bloom->alloc = alloc;
+    }
+    bloom->hashes[bloom->count++] = hashToken(token, len);
+}
+
+/* add the tokens in the complete lines buf[0, len) */
+static void scanLines(struct bloom *bloom, const char *buf, size_t len)
+{
+    regmatch_t m;
+
+    m.rm_so = 0;
+    while ((size_t) m.rm_so < len && !bloom->failed) {
+        m.rm_eo = (regoff_t) len;
+        if (regexec(&bloom->re, buf, 1, &m, REG_STARTEND) != 0)
+            return;
+        if ((size_t) (m.rm_eo - m.rm_so) > bloom->prefixLen)
+            addToken(bloom, buf + m.rm_so + bloom->prefixLen,
+                     (size_t) (m.rm_eo - m.rm_so) - bloom->prefixLen);
+        m.rm_so = m.rm_eo > m.rm_so ? m.rm_eo : m.rm_so + 1;
+    }
+}
+
+/* scanLines() for simple patterns, see compileSimple() */
+static void scanSimple(struct bloom *bloom, const char *buf, size_t len)
+{
+    const unsigned char *p = (const unsigned char *) buf;
+    const unsigned char *end = p + len;
+
+    while (p < end && !bloom->failed) {
+        const unsigned char *hit = p;
+        const unsigned char *token;
+
+        if (bloom->prefixLen) {
+            hit = memmem(p, (size_t) (end - p), bloom->prefix, bloom->prefixLen);
+            if (hit == NULL)
+                return;
+        }
+        token = p = hit + bloom->prefixLen;
+        while (p < end && bloom->tokenChars[*p])
+            p++;
+        if (p > token)
+            addToken(bloom, (const char *) token, (size_t) (p - token));
+        else
+            p = hit + 1;
+    }
+}
+
+static void scan(struct bloom *bloom, const char *buf, size_t len)
+{
+    if (bloom->simple)
+        scanSimple(bloom, buf, len);
+    else
+        scanLines(bloom, buf, len);
+}
+
+/* compressParams tap: add the tokens in the next len bytes of the log */
+void bloomFeed(void *arg, const void *data, size_t len)
+{
+    struct bloom *bloom = arg;
+    const char *buf = data;
+    size_t n;
+
+    if (bloom->failed)
+        return;
+
+    /* complete the line started in the previous chunk */
+    if (bloom->carryLen) {
+        const char *nl = memchr(buf, '\n', len);
+        const size_t room = sizeof(bloom->carry) - bloom->carryLen;
+
+        n = nl ? (size_t) (nl - buf) + 1 : len;
+        if (n > room)
+            n = room;
+        memcpy(bloom->carry + bloom->carryLen, buf, n);
+        bloom->carryLen += n;
+        buf += n;
+        len -= n;
+        if (bloom->carry[bloom->carryLen - 1] != '\n'
+                && bloom->carryLen < sizeof(bloom->carry))
+            return;
+        scan(bloom, bloom->carry, bloom->carryLen);
+        bloom->carryLen = 0;
+    }
+
+    /* scan up to the last newline */
+    for (n = len; n > 0 && buf[n - 1] != '\n'; n--)
+        ;
+    scan(bloom, buf, n);
+    buf += n;
+    len -= n;
+
+    /* and carry the rest over, splitting lines too long for that */
+    while (len >= sizeof(bloom->carry)) {
+        scan(bloom, buf, sizeof(bloom->carry));
+        buf += sizeof(bloom->carry);
+        len -= sizeof(bloom->carry);
+    }
+    memcpy(bloom->carry, buf, len);
+    bloom->carryLen = len;
+}
+
+static uint64_t bloomBit(uint64_t h, unsigned n, uint64_t bits)
+{
+    const uint64_t h2 = ((h >> 32) | (h << 32)) | 1;
+
+    return (h + n * h2) % bits;
+}
+
+/* write the filter to fd and close it, returns 0 on success */
+int bloomWrite(struct bloom *bloom, int fd, const char *name)
+{
+    unsigned char *bitmap;
+    char header[64];
+    uint64_t bits;
+    size_t i, headerLen;
+    unsigned n;
+    int failed;
+
+    if (bloom->carryLen) {
+        scan(bloom, bloom->carry, bloom->carryLen);
+        bloom->carryLen = 0;
+    }
+    uniqueHashes(bloom);
+    if (bloom->failed) {
+        close(fd);
+        return 1;
+    }
+
+    bits = (uint64_t) bloom->count * BLOOM_BITS_PER_TOKEN;
+    bits = bits < 64 ? 64 : (bits + 63) / 64 * 64;
+    bitmap = calloc((size_t) (bits / 8), 1);
+    if (bitmap == NULL) {
+        message_OOM();
+        close(fd);
+        return 1;
+    }
+    for (i = 0; i < bloom->count; i++) {
+        for (n = 0; n < BLOOM_HASHES; n++) {
+            const uint64_t bit = bloomBit(bloom->hashes[i], n, bits);
+            bitmap[bit / 8] |= (unsigned char) (1U << (bit % 8));
+        }
+    }
+
+    headerLen = (size_t) snprintf(header, sizeof(header), BLOOM_MAGIC " %u %ju\n",
+                                  BLOOM_HASHES, (uintmax_t) bits);
+    failed = full_write(fd, header, headerLen) != headerLen
+        || full_write(fd, bitmap, (size_t) (bits / 8)) != (size_t) (bits / 8)
+        || fsync(fd) != 0;
+    if (failed)
+        message(MESS_ERROR, "error writing %s: %s\n", name, strerror(errno));
+    if (close(fd) != 0 && !failed) {
+        message(MESS_ERROR, "error writing %s: %s\n", name, strerror(errno));
+        failed = 1;
+    }
+    free(bitmap);
+    return failed;
+}
+
+void bloomFree(struct bloom *bloom)
+{
+    if (bloom == NULL)
+        return;
+    regfree(&bloom->re);
+    free(bloom->prefix);
+    free(bloom->hashes);
+    free(bloom);
+}
+
+/* Look token up in the filter read from fd.  Returns 0 if the log cannot
+ * hold it, 1 if it may, and -1 if the filter is unusable. */
+int bloomQuery(int fd, const char *name, const char *token)
+{
+    const uint64_t h = hashToken(token, strlen(token));
+    char header[64];
+    unsigned hashes;
+    uintmax_t bits;
+    ssize_t len;
+    int headerLen = 0;
+    unsigned n;
+
+    len = pread(fd, header, sizeof(header) - 1, 0);
+    if (len < 0) {
+        message(MESS_ERROR, "error reading %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+    header[len] = '\0';
+    /* the bitmap may start with what scanf takes for white space */
+    if (sscanf(header, BLOOM_MAGIC " %u %ju%n", &hashes, &bits, &headerLen) != 2
+            || headerLen == 0 || header[headerLen++] != '\n'
+            || bits == 0 || bits % 8 != 0) {
+        message(MESS_ERROR, "%s is no bloom filter\n", name);
+        return -1;
+    }
+
+    for (n = 0; n < hashes; n++) {
+        const uint64_t bit = bloomBit(h, n, (uint64_t) bits);
+        unsigned char byte;
+
+        if (pread(fd, &byte, 1, headerLen + (off_t) (bit / 8)) != 1) {
+            message(MESS_ERROR, "%s is truncated\n", name);
+            return -1;
+        }
+        if (!(byte & (1U << (bit % 8))))
+            return 0;
+    }
+    return 1;
+}
+
+/* vim: set et sw=4 ts=4: */
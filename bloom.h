@@ -0,0 +1,20 @@
+#ifndef H_BLOOM
+#define H_BLOOM
+
+#include <sys/types.h>
+
+/* suffix of the bloom filter written next to a compressed log */
+#define BLOOM_EXT ".bloom"
+
+struct bloom;
+
+int bloomCheckPattern(const char *pattern, char *error, size_t errorSize);
+struct bloom *bloomNew(const char *pattern);
+void bloomFeed(void *bloom, const void *buf, size_t len);
+int bloomWrite(struct bloom *bloom, int fd, const char *name);
+void bloomFree(struct bloom *bloom);
+int bloomQuery(int fd, const char *name, const char *token);
+
+#endif
+
+/* vim: set et sw=4 ts=4: */
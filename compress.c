@@ -0,0 +1,1539 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+#ifdef HAVE_LIBLZMA
+#include <lzma.h>
+#endif
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LIBLZ4
+#include <lz4frame.h>
+#endif
+
+#include "compress.h"
+#include "iolimit.h"
+#include "log.h"
+#include "logrotate.h"
+#include "uring.h"
+#include "zstddict.h"
+
+/* size of the input and output buffers of the built-in backends */
+#define COMPRESS_BUFSIZE (128 * 1024)
+
+/* input compressed into an independent gzip member or zstd or lz4 frame,
+ * by one thread or as one seekable frame */
+#define COMPRESS_CHUNK (4 * 1024 * 1024)
+
+/* The index of a seekable file is a frame of its own at its end: a gzip
+ * member with an empty body and the index as its comment, or a skippable
+ * frame of zstd and lz4.  The index is text, one line per data frame with
+ * its uncompressed and compressed offsets, after a line with INDEX_MAGIC.
+ * It ends with a footer of INDEX_FOOTER, a space, the size of the whole
+ * index frame in 20 digits and a newline; only the empty body and trailer
+ * of the gzip member follow it. */
+#define INDEX_MAGIC "LRIDX1"
+#define INDEX_FOOTER "LRSEEK"
+#define INDEX_FOOTER_LEN (sizeof(INDEX_FOOTER) + 21)
+#define INDEX_SKIPPABLE_MAGIC 0x184D2A5EU
+/* FCOMMENT set, no mtime, OS unknown */
+static const unsigned char indexGzipHeader[10] = { 0x1f, 0x8b, 8, 0x10, 0, 0, 0, 0, 0, 255 };
+/* end of the comment, an empty final deflate block, CRC32 and size 0 */
+static const unsigned char indexGzipTrailer[11] = { 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+/* what encUpdate() does once it has consumed its input */
+enum compressOp {
+    COMPRESS_RUN,       /* nothing, the encoder may keep data buffered */
+    COMPRESS_FLUSH,     /* write out everything, so it can be decoded */
+    COMPRESS_FINISH     /* write out everything and the trailer */
+};
+
+/* the part of the decoded data written out: what follows the first skip
+ * bytes, up to left bytes of it if left is not negative */
+struct decodeRange {
+    off_t skip;
+    off_t left;
+};
+
+struct compressBackend {
+    const char *name;
+    const char *ext;
+    int minLevel;
+    int defaultLevel;
+    int maxLevel;
+    int storeLevel;     /* level doing the least work, for incompressible data */
+    int libThreads;     /* the library compresses with threads itself */
+    int skippableFrames;    /* the index is a zstd/lz4 skippable frame */
+    int dictionaries;       /* compresses with a dictionary, see zstddict.c */
+    int (*encInit)(struct compressStream *s);
+    int (*encUpdate)(struct compressStream *s, const unsigned char *buf,
+                     size_t len, enum compressOp op);
+    void (*encEnd)(struct compressStream *s);
+    /* compress a whole chunk into a malloc()ed, independently decodable
+     * part of the output; must not report errors, it runs in a thread */
+    int (*encChunk)(const struct compressParams *params, const unsigned char *in,
+                    size_t len, unsigned char **out, size_t *outLen);
+    int (*decode)(int inFd, const char *inName, int outFd, const char *outName,
+                  struct decodeRange *range);
+};
+
+/* one chunk of input of a stream compressed in chunks */
+struct compressJob {
+    const struct compressParams *params;
+    const unsigned char *in;
+    size_t len;
+    unsigned char *out;
+    size_t outLen;
+    int failed;
+#ifdef HAVE_PTHREAD
+    pthread_t thread;
+#endif
+};
+
+struct compressStream {
+    struct compressParams params;
+    int outFd;
+    const char *outName;
+    unsigned char *outBuf;
+    size_t outSize;
+    /* with threads or seekable output and a backend with encChunk, the input
+     * is collected in inBuf and compressed in chunks by jobs, one per thread */
+    unsigned char *inBuf;
+    size_t inLen;
+    struct compressJob *jobs;
+    int wroteChunk;
+    /* uncompressed and compressed offsets of the chunks written so far, and
+     * of their end */
+    off_t *index;
+    size_t indexLen;
+    size_t indexSize;
+    off_t uncompressedPos;
+    off_t compressedPos;
+    union {
+#ifdef HAVE_LIBZ
+        z_stream z;
+#endif
+#ifdef HAVE_LIBLZMA
+        lzma_stream xz;
+#endif
+#ifdef HAVE_LIBZSTD
+        ZSTD_CCtx *zstd;
+#endif
+#ifdef HAVE_LIBLZ4
+        LZ4F_cctx *lz4;
+#endif
+        int unused;
+    } u;
+};
+
+static int writeOut(struct compressStream *s, size_t len)
+{
+    if (len && full_write(s->outFd, s->outBuf, len) != len) {
+        message(MESS_ERROR, "error writing to %s: %s\n", s->outName,
+                strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+/* read up to len bytes, returns -1 on error (already reported) */
+static ssize_t readIn(int fd, const char *name, void *buf, size_t len)
+{
+    for (;;) {
+        const ssize_t n_read = read(fd, buf, len);
+        if (n_read < 0) {
+            if (errno == EINTR)
+                continue;
+            message(MESS_ERROR, "error reading %s: %s\n", name, strerror(errno));
+        }
+        return n_read;
+    }
+}
+
+/* Write the part of decoded data within range.  Returns 1 on errors and,
+ * without a message, once the end of range is reached, to stop decoding. */
+static int writeDecoded(int fd, const char *name, const unsigned char *buf,
+                        size_t len, struct decodeRange *range)
+{
+    if (range->skip > 0) {
+        const size_t n = range->skip < (off_t) len ? (size_t) range->skip : len;
+
+        buf += n;
+        len -= n;
+        range->skip -= (off_t) n;
+    }
+    if (range->left >= 0 && (off_t) len > range->left)
+        len = (size_t) range->left;
+
+    if (len && full_write(fd, buf, len) != len) {
+        message(MESS_ERROR, "error writing to %s: %s\n", name, strerror(errno));
+        return 1;
+    }
+    if (range->left >= 0) {
+        range->left -= (off_t) len;
+        if (range->left == 0)
+            return 1;
+    }
+    return 0;
+}
+
+#ifdef HAVE_LIBZ
+static int gzipInit(struct compressStream *s)
+{
+    memset(&s->u.z, 0, sizeof(s->u.z));
+    /* windowBits 15 + 16 makes zlib write a gzip(1) compatible header */
+    if (deflateInit2(&s->u.z, s->params.level, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        message(MESS_ERROR, "cannot initialize gzip compression: %s\n",
+                s->u.z.msg ? s->u.z.msg : "unknown error");
+        return 1;
+    }
+    return 0;
+}
+
+static int gzipUpdate(struct compressStream *s, const unsigned char *buf,
+                      size_t len, enum compressOp op)
+{
+    z_stream *z = &s->u.z;
+    int rc;
+
+    z->next_in = (Bytef *) buf;
+    z->avail_in = (uInt) len;
+    for (;;) {
+        z->next_out = s->outBuf;
+        z->avail_out = (uInt) s->outSize;
+        rc = deflate(z, op == COMPRESS_FINISH ? Z_FINISH
+                     : op == COMPRESS_FLUSH ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+        if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+            message(MESS_ERROR, "gzip compression of %s failed: %s\n",
+                    s->outName, z->msg ? z->msg : "unknown error");
+            return 1;
+        }
+        if (writeOut(s, s->outSize - z->avail_out))
+            return 1;
+        if (op == COMPRESS_FINISH ? rc == Z_STREAM_END : (z->avail_in == 0 && z->avail_out != 0))
+            return 0;
+    }
+}
+
+static void gzipEnd(struct compressStream *s)
+{
+    deflateEnd(&s->u.z);
+}
+
+static int gzipChunk(const struct compressParams *params, const unsigned char *in,
+                     size_t len, unsigned char **out, size_t *outLen)
+{
+    z_stream z;
+    uLong bound;
+    int rc;
+
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, params->level, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+        return 1;
+
+    bound = deflateBound(&z, (uLong) len);
+    *out = malloc(bound);
+    if (*out == NULL) {
+        deflateEnd(&z);
+        return 1;
+    }
+
+    /* gunzip(1) decompresses concatenated members as one file */
+    z.next_in = (Bytef *) in;
+    z.avail_in = (uInt) len;
+    z.next_out = *out;
+    z.avail_out = (uInt) bound;
+    rc = deflate(&z, Z_FINISH);
+    *outLen = bound - z.avail_out;
+    deflateEnd(&z);
+    return rc != Z_STREAM_END;
+}
+
+static int gzipDecode(int inFd, const char *inName, int outFd, const char *outName,
+                      struct decodeRange *range)
+{
+    unsigned char *inBuf = malloc(2 * COMPRESS_BUFSIZE);
+    unsigned char *outBuf = inBuf + COMPRESS_BUFSIZE;
+    z_stream z;
+    int rc = Z_OK;
+    int failed = 1;
+
+    if (inBuf == NULL) {
+        message_OOM();
+        return 1;
+    }
+
+    memset(&z, 0, sizeof(z));
+    /* windowBits 15 + 32 accepts both gzip and zlib headers */
+    if (inflateInit2(&z, 15 + 32) != Z_OK) {
+        message(MESS_ERROR, "cannot initialize gzip decompression\n");
+        free(inBuf);
+        return 1;
+    }
+
+    for (;;) {
+        const ssize_t n_read = readIn(inFd, inName, inBuf, COMPRESS_BUFSIZE);
+        if (n_read < 0)
+            goto out;
+        if (n_read == 0)
+            break;
+
+        z.next_in = inBuf;
+        z.avail_in = (uInt) n_read;
+        while (z.avail_in > 0) {
+            if (rc == Z_STREAM_END) {
+                /* gzip(1) decompresses concatenated members as one stream */
+                if (inflateReset(&z) != Z_OK)
+                    goto corrupt;
+            }
+            z.next_out = outBuf;
+            z.avail_out = COMPRESS_BUFSIZE;
+            rc = inflate(&z, Z_NO_FLUSH);
+            if (rc != Z_OK && rc != Z_STREAM_END)
+                goto corrupt;
+            if (writeDecoded(outFd, outName, outBuf, COMPRESS_BUFSIZE - z.avail_out, range))
+                goto out;
+        }
+    }
+
+    /* drain output still buffered in zlib */
+    while (rc == Z_OK) {
+        z.next_out = outBuf;
+        z.avail_out = COMPRESS_BUFSIZE;
+        rc = inflate(&z, Z_NO_FLUSH);
+        if (writeDecoded(outFd, outName, outBuf, COMPRESS_BUFSIZE - z.avail_out, range))
+            goto out;
+        if (z.avail_out != 0)
+            break;
+    }
+    if (rc != Z_STREAM_END)
+        goto corrupt;
+
+    failed = 0;
+    goto out;
+
+corrupt:
+    message(MESS_ERROR, "gzip decompression of %s failed: %s\n", inName,
+            z.msg ? z.msg : "unexpected end of file");
+out:
+    inflateEnd(&z);
+    free(inBuf);
+    return failed;
+}
+#endif /* HAVE_LIBZ */
+
+#ifdef HAVE_LIBLZMA
+static int xzInit(struct compressStream *s)
+{
+    lzma_ret rc;
+    lzma_stream init = LZMA_STREAM_INIT;
+
+    s->u.xz = init;
+    if (s->params.threads > 1) {
+        lzma_mt mt;
+
+        memset(&mt, 0, sizeof(mt));
+        mt.threads = s->params.threads;
+        mt.preset = (uint32_t) s->params.level;
+        mt.check = LZMA_CHECK_CRC64;
+        rc = lzma_stream_encoder_mt(&s->u.xz, &mt);
+    } else {
+        rc = lzma_easy_encoder(&s->u.xz, (uint32_t) s->params.level,
+                               LZMA_CHECK_CRC64);
+    }
+
+    if (rc != LZMA_OK) {
+        message(MESS_ERROR, "cannot initialize xz compression (error %d)\n",
+                (int) rc);
+        return 1;
+    }
+    return 0;
+}
+
+static int xzUpdate(struct compressStream *s, const unsigned char *buf,
+                    size_t len, enum compressOp op)
+{
+    lzma_stream *xz = &s->u.xz;
+    lzma_ret rc;
+
+    xz->next_in = buf;
+    xz->avail_in = len;
+    for (;;) {
+        xz->next_out = s->outBuf;
+        xz->avail_out = s->outSize;
+        rc = lzma_code(xz, op == COMPRESS_FINISH ? LZMA_FINISH
+                       : op == COMPRESS_FLUSH ? LZMA_FULL_FLUSH : LZMA_RUN);
+        if (rc != LZMA_OK && rc != LZMA_STREAM_END) {
+            message(MESS_ERROR, "xz compression of %s failed (error %d)\n",
+                    s->outName, (int) rc);
+            return 1;
+        }
+        if (writeOut(s, s->outSize - xz->avail_out))
+            return 1;
+        if (op != COMPRESS_RUN ? rc == LZMA_STREAM_END : (xz->avail_in == 0 && xz->avail_out != 0))
+            return 0;
+    }
+}
+
+static void xzEnd(struct compressStream *s)
+{
+    lzma_end(&s->u.xz);
+}
+
+static int xzDecode(int inFd, const char *inName, int outFd, const char *outName,
+                    struct decodeRange *range)
+{
+    unsigned char *inBuf = malloc(2 * COMPRESS_BUFSIZE);
+    unsigned char *outBuf = inBuf + COMPRESS_BUFSIZE;
+    lzma_stream xz = LZMA_STREAM_INIT;
+    lzma_action action = LZMA_RUN;
+    lzma_ret rc;
+    int failed = 1;
+
+    if (inBuf == NULL) {
+        message_OOM();
+        return 1;
+    }
+
+    if (lzma_stream_decoder(&xz, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK) {
+        message(MESS_ERROR, "cannot initialize xz decompression\n");
+        free(inBuf);
+        return 1;
+    }
+
+    for (;;) {
+        if (xz.avail_in == 0 && action == LZMA_RUN) {
+            const ssize_t n_read = readIn(inFd, inName, inBuf, COMPRESS_BUFSIZE);
+            if (n_read < 0)
+                goto out;
+            if (n_read == 0)
+                action = LZMA_FINISH;
+            xz.next_in = inBuf;
+            xz.avail_in = (size_t) n_read;
+        }
+
+        xz.next_out = outBuf;
+        xz.avail_out = COMPRESS_BUFSIZE;
+        rc = lzma_code(&xz, action);
+        if (rc != LZMA_OK && rc != LZMA_STREAM_END) {
+            message(MESS_ERROR, "xz decompression of %s failed (error %d)\n",
+                    inName, (int) rc);
+            goto out;
+        }
+        if (writeDecoded(outFd, outName, outBuf, COMPRESS_BUFSIZE - xz.avail_out, range))
+            goto out;
+        if (rc == LZMA_STREAM_END)
+            break;
+    }
+
+    failed = 0;
+out:
+    lzma_end(&xz);
+    free(inBuf);
+    return failed;
+}
+#endif /* HAVE_LIBLZMA */
+
+#ifdef HAVE_LIBZSTD
+static int zstdInit(struct compressStream *s)
+{
+    s->u.zstd = ZSTD_createCCtx();
+    if (s->u.zstd == NULL) {
+        message_OOM();
+        return 1;
+    }
+
+    ZSTD_CCtx_setParameter(s->u.zstd, ZSTD_c_compressionLevel, s->params.level);
+    /* zstd(1) writes a content checksum by default as well */
+    ZSTD_CCtx_setParameter(s->u.zstd, ZSTD_c_checksumFlag, 1);
+    if (s->params.dict) {
+        const size_t ret = ZSTD_CCtx_loadDictionary(s->u.zstd, s->params.dict,
+                                                    s->params.dictSize);
+        if (ZSTD_isError(ret)) {
+            message(MESS_ERROR, "cannot use the dictionary for %s: %s\n",
+                    s->outName, ZSTD_getErrorName(ret));
+            ZSTD_freeCCtx(s->u.zstd);
+            return 1;
+        }
+    }
+    if (s->params.threads > 1 &&
+            ZSTD_isError(ZSTD_CCtx_setParameter(s->u.zstd, ZSTD_c_nbWorkers,
+                                                (int) s->params.threads))) {
+        message(MESS_DEBUG, "libzstd does not support threads, compressing "
+                "%s single-threaded\n", s->outName);
+    }
+    return 0;
+}
+
+static int zstdUpdate(struct compressStream *s, const unsigned char *buf,
+                      size_t len, enum compressOp op)
+{
+    ZSTD_inBuffer in;
+
+    in.src = buf;
+    in.size = len;
+    in.pos = 0;
+    for (;;) {
+        ZSTD_outBuffer out;
+        size_t remaining;
+
+        out.dst = s->outBuf;
+        out.size = s->outSize;
+        out.pos = 0;
+        remaining = ZSTD_compressStream2(s->u.zstd, &out, &in,
+                                         op == COMPRESS_FINISH ? ZSTD_e_end
+                                         : op == COMPRESS_FLUSH ? ZSTD_e_flush
+                                         : ZSTD_e_continue);
+        if (ZSTD_isError(remaining)) {
+            message(MESS_ERROR, "zstd compression of %s failed: %s\n",
+                    s->outName, ZSTD_getErrorName(remaining));
+            return 1;
+        }
+        if (writeOut(s, out.pos))
+            return 1;
+        if (op != COMPRESS_RUN ? remaining == 0 : in.pos == in.size)
+            return 0;
+    }
+}
+
+static void zstdEnd(struct compressStream *s)
+{
+    ZSTD_freeCCtx(s->u.zstd);
+}
+
+static int zstdChunk(const struct compressParams *params, const unsigned char *in,
+                     size_t len, unsigned char **out, size_t *outLen)
+{
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    const size_t bound = ZSTD_compressBound(len);
+    size_t ret;
+
+    if (cctx == NULL)
+        return 1;
+    *out = malloc(bound);
+    if (*out == NULL) {
+        ZSTD_freeCCtx(cctx);
+        return 1;
+    }
+
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, params->level);
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+    if (params->dict && ZSTD_isError(ZSTD_CCtx_loadDictionary(cctx, params->dict,
+                                                             params->dictSize))) {
+        ZSTD_freeCCtx(cctx);
+        return 1;
+    }
+    ret = ZSTD_compress2(cctx, *out, bound, in, len);
+    ZSTD_freeCCtx(cctx);
+    if (ZSTD_isError(ret))
+        return 1;
+    *outLen = ret;
+    return 0;
+}
+
+static int zstdDecode(int inFd, const char *inName, int outFd, const char *outName,
+                      struct decodeRange *range)
+{
+    unsigned char *inBuf = malloc(2 * COMPRESS_BUFSIZE);
+    unsigned char *outBuf = inBuf + COMPRESS_BUFSIZE;
+    struct zstdDict *dict = NULL;
+    int first = 1;
+    ZSTD_DCtx *dctx;
+    size_t ret = 0;
+    int failed = 1;
+
+    if (inBuf == NULL) {
+        message_OOM();
+        return 1;
+    }
+
+    dctx = ZSTD_createDCtx();
+    if (dctx == NULL) {
+        message_OOM();
+        free(inBuf);
+        return 1;
+    }
+
+    for (;;) {
+        ZSTD_inBuffer in;
+        const ssize_t n_read = readIn(inFd, inName, inBuf, COMPRESS_BUFSIZE);
+        if (n_read < 0)
+            goto out;
+        if (n_read == 0)
+            break;
+
+        if (first) {
+            /* all frames of a log are compressed with the same dictionary */
+            const unsigned id = ZSTD_getDictID_fromFrame(inBuf, (size_t) n_read);
+
+            first = 0;
+            if (id != 0) {
+                dict = zstdDictForArchive(inName, id);
+                if (dict == NULL)
+                    goto out;
+                ret = ZSTD_DCtx_loadDictionary(dctx, dict->data, dict->size);
+                if (ZSTD_isError(ret)) {
+                    message(MESS_ERROR, "cannot use the dictionary %s for %s: %s\n",
+                            dict->path, inName, ZSTD_getErrorName(ret));
+                    goto out;
+                }
+            }
+        }
+
+        in.src = inBuf;
+        in.size = (size_t) n_read;
+        in.pos = 0;
+        while (in.pos < in.size) {
+            ZSTD_outBuffer out;
+
+            out.dst = outBuf;
+            out.size = COMPRESS_BUFSIZE;
+            out.pos = 0;
+            ret = ZSTD_decompressStream(dctx, &out, &in);
+            if (ZSTD_isError(ret)) {
+                message(MESS_ERROR, "zstd decompression of %s failed: %s\n",
+                        inName, ZSTD_getErrorName(ret));
+                goto out;
+            }
+            if (writeDecoded(outFd, outName, outBuf, out.pos, range))
+                goto out;
+        }
+    }
+
+    if (ret != 0) {
+        message(MESS_ERROR, "zstd decompression of %s failed: "
+                "unexpected end of file\n", inName);
+        goto out;
+    }
+
+    failed = 0;
+out:
+    ZSTD_freeDCtx(dctx);
+    zstdDictFree(dict);
+    free(inBuf);
+    return failed;
+}
+#endif /* HAVE_LIBZSTD */
+
+#ifdef HAVE_LIBLZ4
+/* LZ4F_compressUpdate() needs an output buffer large enough for the worst
+ * case, so the input is fed in chunks of this size */
+#define LZ4_CHUNK (64 * 1024)
+
+static int lz4Init(struct compressStream *s)
+{
+    LZ4F_preferences_t prefs;
+    size_t ret;
+    unsigned char *buf;
+
+    memset(&prefs, 0, sizeof(prefs));
+    prefs.compressionLevel = s->params.level;
+    prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+
+    buf = realloc(s->outBuf, LZ4F_compressBound(LZ4_CHUNK, &prefs));
+    if (buf == NULL) {
+        message_OOM();
+        return 1;
+    }
+    s->outBuf = buf;
+    s->outSize = LZ4F_compressBound(LZ4_CHUNK, &prefs);
+
+    ret = LZ4F_createCompressionContext(&s->u.lz4, LZ4F_VERSION);
+    if (LZ4F_isError(ret)) {
+        message(MESS_ERROR, "cannot initialize lz4 compression: %s\n",
+                LZ4F_getErrorName(ret));
+        return 1;
+    }
+
+    ret = LZ4F_compressBegin(s->u.lz4, s->outBuf, s->outSize, &prefs);
+    if (LZ4F_isError(ret)) {
+        message(MESS_ERROR, "lz4 compression of %s failed: %s\n",
+                s->outName, LZ4F_getErrorName(ret));
+        LZ4F_freeCompressionContext(s->u.lz4);
+        return 1;
+    }
+    if (writeOut(s, ret)) {
+        LZ4F_freeCompressionContext(s->u.lz4);
+        return 1;
+    }
+    return 0;
+}
+
+static int lz4Update(struct compressStream *s, const unsigned char *buf,
+                     size_t len, enum compressOp op)
+{
+    size_t ret;
+
+    while (len > 0) {
+        const size_t chunk = len < LZ4_CHUNK ? len : LZ4_CHUNK;
+
+        ret = LZ4F_compressUpdate(s->u.lz4, s->outBuf, s->outSize, buf, chunk, NULL);
+        if (LZ4F_isError(ret)) {
+            message(MESS_ERROR, "lz4 compression of %s failed: %s\n",
+                    s->outName, LZ4F_getErrorName(ret));
+            return 1;
+        }
+        if (writeOut(s, ret))
+            return 1;
+        buf += chunk;
+        len -= chunk;
+    }
+
+    if (op == COMPRESS_RUN)
+        return 0;
+
+    if (op == COMPRESS_FLUSH)
+        ret = LZ4F_flush(s->u.lz4, s->outBuf, s->outSize, NULL);
+    else
+        ret = LZ4F_compressEnd(s->u.lz4, s->outBuf, s->outSize, NULL);
+    if (LZ4F_isError(ret)) {
+        message(MESS_ERROR, "lz4 compression of %s failed: %s\n",
+                s->outName, LZ4F_getErrorName(ret));
+        return 1;
+    }
+    return writeOut(s, ret);
+}
+
+static void lz4End(struct compressStream *s)
+{
+    LZ4F_freeCompressionContext(s->u.lz4);
+}
+
+static int lz4Chunk(const struct compressParams *params, const unsigned char *in,
+                    size_t len, unsigned char **out, size_t *outLen)
+{
+    LZ4F_preferences_t prefs;
+    size_t bound, ret;
+
+    memset(&prefs, 0, sizeof(prefs));
+    prefs.compressionLevel = params->level;
+    prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+
+    bound = LZ4F_compressFrameBound(len, &prefs);
+    *out = malloc(bound);
+    if (*out == NULL)
+        return 1;
+
+    /* lz4(1) decompresses concatenated frames as one file */
+    ret = LZ4F_compressFrame(*out, bound, in, len, &prefs);
+    if (LZ4F_isError(ret))
+        return 1;
+    *outLen = ret;
+    return 0;
+}
+
+static int lz4Decode(int inFd, const char *inName, int outFd, const char *outName,
+                     struct decodeRange *range)
+{
+    unsigned char *inBuf = malloc(2 * COMPRESS_BUFSIZE);
+    unsigned char *outBuf = inBuf + COMPRESS_BUFSIZE;
+    LZ4F_dctx *dctx;
+    size_t ret = 0;
+    int failed = 1;
+
+    if (inBuf == NULL) {
+        message_OOM();
+        return 1;
+    }
+
+    ret = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+    if (LZ4F_isError(ret)) {
+        message(MESS_ERROR, "cannot initialize lz4 decompression: %s\n",
+                LZ4F_getErrorName(ret));
+        free(inBuf);
+        return 1;
+    }
+
+    for (;;) {
+        size_t pos = 0;
+        const ssize_t n_read = readIn(inFd, inName, inBuf, COMPRESS_BUFSIZE);
+        if (n_read < 0)
+            goto out;
+        if (n_read == 0)
+            break;
+
+        while (pos < (size_t) n_read) {
+            size_t srcSize = (size_t) n_read - pos;
+            size_t dstSize = COMPRESS_BUFSIZE;
+
+            ret = LZ4F_decompress(dctx, outBuf, &dstSize, inBuf + pos, &srcSize, NULL);
+            if (LZ4F_isError(ret)) {
+                message(MESS_ERROR, "lz4 decompression of %s failed: %s\n",
+                        inName, LZ4F_getErrorName(ret));
+                goto out;
+            }
+            if (writeDecoded(outFd, outName, outBuf, dstSize, range))
+                goto out;
+            pos += srcSize;
+        }
+    }
+
+    if (ret != 0) {
+        message(MESS_ERROR, "lz4 decompression of %s failed: "
+                "unexpected end of file\n", inName);
+        goto out;
+    }
+
+    failed = 0;
+out:
+    LZ4F_freeDecompressionContext(dctx);
+    free(inBuf);
+    return failed;
+}
+#endif /* HAVE_LIBLZ4 */
+
+static const struct compressBackend backends[] = {
+#ifdef HAVE_LIBZ
+    { "gzip", ".gz", 1, 6, 9, 0, 0, 0, 0, gzipInit, gzipUpdate, gzipEnd, gzipChunk, gzipDecode },
+#endif
+#ifdef HAVE_LIBLZMA
+    { "xz", ".xz", 0, 6, 9, 0, 1, 0, 0, xzInit, xzUpdate, xzEnd, NULL, xzDecode },
+#endif
+#ifdef HAVE_LIBZSTD
+    { "zstd", ".zst", 1, 3, 19, 1, 1, 1, 1, zstdInit, zstdUpdate, zstdEnd, zstdChunk, zstdDecode },
+#endif
+#ifdef HAVE_LIBLZ4
+    { "lz4", ".lz4", 1, 1, 12, 1, 0, 1, 0, lz4Init, lz4Update, lz4End, lz4Chunk, lz4Decode },
+#endif
+    { NULL, NULL, 0, 0, 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL }
+};
+
+/* return the built-in backend selected by "internal:NAME", or NULL if prog
+ * is an external command or names a backend not compiled in */
+const struct compressBackend *compressFindBackend(const char *prog)
+{
+    const size_t prefixLen = sizeof(COMPRESS_INTERNAL_PREFIX) - 1;
+    const struct compressBackend *b;
+
+    if (prog == NULL || strncmp(prog, COMPRESS_INTERNAL_PREFIX, prefixLen) != 0)
+        return NULL;
+
+    for (b = backends; b->name; b++) {
+        if (!strcmp(prog + prefixLen, b->name))
+            return b;
+    }
+
+    return NULL;
+}
+
+const char *compressBackendName(const struct compressBackend *backend)
+{
+    return backend->name;
+}
+
+const char *compressBackendExt(const struct compressBackend *backend)
+{
+    return backend->ext;
+}
+
+/* whether the backend compresses with the dictionary in compressParams */
+int compressBackendDictionaries(const struct compressBackend *backend)
+{
+    return backend->dictionaries;
+}
+
+/* whether the backend can write seekable files */
+int compressBackendSeekable(const struct compressBackend *backend)
+{
+    return backend->encChunk != NULL;
+}
+
+/* level of the backend for data which compresses well but should be quick */
+int compressBackendFastLevel(const struct compressBackend *backend)
+{
+    return backend->minLevel;
+}
+
+/* level of the backend for data which hardly compresses, like gzip's stored
+ * blocks */
+int compressBackendStoreLevel(const struct compressBackend *backend)
+{
+    return backend->storeLevel;
+}
+
+/* the built-in backend whose extension name ends with, or NULL */
+const struct compressBackend *compressFindBackendByExt(const char *name)
+{
+    const size_t nameLen = strlen(name);
+    const struct compressBackend *b;
+
+    for (b = backends; b->name; b++) {
+        const size_t extLen = strlen(b->ext);
+
+        if (nameLen > extLen && !strcmp(name + nameLen - extLen, b->ext))
+            return b;
+    }
+
+    return NULL;
+}
+
+/* space separated names of the built-in backends, for messages */
+const char *compressBackendList(void)
+{
+    static const char list[] = ""
+#ifdef HAVE_LIBZ
+        " gzip"
+#endif
+#ifdef HAVE_LIBLZMA
+        " xz"
+#endif
+#ifdef HAVE_LIBZSTD
+        " zstd"
+#endif
+#ifdef HAVE_LIBLZ4
+        " lz4"
+#endif
+        ;
+
+    return list[0] ? list + 1 : "none";
+}
+
+/* number of processes compressing at the same time, set by --device-jobs */
+static unsigned concurrentJobs = 1;
+
+void compressSetJobs(unsigned jobs)
+{
+    concurrentJobs = jobs ? jobs : 1;
+}
+
+/* Number of threads to compress with when requested are asked for, 0 meaning
+ * one per online CPU like in xz(1) and zstd(1).  All processes compressing
+ * at the same time together get no more threads than there are CPUs. */
+unsigned compressThreads(unsigned requested)
+{
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned share;
+
+    if (cpus <= 0)
+        return requested ? requested : 1;
+
+    share = (unsigned) cpus / concurrentJobs;
+    if (share == 0)
+        share = 1;
+    return requested == 0 || requested > share ? share : requested;
+}
+
+static int parseUnsigned(const char *str, unsigned *value)
+{
+    char *endptr;
+    unsigned long v;
+
+    errno = 0;
+    v = strtoul(str, &endptr, 10);
+    if (errno || *str == '\0' || *endptr != '\0' || v > UINT_MAX)
+        return 1;
+
+    *value = (unsigned) v;
+    return 0;
+}
+
+/* Translate compressoptions into level and threads, accepting the spelling
+ * gzip(1), xz(1), zstd(1) and lz4(1) use for them ("-9", "--best", "-T4",
+ * "--threads=4").  Options without a meaning for a built-in backend are
+ * ignored with a warning. */
+int compressParseOptions(struct compressParams *params,
+                         const struct compressBackend *backend,
+                         int argc, const char **argv)
+{
+    int i;
+
+    params->backend = backend;
+    params->level = backend->defaultLevel;
+    params->threads = 1;
+    params->ioLimit = 0;
+    params->seekable = 0;
+    params->tap = NULL;
+    params->tapArg = NULL;
+    params->dict = NULL;
+    params->dictSize = 0;
+
+    for (i = 0; i < argc; i++) {
+        const char *opt = argv[i];
+        unsigned value;
+
+        if (!strcmp(opt, "--fast")) {
+            params->level = backend->minLevel;
+        } else if (!strcmp(opt, "--best")) {
+            params->level = backend->maxLevel;
+        } else if (!strncmp(opt, "--threads=", 10)) {
+            if (parseUnsigned(opt + 10, &value))
+                goto bad_option;
+            params->threads = value;
+        } else if (!strncmp(opt, "-T", 2)) {
+            const char *arg = opt + 2;
+            if (*arg == '\0' && i + 1 < argc)
+                arg = argv[++i];
+            if (parseUnsigned(arg, &value))
+                goto bad_option;
+            params->threads = value;
+        } else if (opt[0] == '-' && opt[1] >= '0' && opt[1] <= '9') {
+            if (parseUnsigned(opt + 1, &value))
+                goto bad_option;
+            if ((int) value < backend->minLevel || (int) value > backend->maxLevel) {
+                message(MESS_ERROR, "compression level %u out of range %d-%d "
+                        "for internal %s compression\n", value,
+                        backend->minLevel, backend->maxLevel, backend->name);
+                return 1;
+            }
+            params->level = (int) value;
+        } else {
+            message(MESS_WARN, "ignoring compression option '%s' not supported "
+                    "by internal %s compression\n", opt, backend->name);
+        }
+        continue;
+
+bad_option:
+        message(MESS_ERROR, "bad compression option '%s'\n", opt);
+        return 1;
+    }
+
+    params->threads = compressThreads(params->threads);
+
+    return 0;
+}
+
+/* record the offsets of the next chunk in the index of a seekable stream */
+static int indexAdd(struct compressStream *s)
+{
+    if (s->indexLen + 2 > s->indexSize) {
+        const size_t size = s->indexSize ? 2 * s->indexSize : 64;
+        off_t *index = realloc(s->index, size * sizeof(*index));
+
+        if (index == NULL) {
+            message_OOM();
+            return 1;
+        }
+        s->index = index;
+        s->indexSize = size;
+    }
+    s->index[s->indexLen++] = s->uncompressedPos;
+    s->index[s->indexLen++] = s->compressedPos;
+    return 0;
+}
+
+static void *runJob(void *arg)
+{
+    struct compressJob *job = arg;
+
+    job->failed = job->params->backend->encChunk(job->params, job->in, job->len,
+                                                 &job->out, &job->outLen);
+    return NULL;
+}
+
+/* compress the input collected so far, one chunk per thread, and write the
+ * compressed chunks in order */
+static int compressJobs(struct compressStream *s)
+{
+    const size_t count = (s->inLen + COMPRESS_CHUNK - 1) / COMPRESS_CHUNK;
+    /* even empty input needs a gzip member or lz4 frame */
+    const size_t n = count ? count : 1;
+    int *started;
+    size_t i;
+    int failed = 0;
+
+    started = calloc(n, sizeof(*started));
+    if (started == NULL) {
+        message_OOM();
+        return 1;
+    }
+
+    for (i = 0; i < n; i++) {
+        struct compressJob *job = &s->jobs[i];
+
+        job->params = &s->params;
+        job->in = s->inBuf + i * COMPRESS_CHUNK;
+        job->len = s->inLen - i * COMPRESS_CHUNK < COMPRESS_CHUNK
+            ? s->inLen - i * COMPRESS_CHUNK : COMPRESS_CHUNK;
+        job->out = NULL;
+        job->outLen = 0;
+    }
+
+    /* the last chunk is compressed by this thread, as are the chunks no
+     * thread could be started for */
+#ifdef HAVE_PTHREAD
+    for (i = 0; i + 1 < n; i++)
+        started[i] = pthread_create(&s->jobs[i].thread, NULL, runJob, &s->jobs[i]) == 0;
+#endif
+    for (i = n; i-- > 0; ) {
+#ifdef HAVE_PTHREAD
+        if (started[i]) {
+            pthread_join(s->jobs[i].thread, NULL);
+            continue;
+        }
+#endif
+        runJob(&s->jobs[i]);
+    }
+
+    for (i = 0; i < n; i++) {
+        const struct compressJob *job = &s->jobs[i];
+
+        if (!failed && job->failed) {
+            message(MESS_ERROR, "%s compression of %s failed\n",
+                    s->params.backend->name, s->outName);
+            failed = 1;
+        }
+        if (!failed && full_write(s->outFd, job->out, job->outLen) != job->outLen) {
+            message(MESS_ERROR, "error writing to %s: %s\n", s->outName,
+                    strerror(errno));
+            failed = 1;
+        }
+        if (!failed && s->params.seekable && indexAdd(s))
+            failed = 1;
+        s->uncompressedPos += (off_t) job->len;
+        s->compressedPos += (off_t) job->outLen;
+        free(job->out);
+    }
+
+    free(started);
+    s->inLen = 0;
+    s->wroteChunk = 1;
+    return failed;
+}
+
+/* write the index of a seekable stream, see INDEX_MAGIC */
+static int writeIndex(struct compressStream *s)
+{
+    const int gzip = !s->params.backend->skippableFrames;
+    const size_t headerLen = gzip ? sizeof(indexGzipHeader) : 8;
+    const size_t trailerLen = gzip ? sizeof(indexGzipTrailer) : 0;
+    /* 2 offsets of at most 20 digits, a space and a newline per line */
+    const size_t textSize = sizeof(INDEX_MAGIC) + (s->indexLen / 2 + 1) * 42
+        + INDEX_FOOTER_LEN + 1;
+    char *frame = malloc(headerLen + textSize + trailerLen);
+    size_t len, i;
+    int failed = 0;
+
+    if (frame == NULL) {
+        message_OOM();
+        return 1;
+    }
+
+    len = headerLen;
+    len += (size_t) sprintf(frame + len, "%s\n", INDEX_MAGIC);
+    for (i = 0; i < s->indexLen; i += 2)
+        len += (size_t) sprintf(frame + len, "%jd %jd\n", (intmax_t) s->index[i],
+                                (intmax_t) s->index[i + 1]);
+    /* the end of the data frames */
+    len += (size_t) sprintf(frame + len, "%jd %jd\n", (intmax_t) s->uncompressedPos,
+                            (intmax_t) s->compressedPos);
+    len += (size_t) sprintf(frame + len, "%s %020ju\n", INDEX_FOOTER,
+                            (uintmax_t) (len + INDEX_FOOTER_LEN + trailerLen));
+
+    if (gzip) {
+        memcpy(frame, indexGzipHeader, headerLen);
+        memcpy(frame + len, indexGzipTrailer, trailerLen);
+        len += trailerLen;
+    } else {
+        const uint32_t magic = INDEX_SKIPPABLE_MAGIC;
+        const uint32_t size = (uint32_t) (len - headerLen);
+        unsigned char *p = (unsigned char *) frame;
+
+        for (i = 0; i < 4; i++) {
+            p[i] = (unsigned char) (magic >> (8 * i));
+            p[4 + i] = (unsigned char) (size >> (8 * i));
+        }
+    }
+
+    if (full_write(s->outFd, frame, len) != len) {
+        message(MESS_ERROR, "error writing to %s: %s\n", s->outName,
+                strerror(errno));
+        failed = 1;
+    }
+    free(frame);
+    return failed;
+}
+
+/* whether threads compress chunks of the input in parallel */
+static int compressParallel(const struct compressParams *params)
+{
+#ifdef HAVE_PTHREAD
+    return params->threads > 1;
+#else
+    (void) params;
+    return 0;
+#endif
+}
+
+struct compressStream *compressStreamOpen(const struct compressParams *params,
+                                          int outFd, const char *outName)
+{
+    struct compressStream *s = calloc(1, sizeof(*s));
+
+    if (s == NULL) {
+        message_OOM();
+        return NULL;
+    }
+
+    s->params = *params;
+    s->outFd = outFd;
+    s->outName = outName;
+    s->outSize = COMPRESS_BUFSIZE;
+    s->outBuf = malloc(s->outSize);
+    if (s->outBuf == NULL) {
+        message_OOM();
+        free(s);
+        return NULL;
+    }
+
+    if (params->backend->encChunk && (params->seekable
+            || (compressParallel(params) && !params->backend->libThreads))) {
+        /* like pigz(1), compress chunks in parallel into a stream of
+         * gzip members or zstd or lz4 frames */
+        s->inBuf = malloc((size_t) params->threads * COMPRESS_CHUNK);
+        s->jobs = calloc(params->threads, sizeof(*s->jobs));
+        if (s->inBuf == NULL || s->jobs == NULL) {
+            message_OOM();
+            free(s->inBuf);
+            free(s->jobs);
+            free(s->outBuf);
+            free(s);
+            return NULL;
+        }
+        return s;
+    }
+
+    if (params->backend->encInit(s)) {
+        free(s->outBuf);
+        free(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+int compressStreamWrite(struct compressStream *s, const void *buf, size_t len)
+{
+    const unsigned char *ptr = buf;
+
+    if (s->params.tap)
+        s->params.tap(s->params.tapArg, buf, len);
+
+    if (s->jobs) {
+        const size_t size = (size_t) s->params.threads * COMPRESS_CHUNK;
+
+        while (len > 0) {
+            const size_t n = len < size - s->inLen ? len : size - s->inLen;
+
+            memcpy(s->inBuf + s->inLen, ptr, n);
+            s->inLen += n;
+            ptr += n;
+            len -= n;
+            if (s->inLen == size && compressJobs(s))
+                return 1;
+        }
+        return 0;
+    }
+
+    /* zlib counts input in uInt, so never pass more than that at once */
+    while (len > 0) {
+        const size_t chunk = len < INT_MAX ? len : INT_MAX;
+        if (s->params.backend->encUpdate(s, ptr, chunk, COMPRESS_RUN))
+            return 1;
+        ptr += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+/* write out everything buffered, so that all input so far can be decoded
+ * from the output, even if the stream is never finished */
+int compressStreamFlush(struct compressStream *s)
+{
+    if (s->jobs)
+        return s->inLen ? compressJobs(s) : 0;
+    return s->params.backend->encUpdate(s, NULL, 0, COMPRESS_FLUSH);
+}
+
+/* write out everything buffered together with the trailer of the format */
+int compressStreamFinish(struct compressStream *s)
+{
+    if (s->jobs) {
+        if ((s->inLen || !s->wroteChunk) && compressJobs(s))
+            return 1;
+        return s->params.seekable ? writeIndex(s) : 0;
+    }
+    return s->params.backend->encUpdate(s, NULL, 0, COMPRESS_FINISH);
+}
+
+void compressStreamFree(struct compressStream *s)
+{
+    if (s == NULL)
+        return;
+
+    if (s->jobs == NULL)
+        s->params.backend->encEnd(s);
+    free(s->jobs);
+    free(s->index);
+    free(s->inBuf);
+    free(s->outBuf);
+    free(s);
+}
+
+struct compressFeed {
+    struct compressStream *stream;
+    const struct ioLimit *lim;
+};
+
+/* number and size of the blocks compressSampleEntropy() looks at */
+#define ENTROPY_SAMPLES 8
+#define ENTROPY_BLOCK (64 * 1024)
+
+/* Estimate how well the first size bytes of fd compress by the order-0
+ * entropy of a few blocks spread over them, in bits per byte: compressed
+ * data has close to 8, text logs about 5.  The blocks are read with pread(),
+ * which leaves the offset of fd alone.  Returns the average of the blocks,
+ * or -1 if fd cannot be read. */
+double compressSampleEntropy(int fd, const char *name, off_t size)
+{
+    unsigned char *buf;
+    double sum = 0;
+    unsigned blocks = 0;
+    off_t prev = -1;
+    unsigned i;
+
+    buf = malloc(ENTROPY_BLOCK);
+    if (buf == NULL) {
+        message_OOM();
+        return -1;
+    }
+
+    for (i = 0; i < ENTROPY_SAMPLES; i++) {
+        /* the first block at the start and the last one at the end */
+        const off_t off = size <= ENTROPY_BLOCK ? 0
+            : (size - ENTROPY_BLOCK) / (ENTROPY_SAMPLES - 1) * (off_t) i;
+        size_t counts[256];
+        double entropy = 0;
+        ssize_t n;
+        unsigned c;
+
+        if (off == prev)
+            continue;
+        prev = off;
+
+        do {
+            n = pread(fd, buf, ENTROPY_BLOCK, off);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) {
+            message(MESS_ERROR, "error reading %s: %s\n", name, strerror(errno));
+            free(buf);
+            return -1;
+        }
+        if (n == 0)
+            continue;
+
+        memset(counts, 0, sizeof(counts));
+        for (c = 0; c < (unsigned) n; c++)
+            counts[buf[c]]++;
+        for (c = 0; c < 256; c++) {
+            if (counts[c]) {
+                const double p = (double) counts[c] / (double) n;
+                entropy -= p * log2(p);
+            }
+        }
+        sum += entropy;
+        blocks++;
+    }
+
+    free(buf);
+    return blocks ? sum / blocks : 0;
+}
+
+/* uringConsumer feeding a compression stream */
+static int compressChunk(void *arg, const void *buf, size_t len)
+{
+    struct compressFeed *feed = arg;
+
+    ioLimitTransfer(feed->lim, len, 0);
+    return compressStreamWrite(feed->stream, buf, len);
+}
+
+/* compress everything readable from inFd into outFd */
+int compressFd(const struct compressParams *params, int inFd, const char *inName,
+               int outFd, const char *outName)
+{
+    struct compressStream *s;
+    struct ioLimit lim;
+    unsigned char *buf = NULL;
+    size_t bufSize;
+    int failed = 1;
+
+    message(MESS_DEBUG, "compressing %s internally with %s, level %d, "
+            "%u thread(s)\n", inName, params->backend->name, params->level,
+            params->threads);
+
+    s = compressStreamOpen(params, outFd, outName);
+    if (s == NULL)
+        return 1;
+
+    /* only the input is limited, the output is a fraction of it */
+    ioLimitInit(&lim, params->ioLimit, inFd, -1);
+
+    /* reads are queued at offsets, which a pipe does not have */
+    if (uringEnabled() && lseek(inFd, 0, SEEK_CUR) >= 0) {
+        /* the next chunks of input are read while one is compressed */
+        struct compressFeed feed;
+        int rc;
+
+        feed.stream = s;
+        feed.lim = &lim;
+        rc = uringReadAll(inFd, compressChunk, &feed);
+        if (rc < 0)
+            message(MESS_ERROR, "error reading %s: %s\n", inName, strerror(errno));
+        if (rc == 0)
+            failed = compressStreamFinish(s);
+        goto out;
+    }
+
+    bufSize = ioLimitChunk(&lim, COMPRESS_BUFSIZE);
+    buf = malloc(bufSize);
+    if (buf == NULL) {
+        message_OOM();
+        goto out;
+    }
+
+    for (;;) {
+        const ssize_t n_read = readIn(inFd, inName, buf, bufSize);
+        if (n_read < 0)
+            goto out;
+        if (n_read == 0)
+            break;
+        ioLimitTransfer(&lim, (size_t) n_read, 0);
+        if (compressStreamWrite(s, buf, (size_t) n_read))
+            goto out;
+    }
+
+    failed = compressStreamFinish(s);
+out:
+    compressStreamFree(s);
+    free(buf);
+    return failed;
+}
+
+int uncompressFd(const struct compressBackend *backend, int inFd, const char *inName,
+                 int outFd, const char *outName)
+{
+    struct decodeRange range = { 0, -1 };
+
+    message(MESS_DEBUG, "uncompressing %s internally with %s\n", inName,
+            backend->name);
+    return backend->decode(inFd, inName, outFd, outName, &range);
+}
+
+/* Uncompress the first length bytes of inFd into outFd.  As decompression
+ * stops there, inFd may go on with anything, like an unfinished stream. */
+int uncompressFdPrefix(const struct compressBackend *backend, int inFd,
+                       const char *inName, int outFd, const char *outName,
+                       off_t length)
+{
+    struct decodeRange range = { 0, length };
+
+    message(MESS_DEBUG, "uncompressing %jd bytes of %s internally with %s\n",
+            (intmax_t) length, inName, backend->name);
+    backend->decode(inFd, inName, outFd, outName, &range);
+    return range.left != 0;
+}
+
+/* Find the frame of the seekable file inFd holding the uncompressed offset
+ * in its index, see INDEX_MAGIC.  Returns the compressed offset of the frame
+ * and sets *frameStart to its uncompressed offset, or returns -1 if inFd has
+ * no valid index. */
+static off_t indexLookup(const struct compressBackend *backend, int inFd,
+                         off_t offset, off_t *frameStart)
+{
+    const size_t headerLen = backend->skippableFrames ? 8 : sizeof(indexGzipHeader);
+    const size_t trailerLen = backend->skippableFrames ? 0 : sizeof(indexGzipTrailer);
+    char tail[INDEX_FOOTER_LEN + sizeof(indexGzipTrailer)];
+    const size_t tailLen = INDEX_FOOTER_LEN + trailerLen;
+    struct stat sb;
+    uintmax_t frameSize;
+    char *text, *p, *end;
+    size_t textLen;
+    off_t pos = -1;
+
+    if (fstat(inFd, &sb) != 0 || sb.st_size < (off_t) tailLen
+            || pread(inFd, tail, tailLen, sb.st_size - (off_t) tailLen) != (ssize_t) tailLen
+            || memcmp(tail, INDEX_FOOTER " ", sizeof(INDEX_FOOTER)) != 0
+            || memcmp(tail + INDEX_FOOTER_LEN, indexGzipTrailer, trailerLen) != 0)
+        return -1;
+
+    frameSize = strtoumax(tail + sizeof(INDEX_FOOTER), &end, 10);
+    if (*end != '\n' || frameSize > (uintmax_t) sb.st_size
+            || frameSize < headerLen + sizeof(INDEX_MAGIC) + tailLen)
+        return -1;
+
+    textLen = (size_t) frameSize - headerLen - tailLen;
+    text = malloc(textLen + 1);
+    if (text == NULL) {
+        message_OOM();
+        return -1;
+    }
+    if (pread(inFd, text, textLen, sb.st_size - (off_t) frameSize + (off_t) headerLen)
+            != (ssize_t) textLen)
+        goto out;
+    text[textLen] = '\0';
+    if (strncmp(text, INDEX_MAGIC "\n", sizeof(INDEX_MAGIC)) != 0)
+        goto out;
+
+    /* the last frame starting at or before offset, or the end of the data */
+    for (p = text + sizeof(INDEX_MAGIC); *p; p = end + 1) {
+        const intmax_t u = strtoimax(p, &end, 10);
+        intmax_t c;
+
+        if (end == p || *end != ' ')
+            break;
+        p = end + 1;
+        c = strtoimax(p, &end, 10);
+        if (end == p || *end != '\n' || u > offset)
+            break;
+        *frameStart = (off_t) u;
+        pos = (off_t) c;
+    }
+
+out:
+    free(text);
+    return pos;
+}
+
+/* Uncompress inFd into outFd from the uncompressed offset on.  If inFd has
+ * been written seekable, decompression starts at the frame holding offset,
+ * otherwise everything before it is decompressed and thrown away. */
+int uncompressFdFrom(const struct compressBackend *backend, int inFd, const char *inName,
+                     int outFd, const char *outName, off_t offset)
+{
+    off_t frameStart = 0;
+    const off_t pos = offset > 0 ? indexLookup(backend, inFd, offset, &frameStart) : -1;
+    struct decodeRange range = { 0, -1 };
+
+    if (pos > 0) {
+        message(MESS_DEBUG, "frame at offset %jd of %s holds offset %jd\n",
+                (intmax_t) pos, inName, (intmax_t) offset);
+        if (lseek(inFd, pos, SEEK_SET) < 0) {
+            message(MESS_ERROR, "error seeking in %s: %s\n", inName, strerror(errno));
+            return 1;
+        }
+    } else {
+        frameStart = 0;
+    }
+
+    range.skip = offset - frameStart;
+    message(MESS_DEBUG, "uncompressing %s internally with %s\n", inName,
+            backend->name);
+    return backend->decode(inFd, inName, outFd, outName, &range);
+}
+
+/* vim: set et sw=4 ts=4: */
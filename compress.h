@@ -0,0 +1,65 @@
+#ifndef H_COMPRESS
+#define H_COMPRESS
+
+#include <sys/types.h>
+
+/* compresscmd/uncompresscmd values starting with this prefix select one of
+ * the compression backends built into logrotate instead of a command */
+#define COMPRESS_INTERNAL_PREFIX "internal:"
+
+struct compressBackend;
+struct compressStream;
+
+struct compressParams {
+    const struct compressBackend *backend;
+    int level;
+    unsigned threads;
+    off_t ioLimit;      /* bytes per second read from the input, 0 if unlimited */
+    int seekable;       /* write independent frames and an index of them */
+    /* called with all input before it is compressed, if not NULL */
+    void (*tap)(void *arg, const void *buf, size_t len);
+    void *tapArg;
+    /* dictionary to compress with if the backend takes one, else NULL */
+    const void *dict;
+    size_t dictSize;
+};
+
+const struct compressBackend *compressFindBackend(const char *prog);
+const char *compressBackendName(const struct compressBackend *backend);
+const char *compressBackendExt(const struct compressBackend *backend);
+int compressBackendDictionaries(const struct compressBackend *backend);
+int compressBackendSeekable(const struct compressBackend *backend);
+int compressBackendFastLevel(const struct compressBackend *backend);
+int compressBackendStoreLevel(const struct compressBackend *backend);
+const struct compressBackend *compressFindBackendByExt(const char *name);
+const char *compressBackendList(void);
+
+void compressSetJobs(unsigned jobs);
+unsigned compressThreads(unsigned requested);
+
+int compressParseOptions(struct compressParams *params,
+                         const struct compressBackend *backend,
+                         int argc, const char **argv);
+
+struct compressStream *compressStreamOpen(const struct compressParams *params,
+                                          int outFd, const char *outName);
+int compressStreamWrite(struct compressStream *s, const void *buf, size_t len);
+int compressStreamFlush(struct compressStream *s);
+int compressStreamFinish(struct compressStream *s);
+void compressStreamFree(struct compressStream *s);
+
+double compressSampleEntropy(int fd, const char *name, off_t size);
+
+int compressFd(const struct compressParams *params, int inFd, const char *inName,
+               int outFd, const char *outName);
+int uncompressFd(const struct compressBackend *backend, int inFd, const char *inName,
+                 int outFd, const char *outName);
+int uncompressFdPrefix(const struct compressBackend *backend, int inFd,
+                       const char *inName, int outFd, const char *outName,
+                       off_t length);
+int uncompressFdFrom(const struct compressBackend *backend, int inFd, const char *inName,
+                     int outFd, const char *outName, off_t offset);
+
+#endif
+
+/* vim: set et sw=4 ts=4: */
@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include <assert.h>
 #include <wchar.h>
@@ -24,6 +25,8 @@
 #include <sys/param.h>
 #endif
 
+#include "bloom.h"
+#include "compress.h"
 #include "log.h"
 #include "logrotate.h"
 
@@ -465,6 +468,20 @@ cleanup:
 
 }
 
+static const struct compressBackend *findInternalCompressor(const char *configFile,
+                                                            int lineNum, const char *prog)
+{
+    const struct compressBackend *backend = compressFindBackend(prog);
+
+    if (backend == NULL) {
+        message(MESS_ERROR, "%s:%d unknown internal compressor '%s'"
+                " (available: %s)\n", configFile, lineNum, prog,
+                compressBackendList());
+    }
+
+    return backend;
+}
+
 static char *readAddress(const char *configFile, int lineNum, const char *key,
                          char **startPtr, char **buf, size_t length)
 {
@@ -489,6 +506,29 @@ static char *readAddress(const char *configFile, int lineNum, const char *key,
     return address;
 }
 
+/* whether list is a comma separated list of CPU numbers and ranges like 0-3 */
+static int isCpuList(const char *list)
+{
+    for (;;) {
+        char *end;
+        const unsigned long first = strtoul(list, &end, 10);
+
+        if (!isdigit((unsigned char)*list))
+            return 0;
+        list = end;
+        if (*list == '-') {
+            list++;
+            if (!isdigit((unsigned char)*list) || strtoul(list, &end, 10) < first)
+                return 0;
+            list = end;
+        }
+        if (*list == '\0')
+            return 1;
+        if (*list++ != ',')
+            return 0;
+    }
+}
+
 static int do_mkdir(const char *path, mode_t mode, uid_t uid, gid_t gid) {
     if (mkdir(path, mode) == 0) {
         int fd;
@@ -621,6 +661,7 @@ static int copyLogInfo(struct logInfo *to, const struct logInfo *from)
 
     memset(to, 0, sizeof(*to));
     MEMBER_COPY(to->oldDir, from->oldDir);
+    MEMBER_COPY(to->trashDir, from->trashDir);
     to->criterium = from->criterium;
     to->weekday = from->weekday;
     to->monthday = from->monthday;
@@ -628,9 +669,17 @@ static int copyLogInfo(struct logInfo *to, const struct logInfo *from)
     to->minutes = from->minutes;
     to->minsize = from->minsize;
     to->maxsize = from->maxsize;
+    to->iolimit = from->iolimit;
+    to->trashRate = from->trashRate;
+    to->truncateStep = from->truncateStep;
+    to->copyTail = from->copyTail;
+    to->indexInterval = from->indexInterval;
     to->rotateCount = from->rotateCount;
     to->rotateMinAge = from->rotateMinAge;
     to->rotateAge = from->rotateAge;
+    to->recompressAge = from->recompressAge;
+    to->packOlder = from->packOlder;
+    to->catalogDays = from->catalogDays;
     to->logStart = from->logStart;
     MEMBER_COPY(to->pre, from->pre);
     MEMBER_COPY(to->post, from->post);
@@ -642,6 +691,7 @@ static int copyLogInfo(struct logInfo *to, const struct logInfo *from)
     MEMBER_COPY(to->compress_prog, from->compress_prog);
     MEMBER_COPY(to->uncompress_prog, from->uncompress_prog);
     MEMBER_COPY(to->compress_ext, from->compress_ext);
+    to->compressThreads = from->compressThreads;
     to->flags = from->flags;
     to->shred_cycles = from->shred_cycles;
     to->createMode = from->createMode;
@@ -649,6 +699,11 @@ static int copyLogInfo(struct logInfo *to, const struct logInfo *from)
     to->createGid = from->createGid;
     to->suUid = from->suUid;
     to->suGid = from->suGid;
+    to->childNice = from->childNice;
+    to->childIoClass = from->childIoClass;
+    to->childIoPriority = from->childIoPriority;
+    MEMBER_COPY(to->childCpuAffinity, from->childCpuAffinity);
+    MEMBER_COPY(to->childCgroup, from->childCgroup);
     to->olddirMode = from->olddirMode;
     to->olddirUid = from->olddirUid;
     to->olddirGid = from->olddirGid;
@@ -662,7 +717,18 @@ static int copyLogInfo(struct logInfo *to, const struct logInfo *from)
         }
     }
 
+    if (from->recompress_count) {
+        poptDupArgv(from->recompress_count, from->recompress_list,
+                    &to->recompress_count, &to->recompress_list);
+        if (to->recompress_list == NULL) {
+            message_OOM();
+            rv = 1;
+        }
+    }
+
     MEMBER_COPY(to->dateformat, from->dateformat);
+    MEMBER_COPY(to->indexFormat, from->indexFormat);
+    MEMBER_COPY(to->bloomPattern, from->bloomPattern);
 
     to->list = from->list;
 
@@ -675,6 +741,7 @@ static void freeLogInfo(struct logInfo *log)
     free(log->pattern);
     free_2d_array(log->files, log->numFiles);
     free(log->oldDir);
+    free(log->trashDir);
     free(log->pre);
     free(log->post);
     free(log->first);
@@ -686,7 +753,17 @@ static void freeLogInfo(struct logInfo *log)
     free(log->uncompress_prog);
     free(log->compress_ext);
     free(log->compress_options_list);
+    free(log->recompress_list);
     free(log->dateformat);
+    if (log->dateExt) {
+        free(log->dateExt->format);
+        free(log->dateExt->pattern);
+        free(log->dateExt);
+    }
+    free(log->indexFormat);
+    free(log->bloomPattern);
+    free(log->childCpuAffinity);
+    free(log->childCgroup);
 }
 
 static struct logInfo *newLogInfo(const struct logInfo *template)
@@ -756,6 +833,155 @@ static void set_criterium(enum criterium *pDst, enum criterium src, int *pSet)
     *pSet = 1;
 }
 
+/*
+ * Compile the dateext suffix of log from its dateformat, or from the default
+ * format of its criterium: the format for strftime(3), with the conversions
+ * not of a fixed number of digits taken literally, and the glob pattern
+ * matching the suffixes of its rotated logs.  Done once per log definition
+ * instead of on every rotation.
+ */
+static int compileDateExt(struct logInfo *log, const char *configFile,
+                          int lineNum)
+{
+    struct dateExt *dext;
+    const char *p;
+    size_t f = 0, g = 0;
+
+    dext = calloc(1, sizeof(*dext));
+    if (dext == NULL) {
+        message_OOM();
+        return 1;
+    }
+
+    if (log->dateformat) {
+        p = log->dateformat;
+        dext->sortByDate = 1;
+    } else if (log->criterium == ROT_HOURLY) {
+        /* hourly adds another two digits */
+        p = "-%Y%m%d%H";
+    } else if (log->criterium == ROT_MINUTES) {
+        /* minutes adds another four digits */
+        p = "-%Y%m%d%H%M";
+    } else {
+        /* the default dateformat */
+        p = "-%Y%m%d";
+    }
+
+    /* every character makes at most two of the format and, as %s, fifty
+     * of the pattern */
+    dext->format = malloc(2 * strlen(p) + 1);
+    dext->pattern = malloc(25 * strlen(p) + 1);
+    if (dext->format == NULL || dext->pattern == NULL) {
+        message_OOM();
+        goto error;
+    }
+
+    while (*p == ' ')
+        p++;
+    while (*p != '\0') {
+        const char *sign = NULL;
+        int digits = 0;
+
+        if (*p == '%') {
+            switch (p[1]) {
+                case 'Y':
+                case 'G':
+                    digits = 4;
+                    break;
+                case 'y':
+                case 'g':
+                case 'm':
+                case 'd':
+                case 'H':
+                case 'M':
+                case 'S':
+                case 'V':
+                case 'U':
+                case 'W':
+                    digits = 2;
+                    break;
+                case 'j':
+                    digits = 3;
+                    break;
+                case 'u':
+                case 'w':
+                    digits = 1;
+                    break;
+                case 's':
+                    /* End of year 2286 this pattern does not work. */
+                    digits = 10;
+                    break;
+                case 'z':
+                    sign = "[-+]";
+                    digits = 4;
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        if (digits == 0) {
+            /* a character or an unknown conversion, taken literally */
+            if (*p == '%')
+                dext->format[f++] = '%';
+            dext->format[f++] = *p;
+            dext->pattern[g++] = *p;
+            dext->length++;
+            p++;
+            continue;
+        }
+
+        dext->format[f++] = *p++;
+        dext->format[f++] = *p++;
+        if (sign) {
+            memcpy(dext->pattern + g, sign, strlen(sign));
+            g += strlen(sign);
+            dext->length++;
+        }
+        for (; digits > 0; digits--) {
+            memcpy(dext->pattern + g, "[0-9]", 5);
+            g += 5;
+            dext->length++;
+        }
+    }
+    dext->format[f] = '\0';
+    dext->pattern[g] = '\0';
+
+    if (dext->length >= DATEEXT_LEN) {
+        message(MESS_ERROR, "%s:%d Date format %s is too long\n",
+                configFile, lineNum, log->dateformat);
+        goto error;
+    }
+    if (log->dateformat)
+        message(MESS_DEBUG, "Converted '%s' -> '%s'\n", log->dateformat,
+                dext->format);
+
+    log->dateExt = dext;
+    return 0;
+
+error:
+    free(dext->format);
+    free(dext->pattern);
+    free(dext);
+    return 1;
+}
+
+/*
+ * Parse the dateext suffix at the start of str into tm.  Returns the end of
+ * the suffix, or NULL if str does not start with one.
+ */
+const char *matchDateExt(const struct dateExt *dext, const char *str,
+                         struct tm *tm)
+{
+    const char *end;
+
+    memset(tm, 0, sizeof(*tm));
+    end = strptime(str, dext->format, tm);
+    if (end == NULL || (size_t)(end - str) != dext->length)
+        return NULL;
+    return end;
+}
+
 static int readConfigPath(const char *path, struct logInfo *defConfig)
 {
     struct stat sb;
@@ -893,14 +1119,23 @@ int readAllConfigPaths(const char **paths)
         .files = NULL,
         .numFiles = 0,
         .oldDir = NULL,
+        .trashDir = NULL,
         .criterium = ROT_SIZE,
         .threshold = 1024 * 1024,
         .minutes = 0,
         .minsize = 0,
         .maxsize = 0,
+        .iolimit = -1,
+        .trashRate = -1,
+        .truncateStep = 0,
+        .copyTail = 0,
+        .indexInterval = 1024 * 1024,
         .rotateCount = 0,
         .rotateMinAge = 0,
         .rotateAge = 0,
+        .recompressAge = 0,
+        .packOlder = 0,
+        .catalogDays = 0,
         .logStart = 1,
         .pre = NULL,
         .post = NULL,
@@ -913,7 +1148,10 @@ int readAllConfigPaths(const char **paths)
         .compress_prog = NULL,
         .uncompress_prog = NULL,
         .compress_ext = NULL,
+        .compressThreads = -1,
         .dateformat = NULL,
+        .indexFormat = NULL,
+        .bloomPattern = NULL,
         .flags = LOG_FLAG_IFEMPTY,
         .shred_cycles = 0,
         .createMode = NO_MODE,
@@ -924,8 +1162,15 @@ int readAllConfigPaths(const char **paths)
         .olddirGid = NO_GID,
         .suUid = NO_UID,
         .suGid = NO_GID,
+        .childNice = CHILD_NICE_UNSET,
+        .childIoClass = 0,
+        .childIoPriority = -1,
+        .childCpuAffinity = NULL,
+        .childCgroup = NULL,
         .compress_options_list = NULL,
-        .compress_options_count = 0
+        .compress_options_count = 0,
+        .recompress_list = NULL,
+        .recompress_count = 0
     };
 
     tabooPatterns = malloc(sizeof(*tabooPatterns) * defTabooCount);
@@ -1281,6 +1526,30 @@ static int readConfigFile(const char *configFile, struct logInfo *defConfig)
                         newlog->flags |= LOG_FLAG_SHRED;
                     } else if (!strcmp(key, "noshred")) {
                         newlog->flags &= ~LOG_FLAG_SHRED;
+                    } else if (!strcmp(key, "dropcache")) {
+                        newlog->flags |= LOG_FLAG_DROPCACHE;
+                    } else if (!strcmp(key, "nodropcache")) {
+                        newlog->flags &= ~LOG_FLAG_DROPCACHE;
+                    } else if (!strcmp(key, "compressinplace")) {
+                        newlog->flags |= LOG_FLAG_COMPRESSINPLACE;
+                    } else if (!strcmp(key, "nocompressinplace")) {
+                        newlog->flags &= ~LOG_FLAG_COMPRESSINPLACE;
+                    } else if (!strcmp(key, "streamcompress")) {
+                        newlog->flags |= LOG_FLAG_STREAMCOMPRESS;
+                    } else if (!strcmp(key, "nostreamcompress")) {
+                        newlog->flags &= ~LOG_FLAG_STREAMCOMPRESS;
+                    } else if (!strcmp(key, "seekable")) {
+                        newlog->flags |= LOG_FLAG_SEEKABLE;
+                    } else if (!strcmp(key, "noseekable")) {
+                        newlog->flags &= ~LOG_FLAG_SEEKABLE;
+                    } else if (!strcmp(key, "adaptivecompress")) {
+                        newlog->flags |= LOG_FLAG_ADAPTIVECOMPRESS;
+                    } else if (!strcmp(key, "noadaptivecompress")) {
+                        newlog->flags &= ~LOG_FLAG_ADAPTIVECOMPRESS;
+                    } else if (!strcmp(key, "compressdict")) {
+                        newlog->flags |= LOG_FLAG_COMPRESSDICT;
+                    } else if (!strcmp(key, "nocompressdict")) {
+                        newlog->flags &= ~LOG_FLAG_COMPRESSDICT;
                     } else if (!strcmp(key, "allowhardlink")) {
                         newlog->flags |= LOG_FLAG_ALLOWHARDLINK;
                     } else if (!strcmp(key, "noallowhardlink")) {
@@ -1324,8 +1593,33 @@ static int readConfigFile(const char *configFile, struct logInfo *defConfig)
                         newlog->dateformat = isolateValue(configFile, lineNum,
                                                           key, &start, &buf,
                                                           length);
+                    } else if (!strcmp(key, "index")) {
+                        freeLogItem(indexFormat);
+                        newlog->indexFormat = isolateValue(configFile, lineNum,
+                                                           key, &start, &buf,
+                                                           length);
+                    } else if (!strcmp(key, "noindex")) {
+                        freeLogItem(indexFormat);
+                    } else if (!strcmp(key, "bloom")) {
+                        char error[128];
+
+                        freeLogItem(bloomPattern);
+                        newlog->bloomPattern = isolateValue(configFile, lineNum,
+                                                            key, &start, &buf,
+                                                            length);
+                        if (newlog->bloomPattern
+                                && bloomCheckPattern(newlog->bloomPattern, error,
+                                                     sizeof(error))) {
+                            message(MESS_ERROR, "%s:%d bad bloom pattern '%s': %s\n",
+                                    configFile, lineNum, newlog->bloomPattern, error);
+                            RAISE_ERROR();
+                        }
+                    } else if (!strcmp(key, "nobloom")) {
+                        freeLogItem(bloomPattern);
                     } else if (!strcmp(key, "noolddir")) {
                         freeLogItem(oldDir);
+                    } else if (!strcmp(key, "notrashdir")) {
+                        freeLogItem(trashDir);
                     } else if (!strcmp(key, "mailfirst")) {
                         newlog->flags |= LOG_FLAG_MAILFIRST;
                     } else if (!strcmp(key, "maillast")) {
@@ -1404,7 +1698,10 @@ static int readConfigFile(const char *configFile, struct logInfo *defConfig)
                     } else if (!strcmp(key, "nocreate")) {
                         newlog->flags &= ~LOG_FLAG_CREATE;
                     } else if (!strcmp(key, "size") || !strcmp(key, "minsize") ||
-                            !strcmp(key, "maxsize")) {
+                            !strcmp(key, "maxsize") || !strcmp(key, "iolimit") ||
+                            !strcmp(key, "trashrate") ||
+                            !strcmp(key, "truncatestep") || !strcmp(key, "copytail") ||
+                            !strcmp(key, "indexinterval")) {
                         char *opt = key;
 
                         key = isolateValue(configFile, lineNum, opt, &start, &buf, length);
@@ -1442,6 +1739,22 @@ static int readConfigFile(const char *configFile, struct logInfo *defConfig)
                                 newlog->threshold = size;
                             } else if (!strncmp(opt, "maxsize", 7)) {
                                 newlog->maxsize = size;
+                            } else if (!strcmp(opt, "iolimit")) {
+                                newlog->iolimit = size;
+                            } else if (!strcmp(opt, "trashrate")) {
+                                newlog->trashRate = size;
+                            } else if (!strcmp(opt, "truncatestep")) {
+                                newlog->truncateStep = size;
+                            } else if (!strcmp(opt, "copytail")) {
+                                newlog->copyTail = size;
+                            } else if (!strcmp(opt, "indexinterval")) {
+                                if (size == 0) {
+                                    message(MESS_ERROR, "%s:%d indexinterval must "
+                                            "not be 0\n", configFile, lineNum);
+                                    free(opt);
+                                    RAISE_ERROR();
+                                }
+                                newlog->indexInterval = size;
                             } else {
                                 newlog->minsize = size;
                             }
@@ -1464,6 +1777,87 @@ static int readConfigFile(const char *configFile, struct logInfo *defConfig)
                                     configFile, lineNum, key);
                             RAISE_ERROR();
                         }
+                    } else if (!strcmp(key, "nice")) {
+                        long niceness;
+
+                        free(key);
+                        key = isolateValue(configFile, lineNum, "nice value",
+                                           &start, &buf, length);
+                        if (key == NULL) {
+                            RAISE_ERROR();
+                        }
+                        niceness = strtol(key, &chptr, 10);
+                        if (key[0] == '\0' || *chptr != '\0' || niceness < -20 || niceness > 19) {
+                            message(MESS_ERROR, "%s:%d bad nice value '%s'\n",
+                                    configFile, lineNum, key);
+                            RAISE_ERROR();
+                        }
+                        newlog->childNice = (int)niceness;
+                    } else if (!strcmp(key, "ioclass")) {
+                        free(key);
+                        key = isolateValue(configFile, lineNum, "I/O class",
+                                           &start, &buf, length);
+                        if (key == NULL) {
+                            RAISE_ERROR();
+                        }
+                        if (!strcmp(key, "realtime")) {
+                            newlog->childIoClass = CHILD_IOCLASS_REALTIME;
+                        } else if (!strcmp(key, "best-effort")) {
+                            newlog->childIoClass = CHILD_IOCLASS_BEST_EFFORT;
+                        } else if (!strcmp(key, "idle")) {
+                            newlog->childIoClass = CHILD_IOCLASS_IDLE;
+                        } else if (!strcmp(key, "none")) {
+                            newlog->childIoClass = 0;
+                        } else {
+                            message(MESS_ERROR, "%s:%d unknown I/O class '%s'\n",
+                                    configFile, lineNum, key);
+                            RAISE_ERROR();
+                        }
+                    } else if (!strcmp(key, "iopriority")) {
+                        unsigned long prio;
+
+                        free(key);
+                        key = isolateValue(configFile, lineNum, "I/O priority",
+                                           &start, &buf, length);
+                        if (key == NULL) {
+                            RAISE_ERROR();
+                        }
+                        prio = strtoul(key, &chptr, 10);
+                        if (!isdigit((unsigned char)key[0]) || *chptr != '\0' || prio > 7) {
+                            message(MESS_ERROR, "%s:%d bad I/O priority '%s'\n",
+                                    configFile, lineNum, key);
+                            RAISE_ERROR();
+                        }
+                        newlog->childIoPriority = (int)prio;
+                    } else if (!strcmp(key, "cpuaffinity")) {
+                        free(key);
+                        key = isolateValue(configFile, lineNum, "CPU list",
+                                           &start, &buf, length);
+                        if (key == NULL) {
+                            RAISE_ERROR();
+                        }
+                        if (!isCpuList(key)) {
+                            message(MESS_ERROR, "%s:%d bad CPU list '%s'\n",
+                                    configFile, lineNum, key);
+                            RAISE_ERROR();
+                        }
+                        freeLogItem(childCpuAffinity);
+                        newlog->childCpuAffinity = key;
+                        key = NULL;
+                    } else if (!strcmp(key, "cgroup")) {
+                        free(key);
+                        key = readPath(configFile, lineNum, "cgroup", &start, &buf, length);
+                        if (key == NULL) {
+                            RAISE_ERROR();
+                        }
+                        if (key[0] != '/') {
+                            message(MESS_ERROR, "%s:%d cgroup directory '%s' is not"
+                                    " an absolute path\n", configFile, lineNum, key);
+                            RAISE_ERROR();
+                        }
+                        freeLogItem(childCgroup);
+                        newlog->childCgroup = key;
+                        key = NULL;
                     } else if (!strcmp(key, "hourly")) {
                         set_criterium(&newlog->criterium, ROT_HOURLY, &criterium_set);
                     } else if (!strcmp(key, "minutes")) {
@@ -1584,6 +1978,81 @@ static int readConfigFile(const char *configFile, struct logInfo *defConfig)
                                     configFile, lineNum, start);
                             RAISE_ERROR();
                         }
+                    } else if (!strcmp(key, "recompress")) {
+                        const char **argv = NULL;
+                        int argc = 0;
+
+                        free(newlog->recompress_list);
+                        newlog->recompress_list = NULL;
+                        newlog->recompress_count = 0;
+
+                        free(key);
+                        key = isolateValue(configFile, lineNum, "recompress", &start,
+                                           &buf, length);
+                        if (key == NULL) {
+                            RAISE_ERROR();
+                        }
+                        if (poptParseArgvString(key, &argc, &argv) || argc < 2) {
+                            free(argv);
+                            message(MESS_ERROR, "%s:%d recompress needs an age in days "
+                                    "and a command\n", configFile, lineNum);
+                            RAISE_ERROR();
+                        }
+                        newlog->recompressAge = (int)strtoul(argv[0], &chptr, 0);
+                        if (*chptr != '\0' || newlog->recompressAge <= 0) {
+                            message(MESS_ERROR, "%s:%d bad recompress age '%s'\n",
+                                    configFile, lineNum, argv[0]);
+                            free(argv);
+                            RAISE_ERROR();
+                        }
+                        if (!strncmp(argv[1], COMPRESS_INTERNAL_PREFIX,
+                                     strlen(COMPRESS_INTERNAL_PREFIX)) &&
+                                !findInternalCompressor(configFile, lineNum, argv[1])) {
+                            free(argv);
+                            RAISE_ERROR();
+                        }
+                        /* the age is kept apart, the list starts with the command */
+                        poptDupArgv(argc - 1, argv + 1, &newlog->recompress_count,
+                                    &newlog->recompress_list);
+                        free(argv);
+                        if (newlog->recompress_list == NULL) {
+                            message_OOM();
+                            RAISE_ERROR();
+                        }
+                    } else if (!strcmp(key, "norecompress")) {
+                        free(newlog->recompress_list);
+                        newlog->recompress_list = NULL;
+                        newlog->recompress_count = 0;
+                    } else if (!strcmp(key, "packolder")) {
+                        free(key);
+                        key = isolateValue(configFile, lineNum, "packolder count", &start,
+                                           &buf, length);
+                        if (key == NULL) {
+                            RAISE_ERROR();
+                        }
+                        newlog->packOlder = (int)strtoul(key, &chptr, 0);
+                        if (*chptr != '\0' || newlog->packOlder <= 0) {
+                            message(MESS_ERROR, "%s:%d bad packolder count '%s'\n",
+                                    configFile, lineNum, start);
+                            RAISE_ERROR();
+                        }
+                    } else if (!strcmp(key, "nopackolder")) {
+                        newlog->packOlder = 0;
+                    } else if (!strcmp(key, "catalog")) {
+                        free(key);
+                        key = isolateValue(configFile, lineNum, "catalog days", &start,
+                                           &buf, length);
+                        if (key == NULL) {
+                            RAISE_ERROR();
+                        }
+                        newlog->catalogDays = (int)strtoul(key, &chptr, 0);
+                        if (*chptr != '\0' || newlog->catalogDays <= 0) {
+                            message(MESS_ERROR, "%s:%d bad catalog days '%s'\n",
+                                    configFile, lineNum, start);
+                            RAISE_ERROR();
+                        }
+                    } else if (!strcmp(key, "nocatalog")) {
+                        newlog->catalogDays = 0;
                     } else if (!strcmp(key, "errors")) {
                         message(MESS_WARN,
                                 "%s: %d: the errors directive is deprecated and no longer used.\n",
@@ -1791,6 +2260,17 @@ static int readConfigFile(const char *configFile, struct logInfo *defConfig)
                         }
 
                         message(MESS_DEBUG, "olddir is now %s\n", newlog->oldDir);
+                    } else if (!strcmp(key, "trashdir")) {
+                        freeLogItem(trashDir);
+
+                        if (!(newlog->trashDir = readPath(configFile, lineNum,
+                                        "trashdir", &start, &buf, length))) {
+                            RAISE_ERROR();
+                        }
+
+                        if (expand_home_relative_path(&newlog->trashDir)) {
+                            RAISE_ERROR();
+                        }
                     } else if (!strcmp(key, "extension")) {
                         free(key);
                         key = isolateValue(configFile, lineNum, "extension name", &start,
@@ -1832,6 +2312,24 @@ static int readConfigFile(const char *configFile, struct logInfo *defConfig)
                         message(MESS_DEBUG, "compress_prog is now %s\n",
                                 newlog->compress_prog);
 
+                        if (!strncmp(newlog->compress_prog, COMPRESS_INTERNAL_PREFIX,
+                                     strlen(COMPRESS_INTERNAL_PREFIX))) {
+                            const struct compressBackend *backend;
+
+                            if (!(backend = findInternalCompressor(configFile, lineNum,
+                                                                   newlog->compress_prog))) {
+                                RAISE_ERROR();
+                            }
+                            freeLogItem (compress_ext);
+                            newlog->compress_ext = strdup(compressBackendExt(backend));
+                            if (newlog->compress_ext == NULL) {
+                                message_OOM();
+                                RAISE_ERROR();
+                            }
+                            message(MESS_DEBUG, "compress_ext was changed to %s\n", newlog->compress_ext);
+                            continue;
+                        }
+
                         compresscmd_full = strdup(newlog->compress_prog);
                         if (compresscmd_full == NULL) {
                             message_OOM();
@@ -1869,6 +2367,13 @@ static int readConfigFile(const char *configFile, struct logInfo *defConfig)
                         message(MESS_DEBUG, "uncompress_prog is now %s\n",
                                 newlog->uncompress_prog);
 
+                        if (!strncmp(newlog->uncompress_prog, COMPRESS_INTERNAL_PREFIX,
+                                     strlen(COMPRESS_INTERNAL_PREFIX)) &&
+                                !findInternalCompressor(configFile, lineNum,
+                                                        newlog->uncompress_prog)) {
+                            RAISE_ERROR();
+                        }
+
                     } else if (!strcmp(key, "compressoptions")) {
                         char *options;
 
@@ -1895,6 +2400,19 @@ static int readConfigFile(const char *configFile, struct logInfo *defConfig)
                         message(MESS_DEBUG, "compress_options is now %s\n",
                                 options);
                         free(options);
+                    } else if (!strcmp(key, "compressthreads")) {
+                        free(key);
+                        key = isolateValue(configFile, lineNum, "compress threads",
+                                           &start, &buf, length);
+                        if (key == NULL) {
+                            RAISE_ERROR();
+                        }
+                        newlog->compressThreads = (int)strtoul(key, &chptr, 10);
+                        if (key[0] == '\0' || *chptr != '\0' || newlog->compressThreads < 0) {
+                            message(MESS_ERROR, "%s:%d bad compress threads '%s'\n",
+                                    configFile, lineNum, key);
+                            RAISE_ERROR();
+                        }
                     } else if (!strcmp(key, "compressext")) {
                         freeLogItem (compress_ext);
 
@@ -2207,6 +2725,10 @@ duperror:
                         }
                     }
 
+                    if ((newlog->flags & LOG_FLAG_DATEEXT)
+                            && compileDateExt(newlog, configFile, lineNum))
+                        goto error;
+
                     criterium_set = 0;
                     newlog = defConfig;
                     state = STATE_DEFINITION_END;
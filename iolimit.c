@@ -0,0 +1,144 @@
+#include "queue.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "iolimit.h"
+#include "log.h"
+
+/* smallest amount of data moved between two checks of a limit */
+#define IOLIMIT_MIN_CHUNK (64 * 1024)
+
+/* token bucket of one backing device; it holds at most one second worth of
+ * transfers, a negative fill level is slept off before the next transfer */
+struct ioBucket {
+    dev_t dev;
+    double tokens;
+    struct timespec last;
+    LIST_ENTRY(ioBucket) list;
+};
+
+static LIST_HEAD(ioBucketHead, ioBucket) buckets = LIST_HEAD_INITIALIZER(buckets);
+
+/* limit of logs without their own iolimit, set by --io-limit */
+static off_t defaultRate;
+
+/* number of processes sharing a limit, set by --device-jobs */
+static unsigned shares = 1;
+
+void ioLimitSetDefault(off_t rate)
+{
+    defaultRate = rate;
+}
+
+void ioLimitSetShares(unsigned count)
+{
+    shares = count ? count : 1;
+}
+
+/* effective limit of a log configured with iolimit (negative if unset) */
+off_t ioLimitRate(off_t configured)
+{
+    return configured >= 0 ? configured : defaultRate;
+}
+
+static double secondsSince(const struct timespec *then, const struct timespec *now)
+{
+    return (double) (now->tv_sec - then->tv_sec)
+        + (double) (now->tv_nsec - then->tv_nsec) / 1e9;
+}
+
+static struct ioBucket *findBucket(dev_t dev, off_t rate)
+{
+    struct ioBucket *b;
+
+    LIST_FOREACH(b, &buckets, list) {
+        if (b->dev == dev)
+            return b;
+    }
+
+    b = malloc(sizeof(*b));
+    if (b == NULL) {
+        message_OOM();
+        return NULL;
+    }
+    b->dev = dev;
+    b->tokens = (double) rate;
+    clock_gettime(CLOCK_MONOTONIC, &b->last);
+    LIST_INSERT_HEAD(&buckets, b, list);
+    return b;
+}
+
+/* take bytes out of the bucket of dev and wait until they are covered */
+static void ioLimitCharge(dev_t dev, off_t rate, size_t bytes)
+{
+    struct ioBucket *b;
+    struct timespec now;
+
+    if (rate <= 0 || bytes == 0 || (b = findBucket(dev, rate)) == NULL)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    b->tokens += secondsSince(&b->last, &now) * (double) rate;
+    if (b->tokens > (double) rate)
+        b->tokens = (double) rate;
+    b->last = now;
+
+    b->tokens -= (double) bytes;
+    if (b->tokens < 0) {
+        const double wait = -b->tokens / (double) rate;
+        struct timespec ts;
+
+        ts.tv_sec = (time_t) wait;
+        ts.tv_nsec = (long) ((wait - (double) ts.tv_sec) * 1e9);
+        while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+            ;
+
+        b->tokens = 0;
+        clock_gettime(CLOCK_MONOTONIC, &b->last);
+    }
+}
+
+/* prepare lim for moving data from srcFd to destFd, either may be -1 */
+void ioLimitInit(struct ioLimit *lim, off_t rate, int srcFd, int destFd)
+{
+    struct stat sb;
+
+    lim->rate = rate > 0 ? rate / (off_t) shares : 0;
+    if (rate > 0 && lim->rate == 0)
+        lim->rate = 1;
+    lim->hasSrc = srcFd >= 0 && fstat(srcFd, &sb) == 0;
+    lim->srcDev = lim->hasSrc ? sb.st_dev : 0;
+    lim->hasDest = destFd >= 0 && fstat(destFd, &sb) == 0;
+    lim->destDev = lim->hasDest ? sb.st_dev : 0;
+}
+
+/* largest amount of data to move at once, so that a limit is enforced
+ * smoothly instead of in bursts of chunk bytes */
+size_t ioLimitChunk(const struct ioLimit *lim, size_t chunk)
+{
+    size_t limited;
+
+    if (lim == NULL || lim->rate == 0)
+        return chunk;
+
+    limited = (size_t) (lim->rate / 10);
+    if (limited < IOLIMIT_MIN_CHUNK)
+        limited = IOLIMIT_MIN_CHUNK;
+    return limited < chunk ? limited : chunk;
+}
+
+/* account for a transfer, sleeping as long as the devices are over limit */
+void ioLimitTransfer(const struct ioLimit *lim, size_t bytesRead, size_t bytesWritten)
+{
+    if (lim == NULL || lim->rate == 0)
+        return;
+
+    if (lim->hasSrc)
+        ioLimitCharge(lim->srcDev, lim->rate, bytesRead);
+    if (lim->hasDest)
+        ioLimitCharge(lim->destDev, lim->rate, bytesWritten);
+}
+
+/* vim: set et sw=4 ts=4: */
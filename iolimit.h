@@ -0,0 +1,25 @@
+#ifndef H_IOLIMIT
+#define H_IOLIMIT
+
+#include <sys/types.h>
+
+/* bandwidth limit of a transfer between two files, see ioLimitInit() */
+struct ioLimit {
+    off_t rate;         /* bytes per second and device, 0 for no limit */
+    int hasSrc;
+    dev_t srcDev;
+    int hasDest;
+    dev_t destDev;
+};
+
+void ioLimitSetDefault(off_t rate);
+void ioLimitSetShares(unsigned count);
+off_t ioLimitRate(off_t configured);
+
+void ioLimitInit(struct ioLimit *lim, off_t rate, int srcFd, int destFd);
+size_t ioLimitChunk(const struct ioLimit *lim, size_t chunk);
+void ioLimitTransfer(const struct ioLimit *lim, size_t bytesRead, size_t bytesWritten);
+
+#endif
+
+/* vim: set et sw=4 ts=4: */
@@ -8,7 +8,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
 #include <sys/file.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <time.h>
@@ -18,15 +20,45 @@
 #include <sys/types.h>
 #include <utime.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <libgen.h>
 #include <signal.h>
 
+#ifdef HAVE_POSIX_SPAWN
+#include <spawn.h>
+#endif
+
+#ifdef HAVE_SCHED_SETAFFINITY
+#include <sched.h>
+#endif
+
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
 #if !defined(PATH_MAX) && defined(__FreeBSD__)
 #include <sys/param.h>
 #endif
 
+#include "compress.h"
 #include "log.h"
 #include "logrotate.h"
+#include "uring.h"
+#include "iolimit.h"
+#include "trash.h"
+#include "timeindex.h"
+#include "bloom.h"
+#include "zstddict.h"
+#include "pack.h"
 
 static char *prev_context;
 #ifdef WITH_SELINUX
@@ -61,12 +93,29 @@ extern int asprintf(char **str, const char *fmt, ...);
 /* Number of seconds in a day */
 #define DAY_SECONDS 86400
 
+/* suffix of the file next to the state file holding the catalogs */
+#define CATALOG_EXT ".catalog"
+
+/* entry of the catalog of rotated logs, see catalog in logrotate(8) */
+struct rotatedFile {
+    char *name;
+    int generation;         /* number of numbered logs, 0 with dateext */
+    time_t mtime;
+    off_t size;
+    int compressed;
+    int gone;               /* removed in this run, dropped by catalogPrune() */
+};
+
 struct logState {
     char *fn;
     struct tm lastRotated;  /* only tm_hour, tm_mday, tm_mon, tm_year are good! */
     struct stat sb;
     int doRotate;
     int isUsed;     /* True if there is real log file in system for this state. */
+    struct rotatedFile *rotated;    /* dateext logs oldest first */
+    size_t rotatedCount;
+    char *catalogKey;       /* glob pattern the rotated logs were found with */
+    time_t catalogScanned;  /* last scan of the directory, 0 if not kept */
     LIST_ENTRY(logState) list;
 };
 
@@ -78,11 +127,6 @@ struct logNames {
     char *baseName;
 };
 
-struct compData {
-    size_t prefix_len;
-    const char *dformat;
-};
-
 static struct logStateList {
     LIST_HEAD(stateSet, logState) head;
 } **states;
@@ -105,37 +149,54 @@ static int globerr(const char *pathname, int theerr)
     return 1;
 }
 
-/* We could switch to qsort_r to get rid of this global variable,
- * but qsort_r is not portable enough (Linux vs. *BSD vs ...)... */
-static struct compData _compData;
+/* glob match with the date in its name as sort key */
+struct globKey {
+    time_t time;
+    size_t index;       /* in the glob result, keeps the order of equal dates */
+    char *path;
+};
 
-static int compGlobResult(const void *result1, const void *result2)  {
-    struct tm time_tmp;
-    time_t t1, t2;
-    const char *r1 = *(char * const*)(result1);
-    const char *r2 = *(char * const*)(result2);
+static int compGlobKey(const void *key1, const void *key2)
+{
+    const struct globKey *k1 = key1;
+    const struct globKey *k2 = key2;
 
-    memset(&time_tmp, 0, sizeof(struct tm));
-    strptime(r1 + _compData.prefix_len, _compData.dformat, &time_tmp);
-    t1 = mktime(&time_tmp);
+    if (k1->time != k2->time)
+        return k1->time < k2->time ? -1 : 1;
+    return (k1->index > k2->index) - (k1->index < k2->index);
+}
 
-    memset(&time_tmp, 0, sizeof(struct tm));
-    strptime(r2 + _compData.prefix_len, _compData.dformat, &time_tmp);
-    t2 = mktime(&time_tmp);
+/* Sort the matches of a glob by the dateext suffix following prefix_len in
+ * their names, if dext asks for it.  Each name is parsed and converted with
+ * mktime() once, not on every comparison. */
+static void sortGlobResult(glob_t *result, size_t prefix_len,
+                           const struct dateExt *dext) {
+    struct globKey *keys;
+    size_t i;
 
-    if (t1 < t2) return -1;
-    if (t1 > t2) return  1;
-    return 0;
-}
+    if (!dext->sortByDate || result->gl_pathc < 2) {
+        return;
+    }
 
-static void sortGlobResult(glob_t *result, size_t prefix_len, const char *dformat) {
-    if (!dformat || *dformat == '\0') {
+    keys = malloc(result->gl_pathc * sizeof(*keys));
+    if (keys == NULL) {
+        message_OOM();
         return;
     }
 
-    _compData.prefix_len = prefix_len;
-    _compData.dformat = dformat;
-    qsort(result->gl_pathv, result->gl_pathc, sizeof(char *), compGlobResult);
+    for (i = 0; i < result->gl_pathc; i++) {
+        struct tm time_tmp;
+
+        matchDateExt(dext, result->gl_pathv[i] + prefix_len, &time_tmp);
+        keys[i].time = mktime(&time_tmp);
+        keys[i].index = i;
+        keys[i].path = result->gl_pathv[i];
+    }
+
+    qsort(keys, result->gl_pathc, sizeof(*keys), compGlobKey);
+    for (i = 0; i < result->gl_pathc; i++)
+        result->gl_pathv[i] = keys[i].path;
+    free(keys);
 }
 
 int switch_user(uid_t user, gid_t group) {
@@ -222,10 +283,19 @@ static int switch_user_back_permanently(void) {
 }
 
 static int open_logfile(const char *path, const struct logInfo *log, int write_access) {
+    const int open_flags = O_NOFOLLOW | O_NOCTTY | O_NONBLOCK | (write_access ? O_RDWR : O_RDONLY);
     int fd, flags;
     struct stat sb;
 
-    fd = open(path, O_NOFOLLOW | O_NOCTTY | O_NONBLOCK | (write_access ? O_RDWR : O_RDONLY));
+#ifdef O_NOATIME
+    /* reading a log to rotate it is no access worth recording, but only the
+     * owner of the file or a privileged process may open it that way */
+    fd = open(path, open_flags | O_NOATIME);
+    if (fd < 0 && errno == EPERM)
+        fd = open(path, open_flags);
+#else
+    fd = open(path, open_flags);
+#endif
     if (fd < 0)
         return fd;
 
@@ -346,6 +416,31 @@ static int hashIndex(const char *fn)
     return (int)(hash % hashSize);
 }
 
+/* with dropcache, hint that fd is going to be read once from start to end */
+static void adviseSequential(int fd, const struct logInfo *log)
+{
+#ifdef HAVE_POSIX_FADVISE
+    if (log->flags & LOG_FLAG_DROPCACHE)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#else
+    (void) fd;
+    (void) log;
+#endif
+}
+
+/* with dropcache, evict the pages of fd from the page cache; only clean pages
+ * can be dropped, so files just written have to be synced before */
+static void dropCache(int fd, const struct logInfo *log)
+{
+#ifdef HAVE_POSIX_FADVISE
+    if (log->flags & LOG_FLAG_DROPCACHE)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#else
+    (void) fd;
+    (void) log;
+#endif
+}
+
 /* safe implementation of dup2(oldfd, nefd) followed by close(oldfd) */
 static void movefd(int oldfd, int newfd)
 {
@@ -359,6 +454,285 @@ static void movefd(int oldfd, int newfd)
         close(oldfd);
 }
 
+extern char **environ;
+
+/* how the credentials of a child process are adjusted before exec */
+enum childCreds {
+    CHILD_CREDS_LOG_USER,       /* switch_user_permanently() */
+    CHILD_CREDS_ROOT            /* switch_user_back_permanently() */
+};
+
+/* value for spawnChild() fds[] to close the standard descriptor */
+#define CHILD_FD_CLOSE (-2)
+
+/* move the calling process into the cgroup v2 directory cgroup */
+static int enterCgroup(const char *cgroup)
+{
+    char *procs = NULL;
+    char pid[32];
+    int fd, n;
+
+    if (asprintf(&procs, "%s/cgroup.procs", cgroup) < 0) {
+        message_OOM();
+        return 1;
+    }
+
+    fd = open(procs, O_WRONLY | O_CLOEXEC);
+    free(procs);
+    n = snprintf(pid, sizeof(pid), "%ld\n", (long) getpid());
+    if (fd < 0 || full_write(fd, pid, (size_t)n) != (size_t)n) {
+        message(MESS_ERROR, "cannot move child into cgroup %s: %s\n", cgroup,
+                strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return 1;
+    }
+    close(fd);
+    return 0;
+}
+
+/* restrict the calling process to the CPUs in list, e.g. "0-3,6" */
+static int setCpuAffinity(const char *list)
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+    cpu_set_t set;
+    const char *p = list;
+
+    CPU_ZERO(&set);
+    for (;;) {
+        char *end;
+        unsigned long cpu = strtoul(p, &end, 10);
+        unsigned long last = cpu;
+
+        if (*end == '-')
+            last = strtoul(end + 1, &end, 10);
+        for (; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, &set);
+        if (*end != ',')
+            break;
+        p = end + 1;
+    }
+
+    if (sched_setaffinity(0, sizeof(set), &set) == 0)
+        return 0;
+    message(MESS_ERROR, "cannot set CPU affinity of child to %s: %s\n", list,
+            strerror(errno));
+#else
+    message(MESS_ERROR, "cannot set CPU affinity of child to %s: %s\n", list,
+            strerror(ENOSYS));
+#endif
+    return 1;
+}
+
+/* set the I/O scheduling class and priority of the calling process */
+static int setIoPriority(int ioClass, int ioPriority)
+{
+#if defined(HAVE_SYS_SYSCALL_H) && defined(SYS_ioprio_set)
+    /* from linux/ioprio.h, which is not always installed */
+    const int whoProcess = 1, classShift = 13;
+
+    if (ioClass == 0)
+        ioClass = CHILD_IOCLASS_BEST_EFFORT;
+    /* the idle class has no priorities, the others default to 4 */
+    if (ioClass == CHILD_IOCLASS_IDLE)
+        ioPriority = 0;
+    else if (ioPriority < 0)
+        ioPriority = 4;
+    if (syscall(SYS_ioprio_set, whoProcess, 0, (ioClass << classShift) | ioPriority) == 0)
+        return 0;
+    message(MESS_ERROR, "cannot set I/O priority of child: %s\n", strerror(errno));
+#else
+    (void) ioClass;
+    (void) ioPriority;
+    message(MESS_ERROR, "cannot set I/O priority of child: %s\n", strerror(ENOSYS));
+#endif
+    return 1;
+}
+
+static int applyChildProfileNow(const struct logInfo *log)
+{
+    if (log->childCgroup && enterCgroup(log->childCgroup))
+        return 1;
+
+    if (log->childCpuAffinity && setCpuAffinity(log->childCpuAffinity))
+        return 1;
+
+    if ((log->childIoClass != 0 || log->childIoPriority >= 0)
+        && setIoPriority(log->childIoClass, log->childIoPriority))
+        return 1;
+
+    if (log->childNice != CHILD_NICE_UNSET
+        && setpriority(PRIO_PROCESS, 0, log->childNice) != 0) {
+        message(MESS_ERROR, "cannot set nice value of child to %d: %s\n",
+                log->childNice, strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+/* apply the resource profile of log to a freshly forked child, before it
+ * drops its privileges.  With su the child runs as the su user, who may not
+ * enter the cgroup or raise priorities, so the profile is applied with the
+ * credentials logrotate started with and the su user is switched to again
+ * afterwards. */
+static int applyChildProfile(const struct logInfo *log)
+{
+    const uid_t euid = geteuid();
+    const gid_t egid = getegid();
+    int rc;
+
+    if (!(log->flags & LOG_FLAG_SU) || (euid == save_euid && egid == save_egid))
+        return applyChildProfileNow(log);
+
+    /* the euid goes first, as it takes root to change the egid */
+    if (seteuid(save_euid) || setegid(save_egid)) {
+        message(MESS_ERROR, "error switching euid back to %u and egid to %u "
+                "(pid %d): %s\n", (unsigned) save_euid, (unsigned) save_egid,
+                getpid(), strerror(errno));
+        return 1;
+    }
+    rc = applyChildProfileNow(log);
+    if (setegid(egid) || seteuid(euid)) {
+        message(MESS_ERROR, "error switching euid to %u and egid to %u "
+                "(pid %d): %s\n", (unsigned) euid, (unsigned) egid, getpid(),
+                strerror(errno));
+        return 1;
+    }
+    return rc;
+}
+
+#ifdef HAVE_POSIX_SPAWN
+/* whether children of log run with a resource profile (nice, ioclass, ...) */
+static int childHasProfile(const struct logInfo *log)
+{
+    return log->childNice != CHILD_NICE_UNSET || log->childIoClass != 0
+        || log->childIoPriority >= 0 || log->childCpuAffinity != NULL
+        || log->childCgroup != NULL;
+}
+
+/* whether the child has to switch credentials or apply a resource profile,
+ * which posix_spawn() cannot */
+static int childNeedsFork(const struct logInfo *log, enum childCreds creds)
+{
+    if (childHasProfile(log))
+        return 1;
+
+    if (!(log->flags & LOG_FLAG_SU))
+        return 0;
+
+    if (creds == CHILD_CREDS_LOG_USER)
+        return getuid() != geteuid() || getgid() != getegid()
+            || geteuid() != log->suUid || getegid() != log->suGid;
+
+    return creds == CHILD_CREDS_ROOT
+        && (geteuid() != save_euid || getegid() != save_egid);
+}
+#endif
+
+/*
+ * Start argv[0] (searched in PATH) as a child process.  fds[] are installed
+ * as stdin, stdout and stderr of the child like by movefd(), -1 keeps the
+ * inherited descriptor and CHILD_FD_CLOSE closes it.  closeFds[] are
+ * descriptors of the parent the child must not keep open.  If envp is NULL
+ * the environment of logrotate is passed on.
+ *
+ * Children which run with the credentials of logrotate are started with
+ * posix_spawnp(3), which avoids copying the page tables of the parent.  Only
+ * if the credentials need to be changed or the resource profile of log
+ * (nice, ioclass, iopriority, cpuaffinity, cgroup) applied before exec the
+ * child is forked.
+ *
+ * Returns the pid of the child or -1 after logging an error.
+ */
+static pid_t spawnChild(const struct logInfo *log, enum childCreds creds,
+                        const char *what, char *const argv[], char *const envp[],
+                        const int fds[3], const int closeFds[], int closeFdsCount)
+{
+    pid_t pid;
+    int i;
+
+#ifdef HAVE_POSIX_SPAWN
+    if (!childNeedsFork(log, creds)) {
+        posix_spawn_file_actions_t actions;
+        int rc;
+
+        if ((rc = posix_spawn_file_actions_init(&actions)) != 0) {
+            message(MESS_ERROR, "cannot spawn %s: %s\n", what, strerror(rc));
+            return -1;
+        }
+
+        for (i = 0; i < closeFdsCount && rc == 0; i++)
+            rc = posix_spawn_file_actions_addclose(&actions, closeFds[i]);
+        for (i = 0; i < 3 && rc == 0; i++) {
+            if (fds[i] == CHILD_FD_CLOSE)
+                rc = posix_spawn_file_actions_addclose(&actions, i);
+            else if (fds[i] >= 0 && fds[i] != i) {
+                rc = posix_spawn_file_actions_adddup2(&actions, fds[i], i);
+                if (rc == 0)
+                    rc = posix_spawn_file_actions_addclose(&actions, fds[i]);
+            }
+        }
+
+        if (rc == 0)
+            rc = posix_spawnp(&pid, argv[0], &actions, NULL, argv,
+                              envp ? envp : environ);
+        posix_spawn_file_actions_destroy(&actions);
+
+        if (rc != 0) {
+            message(MESS_ERROR, "cannot execute %s '%s': %s\n", what, argv[0],
+                    strerror(rc));
+            return -1;
+        }
+        return pid;
+    }
+#endif
+
+    pid = fork();
+
+    if (pid == -1) {
+        message(MESS_ERROR, "cannot fork: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (pid == 0) {
+        for (i = 0; i < closeFdsCount; i++)
+            close(closeFds[i]);
+        for (i = 0; i < 2; i++) {
+            if (fds[i] == CHILD_FD_CLOSE)
+                close(i);
+            else if (fds[i] >= 0)
+                movefd(fds[i], i);
+        }
+
+        if (applyChildProfile(log) != 0)
+            exit(1);
+
+        if (creds == CHILD_CREDS_LOG_USER) {
+            if (switch_user_permanently(log) != 0)
+                exit(1);
+        } else if (creds == CHILD_CREDS_ROOT && (log->flags & LOG_FLAG_SU)) {
+            if (switch_user_back_permanently() != 0)
+                exit(1);
+        }
+
+        /* stderr is redirected last so credential errors are still shown */
+        if (fds[2] == CHILD_FD_CLOSE)
+            close(STDERR_FILENO);
+        else if (fds[2] >= 0)
+            movefd(fds[2], STDERR_FILENO);
+
+        if (envp)
+            environ = (char **) envp;
+        execvp(argv[0], argv);
+        message(MESS_ERROR, "cannot execute %s '%s': %s\n", what, argv[0],
+                strerror(errno));
+        exit(1);
+    }
+
+    return pid;
+}
+
 #ifdef WITH_SELINUX
 static int setSecCtx(char *srcCtx, char **pPrevCtx)
 {
@@ -490,6 +864,10 @@ static struct logState *newState(const char *fn)
 
     new->doRotate = 0;
     new->isUsed = 0;
+    new->rotated = NULL;
+    new->rotatedCount = 0;
+    new->catalogKey = NULL;
+    new->catalogScanned = 0;
 
     memset(&new->lastRotated, 0, sizeof(new->lastRotated));
     new->lastRotated.tm_hour = now.tm_hour;
@@ -528,99 +906,486 @@ static struct logState *findState(const char *fn)
     return p;
 }
 
-static int waitpid_checked(pid_t pid, const char **errmsg)
+/*
+ * With catalog, the rotated logs of a log are kept in a catalog next to the
+ * state file, and rotate and maxage are applied to it instead of searching
+ * the directory on every rotation.  The catalog follows what logrotate does
+ * to the rotated logs, and is built anew from the directory once it is older
+ * than the days given to catalog, as others may add or remove rotated logs
+ * in between.  A rotated log is checked to still exist before removing it.
+ */
+
+static void catalogClear(struct logState *state)
 {
-    int status;
+    size_t i;
 
-    if (waitpid(pid, &status, 0) < 0) {
-        *errmsg = strerror(errno);
-        return -1;
-    }
+    for (i = 0; i < state->rotatedCount; i++)
+        free(state->rotated[i].name);
+    free(state->rotated);
+    free(state->catalogKey);
+    state->rotated = NULL;
+    state->rotatedCount = 0;
+    state->catalogKey = NULL;
+    state->catalogScanned = 0;
+}
 
-    if (!WIFEXITED(status)) {
-        *errmsg = "child did not terminate normally";
-        return -2;
-    }
+static struct rotatedFile *catalogFind(const struct logState *state, const char *name)
+{
+    size_t i;
 
-    if (WEXITSTATUS(status) != 0) {
-        *errmsg = "child did not exit with status 0";
-        return -3;
+    for (i = 0; i < state->rotatedCount; i++) {
+        if (!state->rotated[i].gone && !strcmp(state->rotated[i].name, name))
+            return state->rotated + i;
     }
+    return NULL;
+}
 
-    *errmsg = NULL;
+/* add name to the end of the catalog of state, or update it */
+static int catalogAppend(struct logState *state, const char *name, int generation,
+                         time_t mtime, off_t size, int compressed)
+{
+    struct rotatedFile *f = catalogFind(state, name);
+
+    if (f == NULL) {
+        struct rotatedFile *more = realloc(state->rotated,
+                                           (state->rotatedCount + 1) * sizeof(*more));
+        if (more == NULL) {
+            message_OOM();
+            return 1;
+        }
+        state->rotated = more;
+        f = more + state->rotatedCount;
+        if ((f->name = strdup(name)) == NULL) {
+            message_OOM();
+            return 1;
+        }
+        f->gone = 0;
+        state->rotatedCount++;
+    }
+    f->generation = generation;
+    f->mtime = mtime;
+    f->size = size;
+    f->compressed = compressed;
     return 0;
 }
 
-static int runScript(const struct logInfo *log, const char *logfn,
-                     const char *logrotfn, const char *script, const char **errmsg)
+/* forget the rotated logs removed in this run */
+static void catalogPrune(struct logState *state)
 {
-    pid_t pid;
+    size_t i, kept = 0;
 
-    if (debug) {
-        message(MESS_DEBUG, "running script with args %s %s: \"%s\"\n",
-                logfn, logrotfn ? logrotfn : "", script);
-        return 0;
+    for (i = 0; i < state->rotatedCount; i++) {
+        if (state->rotated[i].gone)
+            free(state->rotated[i].name);
+        else
+            state->rotated[kept++] = state->rotated[i];
     }
+    state->rotatedCount = kept;
+}
 
-    pid = fork();
+/* the rotated log name was created or changed, keep the catalog up to date */
+static void catalogRecord(struct logState *state, const char *name, int generation,
+                          int compressed)
+{
+    struct stat sb;
 
-    if (pid == -1) {
-        message(MESS_ERROR, "cannot fork: %s\n", strerror(errno));
-        return -1;
+    if (!state->catalogScanned)
+        return;
+
+    if (stat(name, &sb) == 0) {
+        if (catalogAppend(state, name, generation, sb.st_mtime, sb.st_size, compressed))
+            /* found again by the next run */
+            catalogClear(state);
+    } else if (errno != ENOENT) {
+        message(MESS_ERROR, "cannot stat %s: %s\n", name, strerror(errno));
+        catalogClear(state);
     }
+}
 
-    if (pid == 0) {
-        if (log->flags & LOG_FLAG_SU) {
-            if (switch_user_back_permanently() != 0) {
-                exit(1);
-            }
-        }
-        execl("/bin/sh", "sh", "-c", (char *) script, "logrotate_script", (char *) logfn, (char *) logrotfn, (char *) NULL);
-        message(MESS_ERROR, "cannot execute sub-shell: %s\n", strerror(errno));
-        exit(1);
+/* catalogRecord() of name with ext appended, as done by compressing it */
+static void catalogRecordExt(struct logState *state, const char *name, const char *ext,
+                             int generation)
+{
+    char *fullName;
+
+    if (!state->catalogScanned)
+        return;
+    if (asprintf(&fullName, "%s%s", name, ext) < 0) {
+        message_OOM();
+        catalogClear(state);
+        return;
     }
+    catalogRecord(state, fullName, generation, *ext != '\0');
+    free(fullName);
+}
+
+/* highest number of the numbered rotated logs in the catalog of state */
+static int catalogLastGeneration(const struct logState *state)
+{
+    int last = 0;
+    size_t i;
 
-    return waitpid_checked(pid, errmsg);
+    for (i = 0; i < state->rotatedCount; i++) {
+        if (state->rotated[i].generation > last)
+            last = state->rotated[i].generation;
+    }
+    return last;
 }
 
-#ifdef WITH_ACL
-static int is_acl_well_supported(int err)
+/* the rotated log name was removed */
+static void catalogDrop(struct logState *state, const char *name)
 {
-    switch (err) {
-        case ENOTSUP:   /* no file system support */
-        case EINVAL:    /* acl does not point to a valid ACL */
-        case ENOSYS:    /* compatibility - acl_(g|s)et_fd(3) should never return this */
-        case EBUSY:     /* compatibility - acl_(g|s)et_fd(3) should never return this */
-            return 0;
-        default:
-            return 1;
+    struct rotatedFile *f = catalogFind(state, name);
+
+    if (f != NULL) {
+        f->gone = 1;
+        catalogPrune(state);
     }
 }
-#endif /* WITH_ACL */
 
-static int createOutputFile(const char *fileName, int flags, const struct stat *sb,
-                            acl_type acl, int force_mode)
+/* the rotated log oldName was renamed to newName */
+static void catalogMove(struct logState *state, const char *oldName,
+                        const char *newName, int generation)
 {
-    int fd = -1;
-    struct stat sb_create;
-    int acl_set = 0;
-    int i;
+    struct rotatedFile *f;
+    char *name;
 
-    for (i = 0; i < 2; ++i) {
-        struct tm now;
-        size_t fileName_size, buf_size;
-        char *backupName, *ptr;
+    catalogDrop(state, newName);
+    if ((f = catalogFind(state, oldName)) == NULL)
+        return;
+    if ((name = strdup(newName)) == NULL) {
+        message_OOM();
+        catalogClear(state);
+        return;
+    }
+    free(f->name);
+    f->name = name;
+    f->generation = generation;
+}
 
-        fd = open(fileName, (flags | O_CREAT | O_EXCL | O_NOFOLLOW),
-                (S_IRUSR | S_IWUSR) & sb->st_mode);
+/*
+ * Build the catalog of state from the rotated logs matching pattern.  Their
+ * names continue after prefixLen with the dateext suffix dext, by which
+ * they are sorted, or without dext with their number, followed by
+ * suffixLen characters.  It is kept for later runs if log asks for it.
+ */
+static int catalogScan(const struct logInfo *log, struct logState *state,
+                       const char *pattern, size_t prefixLen, size_t suffixLen,
+                       const struct dateExt *dext, int compressed)
+{
+    glob_t globResult;
+    size_t i;
+    int rc;
 
-        if ((fd >= 0) || (errno != EEXIST))
-            break;
+    catalogClear(state);
+    rc = glob(pattern, 0, globerr, &globResult);
+    if (rc == GLOB_NOMATCH) {
+        globResult.gl_pathc = 0;
+    } else if (rc != 0) {
+        return 1;
+    } else if (dext != NULL) {
+        sortGlobResult(&globResult, prefixLen, dext);
+    }
 
-        /* the destination file already exists, while it should not */
-        localtime_r(&nowSecs, &now);
-        fileName_size = strlen(fileName);
-        buf_size = fileName_size + sizeof("-YYYYMMDDHH.backup");
+    for (i = 0; i < globResult.gl_pathc; i++) {
+        const char *name = globResult.gl_pathv[i];
+        const size_t len = strlen(name);
+        struct stat sb;
+        long generation = 0;
+
+        if (dext == NULL) {
+            char *end;
+
+            if (len <= prefixLen + suffixLen
+                    || !isdigit((unsigned char)name[prefixLen]))
+                continue;
+            generation = strtol(name + prefixLen, &end, 10);
+            if (end != name + len - suffixLen || generation > INT_MAX)
+                continue;
+        }
+
+        if (stat(name, &sb) != 0)
+            continue;
+        if (catalogAppend(state, name, (int)generation, sb.st_mtime, sb.st_size,
+                          compressed)) {
+            globfree(&globResult);
+            catalogClear(state);
+            return 1;
+        }
+    }
+    if (rc == 0)
+        globfree(&globResult);
+
+    if ((state->catalogKey = strdup(pattern)) == NULL) {
+        message_OOM();
+        catalogClear(state);
+        return 1;
+    }
+    if (log->catalogDays > 0) {
+        state->catalogScanned = nowSecs;
+        message(MESS_DEBUG, "cataloged %zu rotated logs matching %s\n",
+                state->rotatedCount, pattern);
+    }
+    return 0;
+}
+
+/* whether the catalog of state still lists the rotated logs matching pattern */
+static int catalogCurrent(const struct logInfo *log, const struct logState *state,
+                          const char *pattern)
+{
+    if (log->catalogDays <= 0 || !state->catalogScanned
+            || state->catalogKey == NULL || strcmp(state->catalogKey, pattern))
+        return 0;
+    return difftime(nowSecs, state->catalogScanned) < (double)log->catalogDays * DAY_SECONDS;
+}
+
+/* Get the rotated log name like stat(2), but from the catalog if one is kept.
+ * Only the time and size are set then, unless full asks for all of sb.  Names
+ * missing from the catalog are looked up, as others may have put them there. */
+static int statRotated(const struct logState *state, const char *name,
+                       struct stat *sb, int full)
+{
+    const struct rotatedFile *f;
+
+    if (!state->catalogScanned)
+        return stat(name, sb);
+
+    f = catalogFind(state, name);
+    if (f == NULL || full)
+        return stat(name, sb);
+    memset(sb, 0, sizeof(*sb));
+    sb->st_mode = S_IFREG;
+    sb->st_mtime = f->mtime;
+    sb->st_size = f->size;
+    return 0;
+}
+
+/* write str in double quotes, escaped as unescape() expects it */
+static int writeQuoted(FILE *f, const char *str)
+{
+    const char *chptr;
+    int error = fputc('"', f) == EOF;
+
+    for (chptr = str; *chptr && error == 0; chptr++) {
+        switch (*chptr) {
+            case '"':
+            case '\\':
+                error = fputc('\\', f) == EOF;
+                break;
+            case '\n':
+                error = fputc('\\', f) == EOF;
+                if (error == 0) {
+                    error = fputc('n', f) == EOF;
+                }
+                continue;
+            default:
+                break;
+        }
+        if (error == 0 && fputc(*chptr, f) == EOF) {
+            error = 1;
+        }
+    }
+
+    if (error == 0 && fputc('"', f) == EOF)
+        error = 1;
+
+    return error;
+}
+
+/* write the catalog of p, if one is kept, for readCatalogLine() */
+static int writeCatalogOf(FILE *f, const struct logState *p)
+{
+    size_t i;
+    int error;
+
+    if (!p->catalogScanned)
+        return 0;
+
+    error = writeQuoted(f, p->fn)
+        || fprintf(f, " %jd ", (intmax_t)p->catalogScanned) < 0
+        || writeQuoted(f, p->catalogKey)
+        || fputc('\n', f) == EOF;
+    for (i = 0; i < p->rotatedCount && error == 0; i++) {
+        const struct rotatedFile *r = p->rotated + i;
+
+        if (r->gone)
+            continue;
+        error = fputs("  ", f) == EOF
+            || writeQuoted(f, r->name)
+            || fprintf(f, " %d %jd %jd %d\n", r->generation, (intmax_t)r->mtime,
+                       (intmax_t)r->size, r->compressed) < 0;
+    }
+    return error;
+}
+
+/* Read a line written by writeCatalogOf() into the catalog of *current, the
+ * state of the log the following lines belong to.  Returns 0 on success. */
+static int readCatalogLine(const char *buf, struct logState **current)
+{
+    const char **argv = NULL;
+    char *name = NULL;
+    intmax_t secs, size;
+    int argc;
+    int generation, compressed;
+    char c;
+    int rc = 1;
+
+    if (poptParseArgvString(buf, &argc, &argv))
+        return 1;
+
+    if (argc == 3) {
+        if (sscanf(argv[1], "%jd%c", &secs, &c) != 1 || secs <= 0)
+            goto out;
+        if ((name = strdup(argv[0])) == NULL) {
+            message_OOM();
+            goto out;
+        }
+        unescape(name);
+        if ((*current = findState(name)) == NULL)
+            goto out;
+        catalogClear(*current);
+        if (((*current)->catalogKey = strdup(argv[2])) == NULL) {
+            message_OOM();
+            goto out;
+        }
+        unescape((*current)->catalogKey);
+        (*current)->catalogScanned = (time_t)secs;
+        rc = 0;
+    } else if (argc == 5 && *current != NULL) {
+        if (sscanf(argv[1], "%d%c", &generation, &c) != 1
+                || sscanf(argv[2], "%jd%c", &secs, &c) != 1
+                || sscanf(argv[3], "%jd%c", &size, &c) != 1
+                || sscanf(argv[4], "%d%c", &compressed, &c) != 1)
+            goto out;
+        if ((name = strdup(argv[0])) == NULL) {
+            message_OOM();
+            goto out;
+        }
+        unescape(name);
+        rc = catalogAppend(*current, name, generation, (time_t)secs, (off_t)size,
+                           compressed);
+    }
+
+out:
+    free(name);
+    free(argv);
+    return rc;
+}
+
+static void catalogClearAll(void)
+{
+    struct logState *p;
+    unsigned int i;
+
+    for (i = 0; i < hashSize; i++) {
+        for (p = states[i]->head.lh_first; p != NULL; p = p->list.le_next)
+            catalogClear(p);
+    }
+}
+
+/* Wait for the child pid started as what and report the resources it used,
+ * to help tuning nice, ioclass, iopriority and cpuaffinity. */
+static int waitpid_checked(pid_t pid, const char *what, const char **errmsg)
+{
+    int status;
+#ifdef HAVE_WAIT4
+    struct rusage ru;
+
+    if (wait4(pid, &status, 0, &ru) < 0) {
+        *errmsg = strerror(errno);
+        return -1;
+    }
+
+    message(MESS_DEBUG, "%s (pid %ld) used %ld.%03lds user and %ld.%03lds system"
+            " CPU time, %ld KiB max RSS, %ld blocks in, %ld blocks out\n", what,
+            (long) pid, (long) ru.ru_utime.tv_sec, (long) ru.ru_utime.tv_usec / 1000,
+            (long) ru.ru_stime.tv_sec, (long) ru.ru_stime.tv_usec / 1000,
+            ru.ru_maxrss, ru.ru_inblock, ru.ru_oublock);
+#else
+    (void) what;
+
+    if (waitpid(pid, &status, 0) < 0) {
+        *errmsg = strerror(errno);
+        return -1;
+    }
+#endif
+
+    if (!WIFEXITED(status)) {
+        *errmsg = "child did not terminate normally";
+        return -2;
+    }
+
+    if (WEXITSTATUS(status) != 0) {
+        *errmsg = "child did not exit with status 0";
+        return -3;
+    }
+
+    *errmsg = NULL;
+    return 0;
+}
+
+static int runScript(const struct logInfo *log, const char *logfn,
+                     const char *logrotfn, const char *script, const char **errmsg)
+{
+    char * const argv[] = { (char *) "/bin/sh", (char *) "-c", (char *) script,
+                            (char *) "logrotate_script", (char *) logfn,
+                            (char *) logrotfn, NULL };
+    const int fds[3] = { -1, -1, -1 };
+    pid_t pid;
+
+    if (debug) {
+        message(MESS_DEBUG, "running script with args %s %s: \"%s\"\n",
+                logfn, logrotfn ? logrotfn : "", script);
+        return 0;
+    }
+
+    pid = spawnChild(log, CHILD_CREDS_ROOT, "sub-shell", argv, NULL, fds, NULL, 0);
+    if (pid == -1) {
+        *errmsg = "cannot start sub-shell";
+        return -1;
+    }
+
+    return waitpid_checked(pid, "sub-shell", errmsg);
+}
+
+#ifdef WITH_ACL
+static int is_acl_well_supported(int err)
+{
+    switch (err) {
+        case ENOTSUP:   /* no file system support */
+        case EINVAL:    /* acl does not point to a valid ACL */
+        case ENOSYS:    /* compatibility - acl_(g|s)et_fd(3) should never return this */
+        case EBUSY:     /* compatibility - acl_(g|s)et_fd(3) should never return this */
+            return 0;
+        default:
+            return 1;
+    }
+}
+#endif /* WITH_ACL */
+
+static int createOutputFile(const char *fileName, int flags, const struct stat *sb,
+                            acl_type acl, int force_mode)
+{
+    int fd = -1;
+    struct stat sb_create;
+    int acl_set = 0;
+    int i;
+
+    for (i = 0; i < 2; ++i) {
+        struct tm now;
+        size_t fileName_size, buf_size;
+        char *backupName, *ptr;
+
+        fd = open(fileName, (flags | O_CREAT | O_EXCL | O_NOFOLLOW),
+                (S_IRUSR | S_IWUSR) & sb->st_mode);
+
+        if ((fd >= 0) || (errno != EEXIST))
+            break;
+
+        /* the destination file already exists, while it should not */
+        localtime_r(&nowSecs, &now);
+        fileName_size = strlen(fileName);
+        buf_size = fileName_size + sizeof("-YYYYMMDDHH.backup");
         backupName = malloc(buf_size);
         if (!backupName) {
             message_OOM();
@@ -713,6 +1478,27 @@ static int createOutputFile(const char *fileName, int flags, const struct stat *
     return fd;
 }
 
+/* take one pass of shred(1) over fd out of the I/O limit of its device
+ * before it is issued */
+static void chargeShred(int fd, const struct logInfo *log)
+{
+    struct ioLimit lim;
+    struct stat sb;
+    off_t left;
+
+    ioLimitInit(&lim, ioLimitRate(log->iolimit), -1, fd);
+    if (lim.rate == 0 || fstat(fd, &sb) != 0)
+        return;
+
+    left = sb.st_size;
+    while (left > 0) {
+        const size_t n = ioLimitChunk(&lim, left > INT_MAX ? INT_MAX : (size_t)left);
+
+        ioLimitTransfer(&lim, 0, n);
+        left -= (off_t)n;
+    }
+}
+
 /* unlink, but try to call shred from GNU coreutils if LOG_FLAG_SHRED
  * is enabled (in that case fd needs to be a valid file descriptor) */
 static int shred_file(int fd, const char *filename, const struct logInfo *log)
@@ -720,7 +1506,9 @@ static int shred_file(int fd, const char *filename, const struct logInfo *log)
     char count[12];    /*  11 digits - that's a lot of shredding :)  */
     const char *fullCommand[6];
     const char *errmsg = NULL;
+    int fds[3] = { -1, -1, -1 };
     int id = 0;
+    int passes = 1;
     pid_t pid;
 
     if (log->preremove) {
@@ -758,44 +1546,50 @@ static int shred_file(int fd, const char *filename, const struct logInfo *log)
     message(MESS_DEBUG, "Using shred to remove the file %s\n", filename);
 
     fullCommand[id++] = "shred";
-    fullCommand[id++] = "-u";
 
-    if (log->shred_cycles != 0) {
+    if (ioLimitRate(log->iolimit) > 0) {
+        /* one pass at a time, each one waiting for its share of iolimit;
+         * shred(1) does 3 passes by default, and without -u as that would
+         * empty the file after the first one */
+        passes = log->shred_cycles > 0 ? log->shred_cycles : 3;
         fullCommand[id++] = "-n";
-        snprintf(count, sizeof(count), "%d", log->shred_cycles);
-        fullCommand[id++] = count;
+        fullCommand[id++] = "1";
+    } else {
+        fullCommand[id++] = "-u";
+        if (log->shred_cycles != 0) {
+            fullCommand[id++] = "-n";
+            snprintf(count, sizeof(count), "%d", log->shred_cycles);
+            fullCommand[id++] = count;
+        }
     }
     fullCommand[id++] = "-";
     fullCommand[id++] = NULL;
 
-    pid = fork();
-
-    if (pid == -1) {
-        message(MESS_ERROR, "cannot fork: %s\n", strerror(errno));
-        return 1;
-    }
+    fds[1] = fd;
+    for (; passes > 0; passes--) {
+        chargeShred(fd, log);
 
-    if (pid == 0) {
-        movefd(fd, STDOUT_FILENO);
+        pid = spawnChild(log, CHILD_CREDS_LOG_USER, "shred command",
+                         (void *) fullCommand, NULL, fds, NULL, 0);
+        if (pid == -1)
+            return 1;
 
-        if (switch_user_permanently(log) != 0) {
-            exit(1);
+        if (waitpid_checked(pid, "shred command", &errmsg) < 0) {
+            message(MESS_ERROR, "Failed to shred %s (%s), trying unlink\n", filename, errmsg);
+            return unlink(filename);
         }
-
-        execvp(fullCommand[0], (void *) fullCommand);
-        message(MESS_ERROR, "cannot execute shred command: %s\n", strerror(errno));
-        exit(1);
     }
 
-    if (waitpid_checked(pid, &errmsg) < 0) {
-        message(MESS_ERROR, "Failed to shred %s (%s), trying unlink\n", filename, errmsg);
-        return unlink(filename);
-    }
+    /* shred(1) syncs the overwritten data itself */
+    dropCache(fd, log);
 
     /* We have to unlink it after shred anyway,
      * because it doesn't remove the file itself */
 
 unlink_file:
+    if (log->trashDir && !(log->flags & LOG_FLAG_SHRED)
+        && trashFile(filename, log->trashDir) == 0)
+        return 0;
     if (unlink(filename) == 0)
         return 0;
     if (errno != ENOENT)
@@ -807,6 +1601,57 @@ unlink_file:
     return 0;
 }
 
+/* empty sidecar marking an archive as recompressed, see recompressArchive() */
+#define RECOMPRESSED_EXT ".recompressed"
+
+/* suffixes of the files written next to a compressed log, which follow it
+ * when it is renamed or removed; all of them are optional */
+static const char *const sidecarExts[] = {
+    TIME_INDEX_EXT, BLOOM_EXT, RECOMPRESSED_EXT, ZSTD_DICT_EXT, NULL
+};
+
+static void moveSidecars(const char *oldName, const char *newName)
+{
+    const char *const *ext;
+
+    for (ext = sidecarExts; *ext; ext++) {
+        char *oldSidecar, *newSidecar;
+
+        if (asprintf(&oldSidecar, "%s%s", oldName, *ext) < 0) {
+            message_OOM();
+            return;
+        }
+        if (asprintf(&newSidecar, "%s%s", newName, *ext) < 0) {
+            message_OOM();
+            free(oldSidecar);
+            return;
+        }
+        if (rename(oldSidecar, newSidecar) != 0 && errno != ENOENT)
+            message(MESS_ERROR, "error renaming %s to %s: %s\n",
+                    oldSidecar, newSidecar, strerror(errno));
+        free(newSidecar);
+        free(oldSidecar);
+    }
+}
+
+static void removeSidecars(const char *name)
+{
+    const char *const *ext;
+
+    for (ext = sidecarExts; *ext; ext++) {
+        char *sidecar;
+
+        if (asprintf(&sidecar, "%s%s", name, *ext) < 0) {
+            message_OOM();
+            return;
+        }
+        if (unlink(sidecar) != 0 && errno != ENOENT)
+            message(MESS_ERROR, "error unlinking %s: %s\n", sidecar,
+                    strerror(errno));
+        free(sidecar);
+    }
+}
+
 static int removeLogFile(const char *name, const struct logInfo *log)
 {
     int fd = -1;
@@ -826,6 +1671,8 @@ static int removeLogFile(const char *name, const struct logInfo *log)
         message(MESS_ERROR, "Failed to remove old log %s: %s\n",
                 name, strerror(errno));
         result = 1;
+    } else if (!debug) {
+        removeSidecars(name);
     }
 
     if (fd != -1)
@@ -865,134 +1712,89 @@ static void setAtimeMtime(int fd, const char *filename, const struct stat *sb)
 #endif
 }
 
-static int compressLogFile(const char *name, const struct logInfo *log, const struct stat *sb)
+#define COMPRESSED_FILENAME_VAR "LOGROTATE_COMPRESSED_FILENAME="
+
+/* run the external compress command prog with its options as a filter from
+ * inFile to outFile; exportName is passed on in LOGROTATE_COMPRESSED_FILENAME */
+static int runCompressProg(const char *name, const char *exportName,
+                           const struct logInfo *log,
+                           const char *prog, int optionsCount, const char **options,
+                           int inFile, int outFile)
 {
-    char *compressedName;
     const char *errmsg = NULL;
-    int inFile;
-    int outFile;
+    const char **fullCommand;
+    char *envInFilename;
+    char **env;
     int compressPipe[2];
-    char *prevCtx;
+    int fds[3];
     pid_t pid;
+    int i, j;
 
-    message(MESS_DEBUG, "compressing log with: %s\n", log->compress_prog);
-    if (debug)
-        return 0;
-
-    if ((inFile = open_logfile(name, log, log->flags & LOG_FLAG_SHRED)) < 0) {
-        message(MESS_ERROR, "unable to open %s (%s) for compression: %s\n",
-            name, (log->flags & LOG_FLAG_SHRED) ? "read-write" : "read-only", strerror(errno));
-        return 1;
-    }
-
-    if (setSecCtxByFd(inFile, name, &prevCtx) != 0) {
-        /* error msg already printed */
-        close(inFile);
+    fullCommand = malloc(sizeof(*fullCommand) * ((size_t)optionsCount + 2));
+    if (!fullCommand) {
+        message_OOM();
         return 1;
     }
 
-#ifdef WITH_ACL
-    if ((prev_acl = acl_get_fd(inFile)) == NULL) {
-        if (is_acl_well_supported(errno)) {
-            message(MESS_ERROR, "getting file ACL %s: %s\n",
-                    name, strerror(errno));
-            restoreSecCtx(&prevCtx);
-            close(inFile);
-            return 1;
-        }
-    }
-#endif
+    fullCommand[0] = prog;
+    for (i = 0; i < optionsCount; i++)
+        fullCommand[i + 1] = options[i];
+    fullCommand[optionsCount + 1] = NULL;
 
-    if (asprintf(&compressedName, "%s%s", name, log->compress_ext) < 0) {
+    /* export name of file to compress for custom compress scripts */
+    if (asprintf(&envInFilename, COMPRESSED_FILENAME_VAR "%s", exportName) < 0) {
         message_OOM();
-        close(inFile);
+        free(fullCommand);
         return 1;
     }
 
-    outFile =
-        createOutputFile(compressedName, O_RDWR, sb, prev_acl, 0);
-    restoreSecCtx(&prevCtx);
-#ifdef WITH_ACL
-    if (prev_acl) {
-        acl_free(prev_acl);
-        prev_acl = NULL;
-    }
-#endif
-    if (outFile < 0) {
-        close(inFile);
-        free(compressedName);
+    for (i = 0; environ[i]; i++)
+        ;
+    env = malloc(sizeof(*env) * ((size_t)i + 2));
+    if (!env) {
+        message_OOM();
+        free(envInFilename);
+        free(fullCommand);
         return 1;
     }
+    for (i = 0, j = 0; environ[i]; i++) {
+        /* a value inherited from the environment would shadow ours */
+        if (strncmp(environ[i], COMPRESSED_FILENAME_VAR,
+                    sizeof(COMPRESSED_FILENAME_VAR) - 1) != 0)
+            env[j++] = environ[i];
+    }
+    env[j++] = envInFilename;
+    env[j] = NULL;
 
     /* pipe used to capture stderr of the compress process */
     if (pipe(compressPipe) < 0) {
         message(MESS_ERROR, "error opening pipe for compress: %s\n",
                 strerror(errno));
-        close(inFile);
-        close(outFile);
-        free(compressedName);
+        free(env);
+        free(envInFilename);
+        free(fullCommand);
         return 1;
     }
 
-    pid = fork();
+    fds[0] = inFile;
+    fds[1] = outFile;
+    fds[2] = compressPipe[1];
+    /* the read end of the pipe is not needed by the child */
+    pid = spawnChild(log, CHILD_CREDS_LOG_USER, "compress command",
+                     (void *) fullCommand, env, fds, &compressPipe[0], 1);
 
-    if (pid == -1) {
-        message(MESS_ERROR, "cannot fork: %s\n", strerror(errno));
-        close(inFile);
-        close(outFile);
-        close(compressPipe[1]);
-        close(compressPipe[0]);
-        free(compressedName);
-        return 1;
-    }
+    free(env);
+    free(envInFilename);
+    free(fullCommand);
 
-    if (pid == 0) {
-        const char **fullCommand;
-        int i;
+    /* close write end of pipe in the parent process */
+    close(compressPipe[1]);
 
-        /* close read end of pipe in the child process */
+    if (pid == -1) {
         close(compressPipe[0]);
-        free(compressedName);
-
-        movefd(inFile, STDIN_FILENO);
-        movefd(outFile, STDOUT_FILENO);
-
-        if (switch_user_permanently(log) != 0) {
-            exit(1);
-        }
-
-        movefd(compressPipe[1], STDERR_FILENO);
-
-        /* export name of file to compress for custom compress scripts */
-        {
-                char *envInFilename;
-                if (asprintf(&envInFilename, "LOGROTATE_COMPRESSED_FILENAME=%s", name) < 0) {
-                    message_OOM();
-                    exit(1);
-                }
-                putenv(envInFilename);
-                /* do not free envInFilename, cause putenv(3) might not create a copy */
-        }
-
-        fullCommand = malloc(sizeof(*fullCommand) * ((size_t)log->compress_options_count + 2));
-        if (!fullCommand) {
-            message_OOM();
-            exit(1);
-        }
-
-        fullCommand[0] = log->compress_prog;
-        for (i = 0; i < log->compress_options_count; i++)
-            fullCommand[i + 1] = log->compress_options_list[i];
-        fullCommand[log->compress_options_count + 1] = NULL;
-
-        execvp(fullCommand[0], (void *) fullCommand);
-        message(MESS_ERROR, "cannot execute compress command '%s': %s\n", fullCommand[0], strerror(errno));
-        exit(1);
+        return 1;
     }
 
-    /* close write end of pipe in the parent process */
-    close(compressPipe[1]);
-
     {
         int error_printed = 0;
 
@@ -1020,42 +1822,1161 @@ static int compressLogFile(const char *name, const struct logInfo *log, const st
         }
     }
 
-    close(compressPipe[0]);
+    close(compressPipe[0]);
+
+    if (waitpid_checked(pid, "compress command", &errmsg) < 0) {
+        message(MESS_ERROR, "failed to compress log %s: %s\n", name, errmsg);
+        return 1;
+    }
+    return 0;
+}
+
+/* release len bytes at off of fd, keeping its size; sets errno to ENOSYS
+ * where holes cannot be punched */
+static int punchHole(int fd, off_t off, off_t len)
+{
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_PUNCH_HOLE) && defined(FALLOC_FL_KEEP_SIZE)
+    return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, len);
+#else
+    (void) fd;
+    (void) off;
+    (void) len;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* amount of a log compressed in place between two releases of its data,
+ * which bounds the space needed on top of the compressed output */
+#define COMPRESS_INPLACE_STEP (16 * 1024 * 1024)
+
+/* With compressinplace, compress inFile into outFile in steps.  Each step is
+ * flushed so that it can be decoded, synced, and only then released from
+ * inFile by punching a hole into it.  *released is the amount of inFile
+ * released, which on failure is only in outFile any more. */
+static int compressInPlace(const struct compressParams *params, int inFile,
+                           const char *name, int outFile, const char *outName,
+                           off_t *released)
+{
+    struct compressStream *s;
+    struct ioLimit lim;
+    unsigned char *buf;
+    size_t bufSize;
+    off_t pos = 0;
+    int punch = 1;
+    int failed = 1;
+
+    *released = 0;
+
+    message(MESS_DEBUG, "compressing %s in place internally with %s, level %d\n",
+            name, compressBackendName(params->backend), params->level);
+
+    s = compressStreamOpen(params, outFile, outName);
+    if (s == NULL)
+        return 1;
+
+    ioLimitInit(&lim, params->ioLimit, inFile, -1);
+    bufSize = ioLimitChunk(&lim, 128 * 1024);
+    buf = malloc(bufSize);
+    if (buf == NULL) {
+        message_OOM();
+        goto out;
+    }
+
+    for (;;) {
+        const off_t stepEnd = pos + COMPRESS_INPLACE_STEP;
+        ssize_t n_read = 0;
+
+        while (pos < stepEnd) {
+            const size_t len = stepEnd - pos < (off_t) bufSize
+                ? (size_t) (stepEnd - pos) : bufSize;
+
+            n_read = read(inFile, buf, len);
+            if (n_read < 0 && errno == EINTR)
+                continue;
+            if (n_read <= 0)
+                break;
+            ioLimitTransfer(&lim, (size_t) n_read, 0);
+            if (compressStreamWrite(s, buf, (size_t) n_read))
+                goto out;
+            pos += n_read;
+        }
+        if (n_read < 0) {
+            message(MESS_ERROR, "error reading %s: %s\n", name, strerror(errno));
+            goto out;
+        }
+        /* the last step is released when the log is removed */
+        if (n_read == 0)
+            break;
+
+        if (!punch)
+            continue;
+        if (compressStreamFlush(s))
+            goto out;
+        if (fdatasync(outFile) != 0) {
+            message(MESS_ERROR, "error syncing %s: %s\n", outName, strerror(errno));
+            goto out;
+        }
+        if (punchHole(inFile, *released, pos - *released) != 0) {
+            message(MESS_DEBUG, "cannot punch holes into %s, compressing it "
+                    "without releasing its space: %s\n", name, strerror(errno));
+            punch = 0;
+            continue;
+        }
+        *released = pos;
+    }
+
+    failed = compressStreamFinish(s);
+    if (!failed)
+        message(MESS_DEBUG, "released %jd bytes of %s while compressing it\n",
+                (intmax_t) *released, name);
+out:
+    compressStreamFree(s);
+    free(buf);
+    return failed;
+}
+
+/* time index and bloom filter of a log, built while it is compressed */
+struct sidecars {
+    struct timeIndex *timeIndex;
+    struct bloom *bloom;
+    struct zstdDict *dict;      /* the log is compressed with it, see zstddict.c */
+};
+
+/* compressParams tap feeding the sidecars */
+static void feedSidecars(void *arg, const void *buf, size_t len)
+{
+    struct sidecars *sc = arg;
+
+    if (sc->timeIndex)
+        timeIndexFeed(sc->timeIndex, buf, len);
+    if (sc->bloom)
+        bloomFeed(sc->bloom, buf, len);
+}
+
+/* set up the sidecars configured for log, returns 1 if there are any */
+static int openSidecars(struct sidecars *sc, const struct logInfo *log)
+{
+    sc->timeIndex = NULL;
+    sc->bloom = NULL;
+    sc->dict = NULL;
+    if (log->indexFormat)
+        sc->timeIndex = timeIndexNew(log->indexFormat, log->indexInterval, nowSecs);
+    if (log->bloomPattern)
+        sc->bloom = bloomNew(log->bloomPattern);
+    return sc->timeIndex || sc->bloom;
+}
+
+static void freeSidecars(struct sidecars *sc)
+{
+    timeIndexFree(sc->timeIndex);
+    bloomFree(sc->bloom);
+    zstdDictFree(sc->dict);
+}
+
+/* create the sidecar of compressedName with extension ext */
+static int createSidecar(const char *compressedName, const char *ext,
+                         const struct stat *sb, char **sidecar)
+{
+    int fd;
+
+    if (asprintf(sidecar, "%s%s", compressedName, ext) < 0) {
+        message_OOM();
+        return -1;
+    }
+    message(MESS_DEBUG, "writing %s\n", *sidecar);
+    fd = createOutputFile(*sidecar, O_WRONLY, sb, NULL, 0);
+    if (fd < 0) {
+        free(*sidecar);
+        return -1;
+    }
+    return fd;
+}
+
+/* Write the sidecars of compressedName next to it.  The compressed log is
+ * complete without them, so failures are only reported. */
+static void writeSidecars(const struct sidecars *sc, const char *compressedName,
+                          const struct stat *sb)
+{
+    char *sidecar;
+    int fd;
+
+    if (sc->timeIndex
+            && (fd = createSidecar(compressedName, TIME_INDEX_EXT, sb, &sidecar)) >= 0) {
+        if (timeIndexWrite(sc->timeIndex, fd, sidecar) != 0)
+            unlink(sidecar);
+        free(sidecar);
+    }
+    if (sc->bloom
+            && (fd = createSidecar(compressedName, BLOOM_EXT, sb, &sidecar)) >= 0) {
+        if (bloomWrite(sc->bloom, fd, sidecar) != 0)
+            unlink(sidecar);
+        free(sidecar);
+    }
+    if (sc->dict
+            && (fd = createSidecar(compressedName, ZSTD_DICT_EXT, sb, &sidecar)) >= 0) {
+        if (zstdDictWriteManifest(sc->dict, fd, sidecar) != 0)
+            unlink(sidecar);
+        free(sidecar);
+    }
+}
+
+/* the choices of adaptivecompress */
+enum adaptiveChoice {
+    ADAPTIVE_CONFIGURED,
+    ADAPTIVE_FAST,
+    ADAPTIVE_STORE,
+    ADAPTIVE_CHOICES
+};
+
+/* entropy in bits per byte from which adaptivecompress compresses logs at
+ * the fastest level, and from which it only stores them */
+#define ADAPTIVE_FAST_ENTROPY 6.0
+#define ADAPTIVE_STORE_ENTROPY 7.5
+
+/* logs compressed with adaptivecompress in this run and their sizes by
+ * choice, lanes send theirs to the parent */
+struct adaptiveStats {
+    unsigned logs[ADAPTIVE_CHOICES];
+    off_t bytes[ADAPTIVE_CHOICES];
+};
+
+static struct adaptiveStats adaptiveStats;
+
+/* With adaptivecompress, choose how to compress the log in inFile by the
+ * entropy of samples of it.  Returns the level to compress it with, or -1
+ * for the configured compression.  Logs which compress badly are compressed
+ * by a built-in backend, which stands in for an external compresscmd if it
+ * writes the format of the extension of compressedName. */
+static int adaptiveLevel(int inFile, const char *name, const char *compressedName,
+                         const struct stat *sb, const struct compressBackend **backend)
+{
+    static const char *const verdicts[ADAPTIVE_CHOICES] = {
+        "compressing it as configured",
+        "compressing it at the fastest level",
+        "storing it with the least compression"
+    };
+    const struct compressBackend *b = *backend;
+    enum adaptiveChoice choice = ADAPTIVE_CONFIGURED;
+    double entropy;
+    int level = -1;
+
+    entropy = compressSampleEntropy(inFile, name, sb->st_size);
+    if (entropy >= ADAPTIVE_STORE_ENTROPY)
+        choice = ADAPTIVE_STORE;
+    else if (entropy >= ADAPTIVE_FAST_ENTROPY)
+        choice = ADAPTIVE_FAST;
+
+    if (choice != ADAPTIVE_CONFIGURED) {
+        if (b == NULL)
+            b = compressFindBackendByExt(compressedName);
+        if (b == NULL) {
+            message(MESS_DEBUG, "adaptivecompress: no built-in compressor writes "
+                    "%s\n", compressedName);
+            choice = ADAPTIVE_CONFIGURED;
+        } else {
+            level = choice == ADAPTIVE_STORE ? compressBackendStoreLevel(b)
+                : compressBackendFastLevel(b);
+            *backend = b;
+        }
+    }
+
+    message(MESS_DEBUG, "adaptivecompress: %s has %.2f bits of entropy per byte, "
+            "%s\n", name, entropy, verdicts[choice]);
+    adaptiveStats.logs[choice]++;
+    adaptiveStats.bytes[choice] += sb->st_size;
+    return level;
+}
+
+/* summary of the choices of adaptivecompress at the end of a run */
+static void reportAdaptiveStats(void)
+{
+    const struct adaptiveStats *st = &adaptiveStats;
+
+    if (st->logs[ADAPTIVE_CONFIGURED] + st->logs[ADAPTIVE_FAST]
+            + st->logs[ADAPTIVE_STORE] == 0)
+        return;
+
+    message(MESS_DEBUG, "adaptivecompress: %u log(s) of %jd bytes compressed as "
+            "configured, %u of %jd bytes at the fastest level, %u of %jd bytes "
+            "stored\n",
+            st->logs[ADAPTIVE_CONFIGURED], (intmax_t) st->bytes[ADAPTIVE_CONFIGURED],
+            st->logs[ADAPTIVE_FAST], (intmax_t) st->bytes[ADAPTIVE_FAST],
+            st->logs[ADAPTIVE_STORE], (intmax_t) st->bytes[ADAPTIVE_STORE]);
+}
+
+/* sync the directory holding path, so that a file created in it is durable */
+static int syncParentDir(const char *path)
+{
+    char *pathCopy = strdup(path);
+    int fd;
+    int rc = 0;
+
+    if (pathCopy == NULL) {
+        message_OOM();
+        return 1;
+    }
+    fd = open(dirname(pathCopy), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0 || fsync(fd) != 0) {
+        message(MESS_ERROR, "error syncing the directory of %s: %s\n", path,
+                strerror(errno));
+        rc = 1;
+    }
+    if (fd >= 0)
+        close(fd);
+    free(pathCopy);
+    return rc;
+}
+
+/* Compress inFile, the log name, into the new file compressedName, which gets
+ * the attributes of sb.  The compressed file is synced before returning 0,
+ * on failure it is removed.  With inPlace the data of inFile is released
+ * while it is compressed, see compressInPlace(); the output is written under
+ * a ".partial" suffix until it is complete and is kept if it holds data
+ * which is gone from inFile, see recoverPartial(). */
+static int compressToFile(int inFile, const char *name, const char *compressedName,
+                          const struct logInfo *log, const struct stat *sb, int inPlace)
+{
+    const struct compressBackend *backend;
+    struct sidecars sc = { NULL, NULL, NULL };
+    char *partialName = NULL;
+    int level = -1;
+    int standIn = 0;
+    const char *outName = compressedName;
+    off_t released = 0;
+    int outFile;
+    int failed;
+    char *prevCtx;
+
+    if (inPlace) {
+        if (asprintf(&partialName, "%s.partial", compressedName) < 0) {
+            message_OOM();
+            return 1;
+        }
+        outName = partialName;
+    }
+
+    if (setSecCtxByFd(inFile, name, &prevCtx) != 0) {
+        /* error msg already printed */
+        free(partialName);
+        return 1;
+    }
+
+#ifdef WITH_ACL
+    if ((prev_acl = acl_get_fd(inFile)) == NULL) {
+        if (is_acl_well_supported(errno)) {
+            message(MESS_ERROR, "getting file ACL %s: %s\n",
+                    name, strerror(errno));
+            restoreSecCtx(&prevCtx);
+            free(partialName);
+            return 1;
+        }
+    }
+#endif
+
+    outFile =
+        createOutputFile(outName, O_RDWR, sb, prev_acl, 0);
+    restoreSecCtx(&prevCtx);
+#ifdef WITH_ACL
+    if (prev_acl) {
+        acl_free(prev_acl);
+        prev_acl = NULL;
+    }
+#endif
+    if (outFile < 0) {
+        free(partialName);
+        return 1;
+    }
+    /* the partial file must survive a crash once it holds released data */
+    if (inPlace && syncParentDir(outName)) {
+        close(outFile);
+        unlink(outName);
+        free(partialName);
+        return 1;
+    }
+
+    adviseSequential(inFile, log);
+
+    backend = compressFindBackend(log->compress_prog);
+    if (log->flags & LOG_FLAG_ADAPTIVECOMPRESS) {
+        const int external = backend == NULL;
+
+        level = adaptiveLevel(inFile, name, compressedName, sb, &backend);
+        /* the options are meant for the external command */
+        standIn = external && backend != NULL;
+    }
+    if (backend) {
+        struct compressParams params;
+        failed = compressParseOptions(&params, backend,
+                                      standIn ? 0 : log->compress_options_count,
+                                      standIn ? NULL : log->compress_options_list);
+        if (level >= 0)
+            params.level = level;
+        params.ioLimit = ioLimitRate(log->iolimit);
+        if (log->compressThreads >= 0)
+            params.threads = compressThreads((unsigned) log->compressThreads);
+        if (log->flags & LOG_FLAG_SEEKABLE) {
+            params.seekable = compressBackendSeekable(backend);
+            if (!params.seekable)
+                message(MESS_DEBUG, "internal %s compression cannot write seekable "
+                        "files, compressing %s as usual\n", compressBackendName(backend),
+                        name);
+        }
+        if (openSidecars(&sc, log)) {
+            params.tap = feedSidecars;
+            params.tapArg = &sc;
+        }
+        if ((log->flags & LOG_FLAG_COMPRESSDICT) && !compressBackendDictionaries(backend)) {
+            message(MESS_DEBUG, "internal %s compression takes no dictionary, "
+                    "compressing %s without one\n", compressBackendName(backend), name);
+        } else if (log->flags & LOG_FLAG_COMPRESSDICT) {
+            sc.dict = zstdDictForStanza(log->pattern);
+            if (sc.dict == NULL) {
+                /* this log may complete the samples for the dictionary */
+                zstdDictAddSample(log->pattern, inFile, name);
+                sc.dict = zstdDictForStanza(log->pattern);
+            }
+            if (sc.dict) {
+                message(MESS_DEBUG, "compressing %s with dictionary %s\n", name,
+                        sc.dict->path);
+                params.dict = sc.dict->data;
+                params.dictSize = sc.dict->size;
+            }
+        }
+        if (inPlace)
+            failed = failed || compressInPlace(&params, inFile, name, outFile, outName,
+                                               &released);
+        else
+            failed = failed || compressFd(&params, inFile, name, outFile, outName);
+    } else {
+        /* scripts get the rotated name, also when the live log is streamed */
+        const size_t extLen = log->compress_ext ? strlen(log->compress_ext) : 0;
+        char *rotatedName = strndup(compressedName, strlen(compressedName) - extLen);
+
+        if (log->indexFormat || log->bloomPattern)
+            message(MESS_DEBUG, "index and bloom need a built-in compresscmd, "
+                    "writing neither for %s\n", name);
+        if (log->flags & LOG_FLAG_COMPRESSDICT)
+            message(MESS_DEBUG, "compressdict needs internal:zstd, compressing %s "
+                    "without a dictionary\n", name);
+        if (rotatedName == NULL) {
+            message_OOM();
+            failed = 1;
+        } else {
+            failed = runCompressProg(name, rotatedName, log, log->compress_prog,
+                                     log->compress_options_count,
+                                     log->compress_options_list, inFile, outFile);
+            free(rotatedName);
+        }
+    }
+
+    if (fsync(outFile) != 0 && !failed) {
+        message(MESS_ERROR, "error syncing %s: %s\n", outName, strerror(errno));
+        failed = 1;
+    }
+
+    if (failed) {
+        close(outFile);
+        if (released > 0)
+            message(MESS_ERROR, "the first %jd bytes of %s are only left in %s, "
+                    "which can be decompressed up to the point of failure\n",
+                    (intmax_t) released, name, outName);
+        else
+            unlink(outName);
+        freeSidecars(&sc);
+        free(partialName);
+        return 1;
+    }
+
+    dropCache(outFile, log);
+    dropCache(inFile, log);
+
+    setAtimeMtime(outFile, outName, sb);
+
+    close(outFile);
+
+    if (inPlace && rename(outName, compressedName) != 0) {
+        message(MESS_ERROR, "error renaming %s to %s: %s\n", outName,
+                compressedName, strerror(errno));
+        freeSidecars(&sc);
+        free(partialName);
+        return 1;
+    }
+    writeSidecars(&sc, compressedName, sb);
+    freeSidecars(&sc);
+    free(partialName);
+    return 0;
+}
+
+static int compressLogFile(const char *name, const struct logInfo *log, const struct stat *sb)
+{
+    char *compressedName;
+    int inFile;
+    /* shred has to overwrite the data, so it must not be released before */
+    int inPlace = (log->flags & LOG_FLAG_COMPRESSINPLACE)
+        && !(log->flags & LOG_FLAG_SHRED);
+
+    message(MESS_DEBUG, "compressing log with: %s\n", log->compress_prog);
+    if (inPlace && compressFindBackend(log->compress_prog) == NULL) {
+        message(MESS_DEBUG, "compressinplace needs a built-in compresscmd, "
+                "compressing %s as usual\n", name);
+        inPlace = 0;
+    }
+    if (debug)
+        return 0;
+
+    if ((inFile = open_logfile(name, log, (log->flags & LOG_FLAG_SHRED) || inPlace)) < 0) {
+        message(MESS_ERROR, "unable to open %s (%s) for compression: %s\n",
+            name, ((log->flags & LOG_FLAG_SHRED) || inPlace) ? "read-write" : "read-only",
+            strerror(errno));
+        return 1;
+    }
+
+    if (asprintf(&compressedName, "%s%s", name, log->compress_ext) < 0) {
+        message_OOM();
+        close(inFile);
+        return 1;
+    }
+
+    if (compressToFile(inFile, name, compressedName, log, sb, inPlace)) {
+        close(inFile);
+        free(compressedName);
+        return 1;
+    }
+    free(compressedName);
+
+    if (shred_file(inFile, name, log)) {
+        close(inFile);
+        return 1;
+    }
+
+    close(inFile);
+
+    return 0;
+}
+
+/*
+ * A ".partial" file is left behind by compressinplace when it was stopped
+ * after releasing the start of the log.  The released part is the leading
+ * hole of the log, which is filled from the decoded partial file again;
+ * once the log is complete the partial file is removed and the log is
+ * compressed anew.  If nothing was released yet, or the log is gone, the
+ * partial file is just removed.  Both files are kept if the log cannot be
+ * restored.
+ */
+static int recoverPartial(const char *partialName, const struct logInfo *log)
+{
+    const struct compressBackend *backend;
+    char *compressedName;
+    char *name;
+    struct stat sb;
+    off_t released;
+    int inFile, fd;
+    int failed = 1;
+
+    compressedName = strndup(partialName, strlen(partialName) - strlen(".partial"));
+    if (compressedName == NULL) {
+        message_OOM();
+        return 1;
+    }
+    name = strndup(compressedName, strlen(compressedName) - strlen(log->compress_ext));
+    if (name == NULL) {
+        message_OOM();
+        free(compressedName);
+        return 1;
+    }
+
+    /* the rest of the log went with it, so the partial file is of no use */
+    if (lstat(name, &sb) != 0 || !S_ISREG(sb.st_mode)) {
+        message(MESS_WARN, "%s is left from compressing %s, which is gone, "
+                "removing it\n", partialName, name);
+        if (!debug && unlink(partialName) != 0) {
+            message(MESS_ERROR, "error removing %s: %s\n", partialName,
+                    strerror(errno));
+            failed = 1;
+        } else {
+            failed = 0;
+        }
+        free(name);
+        free(compressedName);
+        return failed;
+    }
+
+    message(MESS_DEBUG, "recovering %s from %s\n", name, partialName);
+    if (debug) {
+        free(name);
+        free(compressedName);
+        return 0;
+    }
+
+    inFile = open_logfile(name, log, 1);
+    if (inFile < 0) {
+        message(MESS_ERROR, "unable to open %s (read-write) for recovery: %s\n",
+                name, strerror(errno));
+        goto out;
+    }
+
+#ifdef SEEK_DATA
+    released = lseek(inFile, 0, SEEK_DATA);
+    if (released < 0 && errno == ENXIO)
+        released = sb.st_size;
+#else
+    /* holes are only punched where they can be found again */
+    released = 0;
+#endif
+    if (released < 0) {
+        message(MESS_ERROR, "cannot find the data of %s: %s\n", name, strerror(errno));
+        goto out;
+    }
+    if (lseek(inFile, 0, SEEK_SET) < 0) {
+        message(MESS_ERROR, "error seeking in %s: %s\n", name, strerror(errno));
+        goto out;
+    }
+
+    if (released > 0) {
+        backend = compressFindBackendByExt(compressedName);
+        if (backend == NULL) {
+            message(MESS_ERROR, "no built-in decompression for %s\n", partialName);
+            goto out;
+        }
+        fd = open(partialName, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) {
+            message(MESS_ERROR, "unable to open %s: %s\n", partialName, strerror(errno));
+            goto out;
+        }
+        failed = uncompressFdPrefix(backend, fd, partialName, inFile, name, released);
+        close(fd);
+        if (failed) {
+            message(MESS_ERROR, "%s does not hold the first %jd bytes of %s\n",
+                    partialName, (intmax_t) released, name);
+            goto out;
+        }
+        if (fsync(inFile) != 0) {
+            message(MESS_ERROR, "error syncing %s: %s\n", name, strerror(errno));
+            failed = 1;
+            goto out;
+        }
+        message(MESS_DEBUG, "restored %jd bytes of %s from %s\n",
+                (intmax_t) released, name, partialName);
+    }
+
+    if (unlink(partialName) != 0) {
+        message(MESS_ERROR, "error removing %s: %s\n", partialName, strerror(errno));
+        failed = 1;
+        goto out;
+    }
+    close(inFile);
+    inFile = -1;
+
+    failed = compressLogFile(name, log, &sb);
+
+out:
+    if (inFile >= 0)
+        close(inFile);
+    if (failed)
+        message(MESS_ERROR, "keeping %s and %s for recovery\n", name, partialName);
+    free(name);
+    free(compressedName);
+    return failed;
+}
+
+/* Recover what compressinplace left behind for the archives of rotNames.
+ * Only names of this log's rotation scheme are taken, base name and
+ * extension with a number or a date in between, not the archives of other
+ * logs whose names start with the same base name. */
+static int recoverPartials(const struct logInfo *log, struct logState *state,
+                           const struct logNames *rotNames, const char *fileext)
+{
+    const int dated = (log->flags & LOG_FLAG_DATEEXT) != 0;
+    const size_t prefixLen = strlen(rotNames->dirName) + 1 + strlen(rotNames->baseName);
+    const size_t suffixLen = strlen(fileext) + strlen(log->compress_ext)
+        + strlen(".partial");
+    char *pattern;
+    glob_t globResult;
+    size_t i;
+    int recovered = 0;
+    int hasErrors = 0;
+
+    if (asprintf(&pattern, "%s/%s%s%s%s.partial", rotNames->dirName,
+                 rotNames->baseName, dated ? log->dateExt->pattern : ".[0-9]*",
+                 fileext, log->compress_ext) < 0) {
+        message_OOM();
+        return 1;
+    }
+    if (glob(pattern, 0, globerr, &globResult) == 0) {
+        for (i = 0; i < globResult.gl_pathc; i++) {
+            const char *name = globResult.gl_pathv[i];
+            const size_t len = strlen(name);
+
+            /* the glob lets anything follow the first digit */
+            if (!dated) {
+                size_t j;
+
+                if (len < prefixLen + 1 + suffixLen)
+                    continue;
+                for (j = prefixLen + 1; j < len - suffixLen; j++) {
+                    if (!isdigit((unsigned char) name[j]))
+                        break;
+                }
+                if (j != len - suffixLen)
+                    continue;
+            }
+            hasErrors |= recoverPartial(name, log);
+            recovered = 1;
+        }
+        /* archives came and went */
+        if (recovered)
+            catalogClear(state);
+    }
+    globfree(&globResult);
+    free(pattern);
+    return hasErrors;
+}
+
+/* a child forked by recompressArchive() runs backend from inFd to outFd */
+struct recompressJob {
+    const struct compressBackend *backend;
+    struct compressParams params;       /* used for compression only */
+    int inFd;
+    const char *inName;
+    int outFd;
+    const char *outName;
+};
+
+static int recompressDecode(const struct recompressJob *job)
+{
+    return uncompressFd(job->backend, job->inFd, job->inName, job->outFd,
+                        job->outName);
+}
+
+static int recompressEncode(const struct recompressJob *job)
+{
+    return compressFd(&job->params, job->inFd, job->inName, job->outFd,
+                      job->outName);
+}
+
+/* fork a child running work(job) with the resource profile of log, like
+ * spawnChild() does for commands; closeFd is not needed by the child.
+ * Returns the pid of the child or -1 after logging an error. */
+static pid_t forkRecompressChild(const struct logInfo *log,
+                                 int (*work)(const struct recompressJob *),
+                                 const struct recompressJob *job, int closeFd)
+{
+    pid_t pid;
+
+    /* do not let the child write out what is buffered for the parent */
+    fflush(NULL);
+
+    pid = fork();
+    if (pid == -1) {
+        message(MESS_ERROR, "cannot fork: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (pid == 0) {
+        close(closeFd);
+        if (applyChildProfile(log) != 0)
+            _exit(1);
+        _exit(work(job));
+    }
+
+    return pid;
+}
+
+/*
+ * With recompress, an archive older than its age is compressed once more by
+ * its command, usually a stronger level than the one used while rotating.
+ * The archive keeps its name, so the command has to write the same format.
+ *
+ * The archive is uncompressed by the built-in backend of its extension, or by
+ * uncompresscmd, into a pipe from which the command compresses it into
+ * "<name>.recompress".  Both ends run as children with the resource profile
+ * of the log (nice, ioclass, cpuaffinity, cgroup), and iolimit applies to
+ * built-in compression, so the work is kept out of the way of everything
+ * else on the host.  The new file takes over the attributes and times of the
+ * archive and is renamed over it once it is synced, so the archive is never
+ * missing or incomplete.  The offsets of its sidecars refer to the
+ * uncompressed log and stay valid; an empty RECOMPRESSED_EXT sidecar keeps
+ * it from being recompressed again.
+ */
+static int recompressArchive(const char *name, const struct logInfo *log,
+                             const struct stat *sb)
+{
+    const char *prog = log->recompress_list[0];
+    struct recompressJob decode, encode;
+    const char *errmsg = NULL;
+    char *tmpName = NULL;
+    char *marker = NULL;
+    pid_t decodeChild = -1, encodeChild = -1;
+    int pipeFds[2];
+    int inFile, outFile, fd;
+    int failed = 0;
+    int keep = 0;
+    char *prevCtx;
+
+    if (asprintf(&marker, "%s%s", name, RECOMPRESSED_EXT) < 0) {
+        message_OOM();
+        return 1;
+    }
+    if (access(marker, F_OK) == 0) {
+        free(marker);
+        return 0;
+    }
+
+    message(MESS_DEBUG, "recompressing %s with %s\n", name, prog);
+    if (debug) {
+        free(marker);
+        return 0;
+    }
+
+    memset(&decode, 0, sizeof(decode));
+    memset(&encode, 0, sizeof(encode));
+    decode.backend = compressFindBackendByExt(name);
+    if (decode.backend == NULL)
+        decode.backend = compressFindBackend(log->uncompress_prog);
+    encode.backend = compressFindBackend(prog);
+    if (encode.backend) {
+        if (compressParseOptions(&encode.params, encode.backend,
+                                 log->recompress_count - 1, log->recompress_list + 1)) {
+            free(marker);
+            return 1;
+        }
+        encode.params.ioLimit = ioLimitRate(log->iolimit);
+        if (log->compressThreads >= 0)
+            encode.params.threads = compressThreads((unsigned) log->compressThreads);
+        /* the frame index would be lost otherwise */
+        if (log->flags & LOG_FLAG_SEEKABLE)
+            encode.params.seekable = compressBackendSeekable(encode.backend);
+    }
+
+    if ((inFile = open_logfile(name, log, 0)) < 0) {
+        message(MESS_ERROR, "unable to open %s for recompression: %s\n", name,
+                strerror(errno));
+        free(marker);
+        return 1;
+    }
+
+    if (asprintf(&tmpName, "%s.recompress", name) < 0) {
+        message_OOM();
+        close(inFile);
+        free(marker);
+        return 1;
+    }
+
+    if (setSecCtxByFd(inFile, name, &prevCtx) != 0) {
+        /* error msg already printed */
+        close(inFile);
+        free(tmpName);
+        free(marker);
+        return 1;
+    }
+
+#ifdef WITH_ACL
+    if ((prev_acl = acl_get_fd(inFile)) == NULL) {
+        if (is_acl_well_supported(errno)) {
+            message(MESS_ERROR, "getting file ACL %s: %s\n",
+                    name, strerror(errno));
+            restoreSecCtx(&prevCtx);
+            close(inFile);
+            free(tmpName);
+            free(marker);
+            return 1;
+        }
+    }
+#endif
+
+    outFile = createOutputFile(tmpName, O_RDWR, sb, prev_acl, 0);
+    restoreSecCtx(&prevCtx);
+#ifdef WITH_ACL
+    if (prev_acl) {
+        acl_free(prev_acl);
+        prev_acl = NULL;
+    }
+#endif
+    if (outFile < 0) {
+        close(inFile);
+        free(tmpName);
+        free(marker);
+        return 1;
+    }
+
+    if (pipe(pipeFds) < 0) {
+        message(MESS_ERROR, "error opening pipe for recompress: %s\n",
+                strerror(errno));
+        close(outFile);
+        unlink(tmpName);
+        close(inFile);
+        free(tmpName);
+        free(marker);
+        return 1;
+    }
+
+    adviseSequential(inFile, log);
+
+    if (decode.backend) {
+        decode.inFd = inFile;
+        decode.inName = name;
+        decode.outFd = pipeFds[1];
+        decode.outName = tmpName;
+        decodeChild = forkRecompressChild(log, recompressDecode, &decode, pipeFds[0]);
+    } else {
+        char * const uncompressArgv[] = { log->uncompress_prog, NULL };
+        const int fds[3] = { inFile, pipeFds[1], -1 };
+
+        /* the read end of the pipe is not needed by the child */
+        decodeChild = spawnChild(log, CHILD_CREDS_LOG_USER, "uncompress command",
+                                 uncompressArgv, NULL, fds, &pipeFds[0], 1);
+    }
+    /* otherwise the compressor would never see the end of the input */
+    close(pipeFds[1]);
+    if (decodeChild == -1)
+        failed = 1;
+
+    if (!failed && encode.backend) {
+        encode.inFd = pipeFds[0];
+        encode.inName = name;
+        encode.outFd = outFile;
+        encode.outName = tmpName;
+        encodeChild = forkRecompressChild(log, recompressEncode, &encode, inFile);
+        failed = encodeChild == -1;
+    } else if (!failed) {
+        failed = runCompressProg(name, name, log, prog, log->recompress_count - 1,
+                                 log->recompress_list + 1, pipeFds[0], outFile);
+    }
+    close(pipeFds[0]);
+
+    if (encodeChild != -1
+            && waitpid_checked(encodeChild, "recompress", &errmsg) < 0) {
+        message(MESS_ERROR, "failed to recompress %s: %s\n", name, errmsg);
+        failed = 1;
+    }
+    if (decodeChild != -1
+            && waitpid_checked(decodeChild, "uncompress for recompress", &errmsg) < 0) {
+        message(MESS_ERROR, "failed to uncompress %s for recompression: %s\n",
+                name, errmsg);
+        failed = 1;
+    }
+
+    if (!failed && fsync(outFile) != 0) {
+        message(MESS_ERROR, "error syncing %s: %s\n", tmpName, strerror(errno));
+        failed = 1;
+    }
+
+    if (!failed) {
+        struct stat sbOut;
+
+        if (fstat(outFile, &sbOut) == 0 && sbOut.st_size >= sb->st_size) {
+            message(MESS_DEBUG, "recompressing %s saves nothing (%jd bytes), "
+                    "keeping it\n", name, (intmax_t) sbOut.st_size);
+            keep = 1;
+        } else {
+            message(MESS_DEBUG, "recompressed %s from %jd to %jd bytes\n", name,
+                    (intmax_t) sb->st_size, (intmax_t) sbOut.st_size);
+        }
+        dropCache(outFile, log);
+        dropCache(inFile, log);
+        setAtimeMtime(outFile, tmpName, sb);
+    }
+    close(outFile);
+    close(inFile);
+
+    if (!failed && !keep && rename(tmpName, name) != 0) {
+        message(MESS_ERROR, "error renaming %s to %s: %s\n", tmpName, name,
+                strerror(errno));
+        failed = 1;
+    }
+    if (failed || keep)
+        unlink(tmpName);
+    /* an archive which did not shrink is marked as well, so the work is not
+     * repeated; after a failure it is tried again next time */
+    if (!failed && (fd = createOutputFile(marker, O_WRONLY, sb, NULL, 0)) >= 0)
+        close(fd);
+
+    free(tmpName);
+    free(marker);
+    return failed;
+}
+
+/* recompress the archive name if it is older than the recompress age; a
+ * failure leaves the archive as it is and does not hold up the rotation */
+static void recompressIfAged(const char *name, const struct logInfo *log,
+                             const struct stat *sb)
+{
+    if (log->recompress_count == 0
+            || ((intmax_t)difftime(nowSecs, sb->st_mtime) / DAY_SECONDS)
+               <= log->recompressAge)
+        return;
+    if (recompressArchive(name, log, sb))
+        message(MESS_WARN, "%s not recompressed, trying again next time\n",
+                name);
+}
+
+/* name of the pack in dir holding the rotated logs of the stanza of log
+ * from the day of mtime, or with mtime 0 a glob pattern of all of them */
+static char *packName(const struct logInfo *log, const char *dir, time_t mtime)
+{
+    uint32_t hash = 0x811c9dc5U;
+    const unsigned char *p;
+    char day[16] = "*";
+    char *name;
+
+    /* FNV-1a */
+    for (p = (const unsigned char *) log->pattern; *p; p++) {
+        hash ^= *p;
+        hash *= 0x01000193U;
+    }
+
+    if (mtime) {
+        struct tm tm;
+
+        localtime_r(&mtime, &tm);
+        strftime(day, sizeof(day), "%Y%m%d", &tm);
+    }
+
+    if (asprintf(&name, "%s/logrotate-%08" PRIx32 "-%s%s", dir, hash, day,
+                 PACK_EXT) < 0) {
+        message_OOM();
+        return NULL;
+    }
+    return name;
+}
+
+/* move the rotated log name into the pack of its day as member */
+static int packRotated(const char *name, const struct logInfo *log,
+                       const struct logNames *rotNames, const char *member,
+                       const struct stat *sb)
+{
+    char *pack = packName(log, rotNames->dirName, sb->st_mtime);
+    int fd;
+    int rc = 1;
+
+    if (pack == NULL)
+        return 1;
+
+    message(MESS_DEBUG, "packing %s into %s as %s\n", name, pack, member);
+    if (debug) {
+        free(pack);
+        return 0;
+    }
+
+    if (access(pack, F_OK) != 0) {
+        fd = createOutputFile(pack, O_RDWR, sb, NULL, 0);
+        if (fd < 0) {
+            free(pack);
+            return 1;
+        }
+        close(fd);
+    }
+
+    fd = open_logfile(name, log, 0);
+    if (fd < 0) {
+        message(MESS_ERROR, "error opening %s: %s\n", name, strerror(errno));
+    } else {
+        rc = packAdd(pack, fd, name, sb, member);
+        close(fd);
+        /* sidecars are not packed, they go with the log */
+        if (rc == 0)
+            rc = removeLogFile(name, log);
+    }
+
+    free(pack);
+    return rc;
+}
+
+/* pack a numbered rotated log under a name telling its time, as the number
+ * is meaningless once it is packed */
+static int packNumbered(const char *name, const struct logInfo *log,
+                        const struct logNames *rotNames, const char *fileext,
+                        const char *compext, const struct stat *sb)
+{
+    char stamp[32];
+    char *member;
+    struct tm tm;
+    int rc;
 
-    if (waitpid_checked(pid, &errmsg) < 0) {
-        message(MESS_ERROR, "failed to compress log %s: %s\n", name, errmsg);
-        fsync(outFile);
-        close(inFile);
-        close(outFile);
-        unlink(compressedName);
-        free(compressedName);
+    localtime_r(&sb->st_mtime, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%d%H%M%S", &tm);
+    if (asprintf(&member, "%s/%s-%s%s%s", rotNames->baseName, rotNames->baseName,
+                 stamp, fileext, compext) < 0) {
+        message_OOM();
         return 1;
     }
+    rc = packRotated(name, log, rotNames, member, sb);
+    free(member);
+    return rc;
+}
 
-    fsync(outFile);
+static int compareMemberAge(const void *a, const void *b)
+{
+    const struct packMember *x = *(struct packMember * const *) a;
+    const struct packMember *y = *(struct packMember * const *) b;
 
-    setAtimeMtime(outFile, compressedName, sb);
+    if (x->mtime != y->mtime)
+        return x->mtime < y->mtime ? 1 : -1;
+    return -strcmp(x->name, y->name);
+}
 
-    close(outFile);
-    free(compressedName);
+/* apply rotate and maxage to the packed rotated logs of a log, the newest
+ * packolder of its rotated logs are not packed */
+static int prunePacked(const struct logInfo *log, const struct logNames *rotNames)
+{
+    struct packMember **members = NULL;
+    size_t count = 0;
+    size_t keep, i;
+    glob_t globResult;
+    char *pattern;
+    char *prefix;
+    int hasErrors = 0;
 
-    if (shred_file(inFile, name, log)) {
-        close(inFile);
+    pattern = packName(log, rotNames->dirName, 0);
+    if (pattern == NULL)
+        return 1;
+    if (asprintf(&prefix, "%s/", rotNames->baseName) < 0) {
+        message_OOM();
+        free(pattern);
         return 1;
     }
 
-    close(inFile);
+    if (glob(pattern, 0, globerr, &globResult) == 0) {
+        for (i = 0; i < globResult.gl_pathc; i++)
+            hasErrors |= packFind(globResult.gl_pathv[i], prefix, &members, &count);
+        globfree(&globResult);
+    }
 
-    return 0;
+    if (log->rotateCount < 0)
+        keep = (size_t) -1;
+    else if (log->rotateCount > log->packOlder)
+        keep = (size_t) (log->rotateCount - log->packOlder);
+    else
+        keep = 0;
+
+    qsort(members, count, sizeof(*members), compareMemberAge);
+    for (i = 0; i < count; i++) {
+        if (i >= keep || (log->rotateAge > 0
+                    && ((intmax_t)difftime(nowSecs, members[i]->mtime) / DAY_SECONDS)
+                       > log->rotateAge)) {
+            message(MESS_DEBUG, "removing %s from %s\n", members[i]->name,
+                    members[i]->packName);
+            if (!debug)
+                packRemove(members[i]);
+        }
+    }
+
+    free(members);
+    free(prefix);
+    free(pattern);
+    return hasErrors;
 }
 
 static int mailLog(const struct logInfo *log, const char *logFile, const char *mailComm,
                    const char *uncompressCommand, const char *address, const char *subject)
 {
     int mailInput;
+    int compressedInput = -1;
     pid_t mailChild, uncompressChild = 0;
     const char *errmsg = NULL;
     int uncompressPipe[2];
+    const struct compressBackend *uncompressBackend = compressFindBackend(uncompressCommand);
     char * const mailArgv[] = { (char *) mailComm, (char *) "-s", (char *) subject, (char *) address, NULL };
     int rc = 0;
 
@@ -1073,73 +2994,75 @@ static int mailLog(const struct logInfo *log, const char *logFile, const char *m
             close(mailInput);
             return 1;
         }
+    }
 
-        uncompressChild = fork();
+    if (uncompressBackend) {
+        /* logrotate itself feeds the uncompressed log into the pipe */
+        compressedInput = mailInput;
+        mailInput = uncompressPipe[0];
+    } else if (uncompressCommand) {
+        char * const uncompressArgv[] = { (char *) uncompressCommand, NULL };
+        const int fds[3] = { mailInput, uncompressPipe[1], -1 };
 
+        /* the read end of the pipe is not needed by the child */
+        uncompressChild = spawnChild(log, CHILD_CREDS_LOG_USER, "uncompress command",
+                                     uncompressArgv, NULL, fds, &uncompressPipe[0], 1);
         if (uncompressChild == -1) {
-            message(MESS_ERROR, "cannot fork: %s\n", strerror(errno));
             close(mailInput);
             close(uncompressPipe[1]);
             close(uncompressPipe[0]);
             return 1;
         }
 
-        if (uncompressChild == 0) {
-            /* uncompress child */
-
-            /* close read end of pipe in the child process */
-            close(uncompressPipe[0]);
-
-            movefd(mailInput, STDIN_FILENO);
-            movefd(uncompressPipe[1], STDOUT_FILENO);
-
-            if (switch_user_permanently(log) != 0) {
-                exit(1);
-            }
-
-            execlp(uncompressCommand, uncompressCommand, (char *) NULL);
-            message(MESS_ERROR, "cannot execute uncompress command: %s\n", strerror(errno));
-            exit(1);
-        }
-
         close(mailInput);
         mailInput = uncompressPipe[0];
         close(uncompressPipe[1]);
     }
 
-    mailChild = fork();
+    {
+        const int fds[3] = { mailInput, CHILD_FD_CLOSE, -1 };
+        /* otherwise the mail command would never see EOF */
+        const int closeFds[2] = { uncompressBackend ? uncompressPipe[1] : -1,
+                                  compressedInput };
+
+        /* mail command runs as root */
+        mailChild = spawnChild(log, CHILD_CREDS_ROOT, "mail command", mailArgv,
+                               NULL, fds, closeFds, uncompressBackend ? 2 : 0);
+    }
 
     if (mailChild == -1) {
-        message(MESS_ERROR, "cannot fork: %s\n", strerror(errno));
         close(mailInput);
+        if (uncompressBackend) {
+            close(uncompressPipe[1]);
+            close(compressedInput);
+        }
         return 1;
     }
 
-    if (mailChild == 0) {
-        movefd(mailInput, STDIN_FILENO);
-        close(STDOUT_FILENO);
+    close(mailInput);
 
-        /* mail command runs as root */
-        if (log->flags & LOG_FLAG_SU) {
-            if (switch_user_back_permanently() != 0) {
-                exit(1);
-            }
-        }
+    if (uncompressBackend) {
+        /* do not get killed if the mail command exits without reading
+         * everything, the write error is reported instead */
+        void (*prevHandler)(int) = signal(SIGPIPE, SIG_IGN);
 
-        execvp(mailArgv[0], mailArgv);
-        message(MESS_ERROR, "cannot execute mail command: %s\n", strerror(errno));
-        exit(1);
+        if (uncompressFd(uncompressBackend, compressedInput, logFile,
+                         uncompressPipe[1], mailComm)) {
+            message(MESS_ERROR, "uncompress failed mailing %s\n", logFile);
+            rc = 1;
+        }
+        close(uncompressPipe[1]);
+        close(compressedInput);
+        signal(SIGPIPE, prevHandler);
     }
 
-    close(mailInput);
-
-    if (waitpid_checked(mailChild, &errmsg) < 0) {
+    if (waitpid_checked(mailChild, "mail command", &errmsg) < 0) {
         message(MESS_ERROR, "mail command failed for %s: %s\n", logFile, errmsg);
         rc = 1;
     }
 
-    if (uncompressCommand) {
-        if (waitpid_checked(uncompressChild, &errmsg) < 0) {
+    if (uncompressCommand && !uncompressBackend) {
+        if (waitpid_checked(uncompressChild, "uncompress command", &errmsg) < 0) {
             message(MESS_ERROR, "uncompress command failed mailing %s: %s\n",
                     logFile, errmsg);
             rc = 1;
@@ -1204,7 +3127,7 @@ static int is_nul (void const *buf, size_t bufsize)
     return cbuf + bufsize < cp;
 }
 
-static size_t full_write(int fd, const void *buf, size_t count)
+size_t full_write(int fd, const void *buf, size_t count)
 {
     size_t total = 0;
     const unsigned char *ptr = (const unsigned char *) buf;
@@ -1233,7 +3156,8 @@ static size_t full_write(int fd, const void *buf, size_t count)
 }
 
 static int sparse_copy(int src_fd, int dest_fd, const struct stat *sb,
-                       const char *saveLog, const char *currLog)
+                       const char *saveLog, const char *currLog,
+                       const struct ioLimit *lim)
 {
     const int make_holes = is_probably_sparse(sb);
     size_t max_n_read = SIZE_MAX;
@@ -1283,6 +3207,7 @@ static int sparse_copy(int src_fd, int dest_fd, const struct stat *sb,
             }
         }
 
+        ioLimitTransfer(lim, bytes_read, make_hole ? 0 : bytes_read);
         last_write_made_hole = make_hole;
     }
 
@@ -1297,13 +3222,407 @@ static int sparse_copy(int src_fd, int dest_fd, const struct stat *sb,
     return 1;
 }
 
+/* largest amount of data handed to the kernel in one copy call */
+#define KERNEL_COPY_CHUNK (1 << 30)
+
+/* ways copy_file_data() copies a log, in the order they are tried */
+enum copyMethod {
+    COPY_METHOD_REFLINK,
+    COPY_METHOD_URING,
+    COPY_METHOD_COPY_FILE_RANGE,
+    COPY_METHOD_SENDFILE,
+    COPY_METHOD_EXTENTS,
+    COPY_METHOD_READ_WRITE
+};
+
+static const char *const copyMethodNames[] = {
+    "reflink", "io_uring", "copy_file_range", "sendfile", "data extents", "read/write"
+};
+
+/* Let dest_fd share the data extents of src_fd.  Returns 1 on success and -1
+ * if the file system cannot do it, in which case dest_fd is left untouched. */
+static int reflink_copy(int src_fd, int dest_fd)
+{
+#if defined(HAVE_LINUX_FS_H) && defined(FICLONE)
+    if (ioctl(dest_fd, FICLONE, src_fd) == 0)
+        return 1;
+#else
+    (void) src_fd;
+    (void) dest_fd;
+#endif
+    return -1;
+}
+
+/* whether a kernel copy failed with err because it cannot handle the files */
+static int kernel_copy_unsupported(int err)
+{
+    return err == ENOSYS || err == EXDEV || err == EINVAL
+        || err == EOPNOTSUPP || err == ENOTSUP;
+}
+
+/* Copy src_fd to dest_fd from their current offsets on without passing the
+ * data through user space.  Returns 1 on success, 0 on error and -1 if the
+ * method is not supported for the given files and nothing has been copied. */
+static int kernel_copy(int src_fd, int dest_fd, enum copyMethod method,
+                       const struct ioLimit *lim)
+{
+    const size_t chunk = ioLimitChunk(lim, KERNEL_COPY_CHUNK);
+    off_t total = 0;
+
+    for (;;) {
+        ssize_t n = -1;
+
+        errno = ENOSYS;
+#ifdef HAVE_COPY_FILE_RANGE
+        if (method == COPY_METHOD_COPY_FILE_RANGE)
+            n = copy_file_range(src_fd, NULL, dest_fd, NULL, chunk, 0);
+#endif
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+        if (method == COPY_METHOD_SENDFILE)
+            n = sendfile(dest_fd, src_fd, NULL, chunk);
+#endif
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (total == 0 && kernel_copy_unsupported(errno))
+                return -1;
+            return 0;
+        }
+
+        if (n == 0)
+            return 1;
+
+        ioLimitTransfer(lim, (size_t)n, (size_t)n);
+        total += n;
+    }
+}
+
+/* uringCopy() in pieces small enough to honour an I/O limit; len < 0 copies
+ * up to the end of the file */
+static int uring_copy(int src_fd, int dest_fd, off_t len, const struct ioLimit *lim)
+{
+    const off_t chunk = (off_t)ioLimitChunk(lim, KERNEL_COPY_CHUNK);
+
+    if (lim == NULL || lim->rate == 0)
+        return uringCopy(src_fd, dest_fd, len);
+
+    for (;;) {
+        off_t start, end;
+        const off_t step = len < 0 || len > chunk ? chunk : len;
+
+        if ((start = lseek(src_fd, 0, SEEK_CUR)) < 0
+            || uringCopy(src_fd, dest_fd, step) < 0
+            || (end = lseek(src_fd, 0, SEEK_CUR)) < 0)
+            return -1;
+
+        ioLimitTransfer(lim, (size_t)(end - start), (size_t)(end - start));
+        if (len >= 0)
+            len -= end - start;
+        /* end of the file or of the range */
+        if (end == start || len == 0)
+            return 0;
+    }
+}
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+/* Copy len bytes from the current offset of src_fd to the current offset of
+ * dest_fd, through io_uring if enabled or inside the kernel while *use_kernel
+ * is set.  Returns 0 on success and -1 on error. */
+static int copy_range(int src_fd, int dest_fd, off_t len, int *use_kernel,
+                      const struct ioLimit *lim)
+{
+    const size_t max_chunk = ioLimitChunk(lim, KERNEL_COPY_CHUNK);
+    char buf[BUFSIZ];
+
+    if (uringEnabled())
+        return uring_copy(src_fd, dest_fd, len, lim);
+
+    while (len > 0) {
+        const size_t chunk = len > (off_t)max_chunk ? max_chunk : (size_t)len;
+        ssize_t n = -1;
+
+#ifdef HAVE_COPY_FILE_RANGE
+        if (*use_kernel) {
+            n = copy_file_range(src_fd, NULL, dest_fd, NULL, chunk, 0);
+            if (n < 0 && kernel_copy_unsupported(errno)) {
+                /* offsets are unchanged, continue with read/write */
+                *use_kernel = 0;
+                continue;
+            }
+        }
+#endif
+        if (!*use_kernel) {
+            n = read(src_fd, buf, MIN(chunk, sizeof(buf)));
+            if (n > 0 && full_write(dest_fd, buf, (size_t)n) != (size_t)n)
+                return -1;
+        }
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        /* the file has been truncated meanwhile */
+        if (n == 0)
+            break;
+
+        ioLimitTransfer(lim, (size_t)n, (size_t)n);
+        len -= n;
+    }
+
+    return 0;
+}
+#endif
+
+/* Copy a sparse file by walking its data extents with SEEK_DATA/SEEK_HOLE,
+ * so that holes are neither read nor written but recreated by seeking and a
+ * final ftruncate().  Returns 1 on success, 0 on error and -1 if the file
+ * system does not report holes, with the offset of src_fd reset to 0. */
+static int extent_copy(int src_fd, int dest_fd, const struct stat *sb,
+                       const struct ioLimit *lim)
+{
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+#ifdef HAVE_COPY_FILE_RANGE
+    int use_kernel = 1;
+#else
+    int use_kernel = 0;
+#endif
+    struct stat sb_end;
+    off_t pos = 0;
+
+    for (;;) {
+        off_t data, hole;
+
+        data = lseek(src_fd, pos, SEEK_DATA);
+        if (data < 0) {
+            /* only holes left up to the end of the file */
+            if (errno == ENXIO)
+                break;
+            if (pos == 0 && errno == EINVAL) {
+                lseek(src_fd, 0, SEEK_SET);
+                return -1;
+            }
+            return 0;
+        }
+
+        hole = lseek(src_fd, data, SEEK_HOLE);
+        if (hole < 0)
+            return 0;
+
+        if (pos == 0 && data == 0 && hole >= sb->st_size) {
+            /* the file looked sparse but no hole is reported, the file
+             * system treats the whole file as data */
+            lseek(src_fd, 0, SEEK_SET);
+            return -1;
+        }
+
+        if (lseek(src_fd, data, SEEK_SET) < 0 || lseek(dest_fd, data, SEEK_SET) < 0)
+            return 0;
+
+        if (copy_range(src_fd, dest_fd, hole - data, &use_kernel, lim) < 0)
+            return 0;
+
+        pos = hole;
+    }
+
+    /* recreate a trailing hole */
+    if (fstat(src_fd, &sb_end) < 0)
+        return 0;
+    if (sb_end.st_size > pos && ftruncate(dest_fd, sb_end.st_size) < 0)
+        return 0;
+
+    return 1;
+#else
+    (void) src_fd;
+    (void) dest_fd;
+    (void) sb;
+    (void) lim;
+    return -1;
+#endif
+}
+
+/* Copy the contents of src_fd into the empty file dest_fd with the cheapest
+ * method available.  Sparse files are not copied by the kernel as that would
+ * fill their holes; their data extents are copied instead, or sparse_copy()
+ * recreates the holes if the file system cannot report them. */
+static int copy_file_data(int src_fd, int dest_fd, const struct stat *sb,
+                          const char *saveLog, const char *currLog,
+                          const struct ioLimit *lim)
+{
+    enum copyMethod method = COPY_METHOD_REFLINK;
+    int rc = reflink_copy(src_fd, dest_fd);
+
+    if (rc < 0 && is_probably_sparse(sb)) {
+        method = COPY_METHOD_EXTENTS;
+        rc = extent_copy(src_fd, dest_fd, sb, lim);
+    } else if (rc < 0 && uringEnabled()) {
+        /* selected by --io-engine=uring */
+        method = COPY_METHOD_URING;
+        rc = uring_copy(src_fd, dest_fd, -1, lim) == 0;
+    } else if (rc < 0) {
+        method = COPY_METHOD_COPY_FILE_RANGE;
+        rc = kernel_copy(src_fd, dest_fd, method, lim);
+        if (rc < 0) {
+            method = COPY_METHOD_SENDFILE;
+            rc = kernel_copy(src_fd, dest_fd, method, lim);
+        }
+    }
+
+    if (rc < 0) {
+        method = COPY_METHOD_READ_WRITE;
+        rc = sparse_copy(src_fd, dest_fd, sb, saveLog, currLog, lim);
+    }
+
+    if (rc == 1)
+        message(MESS_DEBUG, "copied %s to %s using %s\n", currLog, saveLog,
+                copyMethodNames[method]);
+    return rc;
+}
+
+/* passes of copytail over data appended during the previous one, after
+ * which the writer is considered faster than the copy */
+#define COPY_TAIL_MAX_PASSES 16
+
+/* Copy the range [from, to) of src_fd to the same offsets of dest_fd, up to
+ * the end of the last complete line in it if whole_lines is set.  Returns the
+ * offset copied up to, or -1 on error. */
+static off_t copy_delta(int src_fd, int dest_fd, off_t from, off_t to,
+                        int whole_lines, const struct ioLimit *lim)
+{
+    char buf[65536];
+    off_t pos;
+
+    if (whole_lines) {
+        /* look for the last newline from the end */
+        off_t end = to;
+
+        to = from;
+        while (end > from && to == from) {
+            const size_t len = end - from > (off_t) sizeof(buf) ? sizeof(buf) : (size_t) (end - from);
+            const ssize_t n = pread(src_fd, buf, len, end - (off_t) len);
+            const char *nl;
+
+            if (n <= 0)
+                return n < 0 ? -1 : from;
+            for (nl = buf + n - 1; nl >= buf && *nl != '\n'; nl--)
+                ;
+            if (nl >= buf)
+                to = end - (off_t) len + (nl - buf) + 1;
+            end -= (off_t) len;
+        }
+    }
+
+    for (pos = from; pos < to; ) {
+        const size_t len = to - pos > (off_t) sizeof(buf) ? sizeof(buf) : (size_t) (to - pos);
+        const ssize_t n = pread(src_fd, buf, len, pos);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            break;
+        if (pwrite(dest_fd, buf, (size_t) n, pos) != n)
+            return -1;
+        ioLimitTransfer(lim, (size_t) n, (size_t) n);
+        pos += n;
+    }
+
+    return pos;
+}
+
+/* With copytail, copy what has been appended to the live log since it has
+ * been copied to *copied, until less than copytail bytes are left. */
+static int chaseTail(int fdcurr, int fdsave, const char *currLog,
+                     const struct logInfo *log, const struct ioLimit *lim,
+                     off_t *copied)
+{
+    const off_t start = *copied;
+    int passes;
+
+    for (passes = 0; passes < COPY_TAIL_MAX_PASSES; passes++) {
+        struct stat sb;
+
+        if (fstat(fdcurr, &sb) != 0)
+            return 1;
+        if (sb.st_size - *copied < log->copyTail)
+            break;
+        if ((*copied = copy_delta(fdcurr, fdsave, *copied, sb.st_size, 0, lim)) < 0) {
+            message(MESS_ERROR, "error copying tail of %s: %s\n", currLog,
+                    strerror(errno));
+            return 1;
+        }
+    }
+
+    message(MESS_DEBUG, "copied %jd bytes appended to %s during the copy in %d passes\n",
+            (intmax_t) (*copied - start), currLog, passes);
+    return 0;
+}
+
+/* With truncatestep, release the first size bytes of the live log fdcurr,
+ * which have been copied and synced, by punching holes of truncatestep bytes
+ * from the start, so that the final ftruncate() has little left to free and
+ * writers do not stall on one huge extent release.  If paced, this happens
+ * within iolimit, and the caller has to copy what is appended meanwhile. */
+static void punchCopied(int fdcurr, off_t size, const char *currLog,
+                        const struct logInfo *log, int paced)
+{
+    struct ioLimit lim;
+    off_t off = 0;
+
+    if (log->truncateStep <= 0)
+        return;
+
+    ioLimitInit(&lim, paced ? ioLimitRate(log->iolimit) : 0, -1, fdcurr);
+    while (off < size) {
+        const off_t len = size - off < log->truncateStep
+            ? size - off : log->truncateStep;
+
+        if (punchHole(fdcurr, off, len) != 0) {
+            /* the final ftruncate() releases the rest */
+            message(MESS_DEBUG, "cannot punch holes into %s: %s\n", currLog,
+                    strerror(errno));
+            return;
+        }
+        ioLimitTransfer(&lim, 0, (size_t) len);
+        off += len;
+    }
+    message(MESS_DEBUG, "released %jd copied bytes of %s in steps of %jd\n",
+            (intmax_t) off, currLog, (intmax_t) log->truncateStep);
+}
+
+/* Whether copytruncate compresses the live log directly into the rotated
+ * file instead of compressing an uncompressed copy of it afterwards, which
+ * streamcompress asks for.  The uncompressed copy is still made if
+ * delaycompress keeps it around for a cycle, or a postrotate script may look
+ * at it. */
+static int streamsCompression(const struct logInfo *log)
+{
+    return (log->flags & LOG_FLAG_STREAMCOMPRESS)
+        && (log->flags & LOG_FLAG_COPYTRUNCATE) && (log->flags & LOG_FLAG_COMPRESS)
+        && !(log->flags & (LOG_FLAG_DELAYCOMPRESS | LOG_FLAG_TMPFILENAME))
+        && !log->post;
+}
+
 static int copyTruncate(const char *currLog, const char *saveLog, const struct stat *sb,
                         const struct logInfo *log, int skip_copy)
 {
     int rc = 1;
     int fdcurr = -1, fdsave = -1;
-
-    message(MESS_DEBUG, "%scopying %s to %s\n", skip_copy ? "skip " : "", currLog, saveLog);
+    struct ioLimit lim;
+    off_t copied = 0;
+    /* compress the live log, the compressor reads it up to its end */
+    const int stream = !skip_copy && streamsCompression(log);
+    /* with copytail, re-copy the tail of the log which would be lost */
+    const int tail = log->copyTail > 0 && (log->flags & LOG_FLAG_COPYTRUNCATE) && !stream;
+
+    if (stream)
+        message(MESS_DEBUG, "compressing %s directly into %s%s with: %s\n", currLog,
+                saveLog, log->compress_ext, log->compress_prog);
+    else
+        message(MESS_DEBUG, "%scopying %s to %s\n", skip_copy ? "skip " : "", currLog, saveLog);
 
     if (!debug) {
         /* read access is sufficient for 'copy' but not for 'copytruncate' */
@@ -1315,8 +3634,25 @@ static int copyTruncate(const char *currLog, const char *saveLog, const struct s
             goto fail;
         }
 
-        if (!skip_copy) {
+        if (stream) {
+            char *compressedName;
+            int failed;
+
+            if (asprintf(&compressedName, "%s%s", saveLog, log->compress_ext) < 0) {
+                message_OOM();
+                goto fail;
+            }
+            /* synced before it returns, so the log may be truncated */
+            failed = compressToFile(fdcurr, currLog, compressedName, log, sb, 0);
+            free(compressedName);
+            if (failed)
+                goto fail;
+
+            /* the compressor has read the log up to here */
+            copied = lseek(fdcurr, 0, SEEK_CUR);
+        } else if (!skip_copy) {
             char *prevCtx;
+            struct stat sbsave;
 
             if (setSecCtxByFd(fdcurr, currLog, &prevCtx) != 0) {
                 /* error msg already printed */
@@ -1343,12 +3679,34 @@ static int copyTruncate(const char *currLog, const char *saveLog, const struct s
             if (fdsave < 0)
                 goto fail;
 
-            if (sparse_copy(fdcurr, fdsave, sb, saveLog, currLog) != 1) {
+            adviseSequential(fdcurr, log);
+            ioLimitInit(&lim, ioLimitRate(log->iolimit), fdcurr, fdsave);
+
+            if (copy_file_data(fdcurr, fdsave, sb, saveLog, currLog, &lim) != 1) {
                 message(MESS_ERROR, "error copying %s to %s: %s\n", currLog,
                         saveLog, strerror(errno));
                 unlink(saveLog);
                 goto fail;
             }
+
+            if (tail) {
+                if (fstat(fdsave, &sbsave) != 0) {
+                    message(MESS_ERROR, "cannot stat %s: %s\n", saveLog, strerror(errno));
+                    unlink(saveLog);
+                    goto fail;
+                }
+                copied = sbsave.st_size;
+                if (chaseTail(fdcurr, fdsave, currLog, log, &lim, &copied) != 0) {
+                    unlink(saveLog);
+                    goto fail;
+                }
+            }
+
+            if (log->flags & LOG_FLAG_DROPCACHE) {
+                fsync(fdsave);
+                dropCache(fdsave, log);
+                dropCache(fdcurr, log);
+            }
         }
     }
 
@@ -1356,8 +3714,38 @@ static int copyTruncate(const char *currLog, const char *saveLog, const struct s
         message(MESS_DEBUG, "truncating %s\n", currLog);
 
         if (!debug) {
-            if (fdsave >= 0)
-                fsync(fdsave);
+            /* whether to copy what has been appended since copied */
+            int recopy = tail;
+
+            if (stream) {
+                /* appended data cannot be added to the compressed copy
+                 * later on, so nothing waits for iolimit */
+                if (copied > 0)
+                    punchCopied(fdcurr, copied, currLog, log, 0);
+            } else if (fdsave >= 0) {
+                struct stat sbsave;
+
+                /* the copy has to be on disk before data is released */
+                if (fsync(fdsave) == 0 && fstat(fdsave, &sbsave) == 0
+                        && log->truncateStep > 0) {
+                    punchCopied(fdcurr, sbsave.st_size, currLog, log, 1);
+                    copied = sbsave.st_size;
+                    recopy = 1;
+                }
+            }
+            if (recopy && fdsave >= 0) {
+                /* last small delta, complete lines only, then truncate at once */
+                struct stat sbcurr;
+                off_t end;
+
+                if (fstat(fdcurr, &sbcurr) == 0
+                    && (end = copy_delta(fdcurr, fdsave, copied, sbcurr.st_size, 1, NULL)) >= 0
+                    && fdatasync(fdsave) == 0)
+                    copied = end;
+                if (fstat(fdcurr, &sbcurr) == 0)
+                    message(MESS_DEBUG, "%jd bytes of %s at risk by truncating it\n",
+                            (intmax_t) (sbcurr.st_size - copied), currLog);
+            }
             if (ftruncate(fdcurr, 0)) {
                 message(MESS_ERROR, "error truncating %s: %s\n", currLog,
                         strerror(errno));
@@ -1721,13 +4109,10 @@ static int prerotateSingleLog(const struct logInfo *log, unsigned logNum,
     glob_t globResult;
     int rc;
     int rotateCount = log->rotateCount ? log->rotateCount : 1;
-#define DATEEXT_LEN 64
-#define PATTERN_LEN (DATEEXT_LEN * 2)
     char dext_str[DATEEXT_LEN];
-    char dformat[PATTERN_LEN] = "";
-    char dext_pattern[PATTERN_LEN];
-    const char *final_dformat;
     size_t ret;
+    int recompress;
+    int fromCatalog;
 
     if (!state->doRotate)
         return 0;
@@ -1747,6 +4132,8 @@ static int prerotateSingleLog(const struct logInfo *log, unsigned logNum,
 
         compext = log->compress_ext;
     }
+    /* only compressed archives are recompressed */
+    recompress = log->recompress_count > 0 && *compext;
 
     localtime_r(&nowSecs, &now);
     state->lastRotated = now;
@@ -1844,141 +4231,20 @@ static int prerotateSingleLog(const struct logInfo *log, unsigned logNum,
         mktime(&now);
     }
 
-    /* Construct the glob pattern corresponding to the date format */
+    /* The date format and glob pattern were compiled with the configuration */
     dext_str[0] = '\0';
-    if (log->dateformat) {
-        const char *dext = log->dateformat;
-        size_t i = 0, j = 0;
-
-        memset(dext_pattern, 0, sizeof(dext_pattern));
-        while (*dext == ' ')
-            dext++;
-        while (*dext != '\0') {
-            /* Will there be a space for a char and '\0'? */
-            if (j >= (sizeof(dext_pattern) - 1) ||
-                i >= (sizeof(dformat) - 2)) {
-                message(MESS_ERROR, "Date format %s is too long\n",
-                        log->dateformat);
-                return 1;
-            }
-            if (*dext == '%') {
-                switch (*(dext + 1)) {
-                    case 'Y':
-                    case 'G':
-                        strncat(dext_pattern, "[0-9][0-9]",
-                                sizeof(dext_pattern) - strlen(dext_pattern) - 1);
-                        j += 10; /* strlen("[0-9][0-9]") */
-                        /* FALLTHRU */
-                    case 'y':
-                    case 'g':
-                    case 'm':
-                    case 'd':
-                    case 'H':
-                    case 'M':
-                    case 'S':
-                    case 'V':
-                    case 'U':
-                    case 'W':
-                        strncat(dext_pattern, "[0-9][0-9]",
-                                sizeof(dext_pattern) - strlen(dext_pattern) - 1);
-                        j += 10;
-                        if (j >= (sizeof(dext_pattern) - 1)) {
-                            message(MESS_ERROR, "Date format %s is too long\n",
-                                    log->dateformat);
-                            return 1;
-                        }
-                        dformat[i++] = *(dext++);
-                        dformat[i] = *dext;
-                        break;
-                    case 'j':
-                        strncat(dext_pattern, "[0-9][0-9]",
-                                sizeof(dext_pattern) - strlen(dext_pattern) - 1);
-                        j += 10; /* strlen("[0-9][0-9]") */
-                        /* FALLTHRU */
-                    case 'u':
-                    case 'w':
-                        strncat(dext_pattern, "[0-9]",
-                                sizeof(dext_pattern) - strlen(dext_pattern) - 1);
-                        j += 5;
-                        if (j >= (sizeof(dext_pattern) - 1)) {
-                            message(MESS_ERROR, "Date format %s is too long\n",
-                                    log->dateformat);
-                            return 1;
-                        }
-                        dformat[i++] = *(dext++);
-                        dformat[i] = *dext;
-                        break;
-                    case 's':
-                        /* End of year 2286 this pattern does not work. */
-                        strncat(dext_pattern,
-                                "[0-9][0-9][0-9][0-9][0-9][0-9][0-9][0-9][0-9][0-9]",
-                                sizeof(dext_pattern) - strlen(dext_pattern) - 1);
-                        j += 50;
-                        if (j >= (sizeof(dext_pattern) - 1)) {
-                            message(MESS_ERROR, "Date format %s is too long\n",
-                                    log->dateformat);
-                            return 1;
-                        }
-                        dformat[i++] = *(dext++);
-                        dformat[i] = *dext;
-                        break;
-                    case 'z':
-                        strncat(dext_pattern, "[-+][0-9][0-9][0-9][0-9]",
-                                sizeof(dext_pattern) - strlen(dext_pattern) - 1);
-                        j += 24;
-                        if (j >= (sizeof(dext_pattern) - 1)) {
-                            message(MESS_ERROR, "Date format %s is too long\n",
-                                    log->dateformat);
-                            return 1;
-                        }
-                        dformat[i++] = *(dext++);
-                        dformat[i] = *dext;
-                        break;
-                    default:
-                        dformat[i++] = *dext;
-                        dformat[i] = '%';
-                        dext_pattern[j++] = *dext;
-                        break;
-                }
-            } else {
-                dformat[i] = *dext;
-                dext_pattern[j++] = *dext;
-            }
-            ++i;
-            ++dext;
-        }
-        dformat[i] = '\0';
-        message(MESS_DEBUG, "Converted '%s' -> '%s'\n", log->dateformat, dformat);
-        final_dformat = dformat;
-    } else {
-        if (log->criterium == ROT_HOURLY) {
-            /* hourly adds another two digits */
-            final_dformat = "-%Y%m%d%H";
-            strncpy(dext_pattern, "-[0-9][0-9][0-9][0-9][0-9][0-9][0-9][0-9][0-9][0-9]",
-                    sizeof(dext_pattern));
-        } else if (log->criterium == ROT_MINUTES) {
-            /* minutes adds another four digits */
-            final_dformat = "-%Y%m%d%H%M";
-            strncpy(dext_pattern, "-[0-9][0-9][0-9][0-9][0-9][0-9][0-9][0-9][0-9][0-9][0-9][0-9]",
-                    sizeof(dext_pattern));
-        } else {
-            /* The default dateformat and glob pattern */
-            final_dformat = "-%Y%m%d";
-            strncpy(dext_pattern, "-[0-9][0-9][0-9][0-9][0-9][0-9][0-9][0-9]",
-                    sizeof(dext_pattern));
+    if (log->flags & LOG_FLAG_DATEEXT) {
+        ret = strftime(dext_str, sizeof(dext_str), log->dateExt->format, &now);
+        if (ret == 0) {
+            message(MESS_ERROR, "failed to apply date format '%s'\n",
+                    log->dateExt->format);
+            return 1;
         }
-        dext_pattern[PATTERN_LEN - 1] = '\0';
-    }
 
-    ret = strftime(dext_str, sizeof(dext_str), final_dformat, &now);
-    if (ret == 0) {
-        message(MESS_ERROR, "failed to apply date format '%s'\n", final_dformat);
-        return 1;
+        message(MESS_DEBUG, "dateext suffix '%s'\n", dext_str);
+        message(MESS_DEBUG, "glob pattern '%s'\n", log->dateExt->pattern);
     }
 
-    message(MESS_DEBUG, "dateext suffix '%s'\n", dext_str);
-    message(MESS_DEBUG, "glob pattern '%s'\n", dext_pattern);
-
     if (setSecCtxByName(log->files[logNum], &prev_context) != 0) {
         /* error msg already printed */
         return 1;
@@ -1988,20 +4254,23 @@ static int prerotateSingleLog(const struct logInfo *log, unsigned logNum,
         message(MESS_WARN, "delayed compression for log file %s ignored since compression is disabled\n", log->files[logNum]);
     }
 
+    if ((log->flags & LOG_FLAG_COMPRESS) && (log->flags & LOG_FLAG_COMPRESSINPLACE))
+        hasErrors = recoverPartials(log, state, rotNames, fileext);
+
     /* First compress the previous log when necessary */
-    if ((log->flags & LOG_FLAG_COMPRESS) &&
+    if (!hasErrors && (log->flags & LOG_FLAG_COMPRESS) &&
             (log->flags & LOG_FLAG_DELAYCOMPRESS)) {
         if (log->flags & LOG_FLAG_DATEEXT) {
             /* glob for uncompressed files with our pattern */
             if (asprintf(&glob_pattern, "%s/%s%s%s", rotNames->dirName,
-                         rotNames->baseName, dext_pattern, fileext) < 0) {
+                         rotNames->baseName, log->dateExt->pattern, fileext) < 0) {
                 message_OOM();
                 return 1;
             }
             rc = glob(glob_pattern, 0, globerr, &globResult);
             if (!rc && globResult.gl_pathc > 0) {
                 size_t glob_count;
-                sortGlobResult(&globResult, strlen(rotNames->dirName) + 1 + strlen(rotNames->baseName), dformat);
+                sortGlobResult(&globResult, strlen(rotNames->dirName) + 1 + strlen(rotNames->baseName), log->dateExt);
                 for (glob_count = 0; glob_count < globResult.gl_pathc && !hasErrors; glob_count++) {
                     struct stat sbprev;
                     const char *oldName = globResult.gl_pathv[glob_count];
@@ -2013,6 +4282,8 @@ static int prerotateSingleLog(const struct logInfo *log, unsigned logNum,
                             message(MESS_ERROR, "cannot stat %s: %s\n", oldName, strerror(errno));
                     } else {
                         hasErrors = compressLogFile(oldName, log, &sbprev);
+                        if (!hasErrors)
+                            catalogRecordExt(state, oldName, compext, 0);
                     }
                 }
             } else {
@@ -2036,90 +4307,152 @@ static int prerotateSingleLog(const struct logInfo *log, unsigned logNum,
                     message(MESS_ERROR, "cannot stat %s: %s\n", oldName, strerror(errno));
             } else {
                 hasErrors = compressLogFile(oldName, log, &sbprev);
+                if (!hasErrors)
+                    catalogRecordExt(state, oldName, compext, log->logStart);
             }
             free(oldName);
         }
     }
 
     if (log->flags & LOG_FLAG_DATEEXT) {
-        /* glob for compressed files with our pattern
-         * and compress ext */
+        /* rotated logs with our pattern and compress ext */
         if (asprintf(&glob_pattern, "%s/%s%s%s%s", rotNames->dirName,
-                     rotNames->baseName, dext_pattern, fileext, compext) < 0) {
+                     rotNames->baseName, log->dateExt->pattern, fileext, compext) < 0) {
             message_OOM();
             return 1;
         }
-        rc = glob(glob_pattern, 0, globerr, &globResult);
+        fromCatalog = catalogCurrent(log, state, glob_pattern);
+        if (fromCatalog) {
+            message(MESS_DEBUG, "using the catalog of %zu rotated logs\n",
+                    state->rotatedCount);
+            rc = 0;
+        } else {
+            rc = catalogScan(log, state, glob_pattern,
+                             strlen(rotNames->dirName) + 1 + strlen(rotNames->baseName),
+                             0, log->dateExt, *compext != '\0');
+        }
+        free(rotNames->disposeName);
+        rotNames->disposeName = NULL;
         if (!rc) {
             /* search for files to drop, if we find one remember it,
              * if we find another one mail and remove the first and
              * remember the second and so on */
+            struct rotatedFile *files = state->rotated;
+            const size_t count = state->rotatedCount;
             struct stat fst_buf;
-            size_t glob_count, mail_out = (size_t)-1;
+            size_t k, mail_out = (size_t)-1;
             /* Remove the first (n - rotateCount) matches no real rotation
              * needed, since the files have the date in their name. Note that
              * (size_t)-1 == SIZE_T_MAX in rotateCount */
-            sortGlobResult(&globResult, strlen(rotNames->dirName) + 1 + strlen(rotNames->baseName), dformat);
-            for (glob_count = 0; glob_count < globResult.gl_pathc; glob_count++) {
-                if (!stat((globResult.gl_pathv)[glob_count], &fst_buf)) {
-                    if (((globResult.gl_pathc >= (size_t)rotateCount) && (glob_count <= (globResult.gl_pathc - (size_t)rotateCount)))
-                            || ((log->rotateAge > 0)
-                                &&
-                                (((intmax_t)difftime(nowSecs, fst_buf.st_mtime) / DAY_SECONDS)
-                                 > log->rotateAge))) {
-                        if (mail_out != (size_t)-1) {
-                            char *mailFilename =
-                                (globResult.gl_pathv)[mail_out];
-                            if (!hasErrors && log->logAddress)
-                                hasErrors = mailLogWrapper(mailFilename, mailCommand,
-                                                           logNum, log);
-                            if (!hasErrors) {
-                                message(MESS_DEBUG, "removing %s\n", mailFilename);
-                                hasErrors = removeLogFile(mailFilename, log);
-                            }
+            for (k = 0; k < count; k++) {
+                if (((count >= (size_t)rotateCount) && (k <= (count - (size_t)rotateCount)))
+                        || ((log->rotateAge > 0)
+                            &&
+                            (((intmax_t)difftime(nowSecs, files[k].mtime) / DAY_SECONDS)
+                             > log->rotateAge))) {
+                    /* the catalog misses what others removed */
+                    if (fromCatalog && stat(files[k].name, &fst_buf)) {
+                        files[k].gone = 1;
+                        continue;
+                    }
+                    if (mail_out != (size_t)-1) {
+                        const char *mailFilename = files[mail_out].name;
+                        if (!hasErrors && log->logAddress)
+                            hasErrors = mailLogWrapper(mailFilename, mailCommand,
+                                                       logNum, log);
+                        if (!hasErrors) {
+                            message(MESS_DEBUG, "removing %s\n", mailFilename);
+                            hasErrors = removeLogFile(mailFilename, log);
+                            files[mail_out].gone = !hasErrors;
                         }
-                        mail_out = glob_count;
                     }
+                    mail_out = k;
+                }
+            }
+            /* the archives kept may be due for recompression */
+            for (k = mail_out == (size_t)-1 ? 0 : mail_out + 1;
+                 recompress && k < count; k++) {
+                if (files[k].gone || stat(files[k].name, &fst_buf))
+                    continue;
+                recompressIfAged(files[k].name, log, &fst_buf);
+                if (state->catalogScanned && !stat(files[k].name, &fst_buf))
+                    files[k].size = fst_buf.st_size;
+            }
+            /* with the new one, packolder of them stay outside of packs */
+            for (k = mail_out == (size_t)-1 ? 0 : mail_out + 1;
+                 log->packOlder && k + (size_t)log->packOlder - 1 < count; k++) {
+                const char *oldName = files[k].name;
+                char *member;
+
+                if (files[k].gone || stat(oldName, &fst_buf))
+                    continue;
+                if (asprintf(&member, "%s/%s", rotNames->baseName,
+                             oldName + strlen(rotNames->dirName) + 1) < 0) {
+                    message_OOM();
+                    hasErrors = 1;
+                    break;
                 }
+                if (packRotated(oldName, log, rotNames, member, &fst_buf))
+                    hasErrors = 1;
+                else
+                    files[k].gone = 1;
+                free(member);
             }
             if (mail_out != (size_t)-1) {
                 /* oldName is oldest Backup found (for unlink later) */
-                const char *oldName = globResult.gl_pathv[mail_out];
-                rotNames->disposeName = strdup(oldName);
+                rotNames->disposeName = strdup(files[mail_out].name);
                 if (rotNames->disposeName == NULL) {
                     message_OOM();
-                    globfree(&globResult);
                     free(glob_pattern);
                     return 1;
                 }
-            } else {
-                free(rotNames->disposeName);
-                rotNames->disposeName = NULL;
+                files[mail_out].gone = 1;
             }
+            catalogPrune(state);
         } else {
             message(MESS_DEBUG, "glob finding old rotated logs failed\n");
-            free(rotNames->disposeName);
-            rotNames->disposeName = NULL;
         }
+        if (!state->catalogScanned)
+            catalogClear(state);
         /* firstRotated is most recently created/compressed rotated log */
         if (asprintf(&rotNames->firstRotated, "%s/%s%s%s%s",
                 rotNames->dirName, rotNames->baseName, dext_str, fileext,
                 (log->flags & LOG_FLAG_DELAYCOMPRESS) ? "" : compext) < 0) {
             message_OOM();
             rotNames->firstRotated = NULL;
-            globfree(&globResult);
             free(glob_pattern);
             return 1;
         }
-        globfree(&globResult);
         free(glob_pattern);
     } else {
         int i;
         char *newName = NULL;
         char *oldName;
 
+        /* rotated logs with any number */
+        if (log->catalogDays > 0) {
+            if (asprintf(&glob_pattern, "%s/%s.*%s%s", rotNames->dirName,
+                         rotNames->baseName, fileext, compext) < 0) {
+                message_OOM();
+                return 1;
+            }
+            if (catalogCurrent(log, state, glob_pattern))
+                message(MESS_DEBUG, "using the catalog of %zu rotated logs\n",
+                        state->rotatedCount);
+            else if (catalogScan(log, state, glob_pattern,
+                                 strlen(rotNames->dirName) + 1 + strlen(rotNames->baseName) + 1,
+                                 strlen(fileext) + strlen(compext), NULL, *compext != '\0'))
+                message(MESS_DEBUG, "glob finding old rotated logs failed\n");
+            free(glob_pattern);
+        } else {
+            catalogClear(state);
+        }
+
         if (rotateCount == -1) {
-            rotateCount = findLastRotated(rotNames, fileext, compext);
+            if (state->catalogScanned)
+                rotateCount = catalogLastGeneration(state);
+            else
+                rotateCount = findLastRotated(rotNames, fileext, compext);
             if (rotateCount < 0) {
                 message(MESS_ERROR, "could not find last rotated file: %s/%s.*%s%s\n",
                         rotNames->dirName, rotNames->baseName, fileext, compext);
@@ -2162,11 +4495,11 @@ static int prerotateSingleLog(const struct logInfo *log, unsigned logNum,
                 break;
             }
 
-            /* remove files hit by maxage */
-            if (log->rotateAge) {
+            /* remove files hit by maxage, recompress those hit by recompress */
+            if (log->rotateAge || recompress) {
                 struct stat fst_buf;
 
-                if (stat(oldName, &fst_buf)) {
+                if (statRotated(state, oldName, &fst_buf, recompress)) {
                     if (errno == ENOENT) {
                         message(MESS_DEBUG, "old log %s does not exist\n",
                                 oldName);
@@ -2179,15 +4512,46 @@ static int prerotateSingleLog(const struct logInfo *log, unsigned logNum,
                     continue;
                 }
 
-                if (((intmax_t)difftime(nowSecs, fst_buf.st_mtime) / DAY_SECONDS) > log->rotateAge) {
+                if (log->rotateAge
+                        && ((intmax_t)difftime(nowSecs, fst_buf.st_mtime) / DAY_SECONDS) > log->rotateAge) {
                     if (!hasErrors && log->logAddress)
                         hasErrors = mailLogWrapper(oldName, mailCommand,
                                                    logNum, log);
                     if (!hasErrors)
                         hasErrors = removeLogFile(oldName, log);
+                    if (!hasErrors)
+                        catalogDrop(state, oldName);
 
                     continue;
                 }
+
+                if (recompress) {
+                    recompressIfAged(oldName, log, &fst_buf);
+                    catalogRecord(state, oldName, i, 1);
+                }
+            }
+
+            /* packed instead of renamed past packolder generations */
+            if (log->packOlder && i >= log->packOlder + log->logStart - 1) {
+                struct stat fst_buf;
+
+                if (statRotated(state, oldName, &fst_buf, 1)) {
+                    if (errno == ENOENT) {
+                        message(MESS_DEBUG, "old log %s does not exist\n",
+                                oldName);
+                    } else {
+                        message(MESS_ERROR, "cannot stat %s: %s\n", oldName,
+                                strerror(errno));
+                        hasErrors = 1;
+                    }
+                } else {
+                    hasErrors = packNumbered(oldName, log, rotNames, fileext,
+                                             compext, &fst_buf);
+                    if (!hasErrors)
+                        catalogDrop(state, oldName);
+                }
+
+                continue;
             }
 
             message(MESS_DEBUG,
@@ -2198,17 +4562,24 @@ static int prerotateSingleLog(const struct logInfo *log, unsigned logNum,
                 if (errno == ENOENT) {
                     message(MESS_DEBUG, "old log %s does not exist\n",
                             oldName);
+                    catalogDrop(state, oldName);
                 } else {
                     message(MESS_ERROR, "error renaming %s to %s: %s\n",
                             oldName, newName, strerror(errno));
                     hasErrors = 1;
                 }
+            } else if (!debug) {
+                moveSidecars(oldName, newName);
+                catalogMove(state, oldName, newName, i + 1);
             }
         }
         free(newName);
         free(oldName);
     } /* !LOG_FLAG_DATEEXT */
 
+    if (log->packOlder)
+        hasErrors |= prunePacked(log, rotNames);
+
     if (log->flags & LOG_FLAG_DATEEXT) {
         char *destFile;
         struct stat fst_buf;
@@ -2392,7 +4763,7 @@ static int rotateSingleLog(const struct logInfo *log, unsigned logNum,
 }
 
 static int postrotateSingleLog(const struct logInfo *log, unsigned logNum,
-                               const struct logState *state,
+                               struct logState *state,
                                const struct logNames *rotNames)
 {
     int hasErrors = 0;
@@ -2424,7 +4795,8 @@ static int postrotateSingleLog(const struct logInfo *log, unsigned logNum,
                            !log->rotateCount &&
                            !log->logAddress;
 
-        if (!skipped_copy)
+        /* streamed into the compressor by copyTruncate() */
+        if (!skipped_copy && !streamsCompression(log))
             hasErrors = compressLogFile(rotNames->finalName, log, &state->sb);
     }
 
@@ -2440,8 +4812,18 @@ static int postrotateSingleLog(const struct logInfo *log, unsigned logNum,
             hasErrors = mailLogWrapper(mailFilename, mailCommand, logNum, log);
     }
 
-    if (!hasErrors && rotNames->disposeName)
+    /* the rotated log is cataloged once it has its final name */
+    if (!hasErrors && !((log->flags & LOG_FLAG_COMPRESS)
+                && (log->flags & LOG_FLAG_DELAYCOMPRESS)))
+        catalogRecord(state, rotNames->firstRotated,
+                      (log->flags & LOG_FLAG_DATEEXT) ? 0 : log->logStart,
+                      (log->flags & LOG_FLAG_COMPRESS) != 0);
+
+    if (!hasErrors && rotNames->disposeName) {
         hasErrors = removeLogFile(rotNames->disposeName, log);
+        if (!hasErrors)
+            catalogDrop(state, rotNames->disposeName);
+    }
 
     restoreSecCtx(&prev_context);
     return hasErrors;
@@ -2669,91 +5051,537 @@ static int rotateLogSet(const struct logInfo *log, int force)
             }
         }
 
-        if (log->post
-                && (!(
-                        (!(log->flags & LOG_FLAG_SHAREDSCRIPTS) && (logHasErrors[j] || !state[j]->doRotate))
-                        || (hasErrors && (log->flags & LOG_FLAG_SHAREDSCRIPTS))
-                     ))
-           ) {
-            if (!numRotated) {
-                message(MESS_DEBUG, "not running postrotate script, "
-                        "since no logs were rotated\n");
-            } else {
-                const char *logfn = (log->flags & LOG_FLAG_SHAREDSCRIPTS) ? log->pattern : log->files[j];
+        if (log->post
+                && (!(
+                        (!(log->flags & LOG_FLAG_SHAREDSCRIPTS) && (logHasErrors[j] || !state[j]->doRotate))
+                        || (hasErrors && (log->flags & LOG_FLAG_SHAREDSCRIPTS))
+                     ))
+           ) {
+            if (!numRotated) {
+                message(MESS_DEBUG, "not running postrotate script, "
+                        "since no logs were rotated\n");
+            } else {
+                const char *logfn = (log->flags & LOG_FLAG_SHAREDSCRIPTS) ? log->pattern : log->files[j];
+
+                /* It only makes sense to pass in a final rotated filename if scripts are not shared */
+                const char *logrotfn = (log->flags & LOG_FLAG_SHAREDSCRIPTS) ? NULL : rotNames[j]->finalName;
+
+                message(MESS_DEBUG, "running postrotate script\n");
+                if (runScript(log, logfn, logrotfn, log->post, &errmsg) < 0) {
+                    if (log->flags & LOG_FLAG_SHAREDSCRIPTS)
+                        message(MESS_ERROR,
+                                "error running shared postrotate script "
+                                "for '%s': %s\n", log->pattern, errmsg);
+                    else {
+                        message(MESS_ERROR,
+                                "error running non-shared postrotate script "
+                                "for %s of '%s': %s\n", log->files[j], log->pattern, errmsg);
+                    }
+                    logHasErrors[j] = 1;
+                    hasErrors = 1;
+                }
+            }
+        }
+
+        for (i = j;
+                ((log->flags & LOG_FLAG_SHAREDSCRIPTS) && i < log->numFiles)
+                || (!(log->flags & LOG_FLAG_SHAREDSCRIPTS) && i == j); i++) {
+            if (! ( (logHasErrors[i] && !(log->flags & LOG_FLAG_SHAREDSCRIPTS))
+                        || (hasErrors && (log->flags & LOG_FLAG_SHAREDSCRIPTS)) ) ) {
+                logHasErrors[i] |=
+                    postrotateSingleLog(log, i, state[i], rotNames[i]);
+                hasErrors |= logHasErrors[i];
+            }
+        }
+
+    }
+
+    /* members were only marked for removal so far */
+    hasErrors |= packFlush();
+
+    for (i = 0; i < log->numFiles; i++) {
+        free(rotNames[i]->firstRotated);
+        free(rotNames[i]->disposeName);
+        free(rotNames[i]->finalName);
+        free(rotNames[i]->dirName);
+        free(rotNames[i]->baseName);
+        free(rotNames[i]);
+    }
+    free(rotNames);
+    free(state);
+
+    if (log->last) {
+        if (!numRotated) {
+            message(MESS_DEBUG, "not running last action script, "
+                    "since no logs will be rotated\n");
+        } else {
+            message(MESS_DEBUG, "running last action script\n");
+            if (runScript(log, log->pattern, NULL, log->last, &errmsg) < 0) {
+                message(MESS_ERROR, "error running last action script "
+                        "for %s: %s\n", log->pattern, errmsg);
+                hasErrors = 1;
+            }
+        }
+    }
+
+    if (log->flags & LOG_FLAG_SU) {
+        if (switch_user_back() != 0) {
+            free(logHasErrors);
+            return 1;
+        }
+    }
+    free(logHasErrors);
+    return hasErrors;
+}
+
+/* a log set rotated by a child process in the lane of its device */
+struct laneJob {
+    const struct logInfo *log;
+    dev_t dev;
+    pid_t pid;          /* 0 while pending, -1 once finished */
+    int fd;             /* read end of the pipe the child reports states on */
+    char *report;
+    size_t reportLen;
+};
+
+/* state of a rotated log as reported by a lane, followed by its name */
+struct laneState {
+    struct tm lastRotated;
+    int isUsed;
+    size_t fnLen;
+    size_t catalogLen;      /* of the catalog following the name */
+};
+
+/* device of the first existing log of a set, which decides its lane */
+static dev_t logSetDevice(const struct logInfo *log)
+{
+    struct stat sb;
+    unsigned i;
+
+    for (i = 0; i < log->numFiles; i++) {
+        if (lstat(log->files[i], &sb) == 0)
+            return sb.st_dev;
+    }
+    return 0;
+}
+
+/* Body of a lane child: rotate the log set and send the resulting states of
+ * its logs to the parent through fd.  Returns the exit status of the child. */
+static int runLane(const struct logInfo *log, int force, int fd)
+{
+    int rc;
+    unsigned i;
+
+    /* the submission queue of the parent must not be shared */
+    if (uringEnabled()) {
+        uringFree();
+        uringInit();
+    }
+
+    memset(&adaptiveStats, 0, sizeof(adaptiveStats));
+    rc = rotateLogSet(log, force);
+
+    if (full_write(fd, &adaptiveStats, sizeof(adaptiveStats)) != sizeof(adaptiveStats)) {
+        message(MESS_ERROR, "cannot report statistics of %s: %s\n", log->pattern,
+                strerror(errno));
+        rc = 1;
+    }
+
+    for (i = 0; i < log->numFiles; i++) {
+        const struct logState *p = findState(log->files[i]);
+        struct laneState ls;
+        char *catalog = NULL;
+        FILE *f;
+
+        if (p == NULL) {
+            rc = 1;
+            continue;
+        }
+
+        ls.lastRotated = p->lastRotated;
+        ls.isUsed = p->isUsed;
+        ls.fnLen = strlen(p->fn);
+        ls.catalogLen = 0;
+        if ((f = open_memstream(&catalog, &ls.catalogLen)) == NULL
+                || (writeCatalogOf(f, p) | fclose(f)) != 0) {
+            message(MESS_ERROR, "cannot report catalog of %s: %s\n", p->fn,
+                    strerror(errno));
+            free(catalog);
+            rc = 1;
+            break;
+        }
+        if (full_write(fd, &ls, sizeof(ls)) != sizeof(ls)
+            || full_write(fd, p->fn, ls.fnLen) != ls.fnLen
+            || full_write(fd, catalog, ls.catalogLen) != ls.catalogLen) {
+            message(MESS_ERROR, "cannot report state of %s: %s\n", p->fn,
+                    strerror(errno));
+            free(catalog);
+            rc = 1;
+            break;
+        }
+        free(catalog);
+    }
+
+    close(fd);
+    uringFree();
+    return rc != 0;
+}
+
+/* fork the child rotating job->log, returns 0 on success */
+static int startLane(struct laneJob *job, int force)
+{
+    int fds[2];
+
+    if (pipe(fds) != 0) {
+        message(MESS_ERROR, "error creating pipe for lane: %s\n", strerror(errno));
+        return 1;
+    }
+
+    /* do not let the child write out what is buffered for the parent */
+    fflush(NULL);
+
+    job->pid = fork();
+    if (job->pid == -1) {
+        message(MESS_ERROR, "cannot fork: %s\n", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        job->pid = 0;
+        return 1;
+    }
+
+    if (job->pid == 0) {
+        close(fds[0]);
+        _exit(runLane(job->log, force, fds[1]));
+    }
+
+    close(fds[1]);
+    job->fd = fds[0];
+    message(MESS_DEBUG, "started lane %ld for %s on device %#lx\n",
+            (long) job->pid, job->log->pattern, (unsigned long) job->dev);
+    return 0;
+}
+
+/* reap the child of job and merge the states it reported, returns its
+ * success like rotateLogSet() */
+static int finishLane(struct laneJob *job)
+{
+    const char *errmsg = NULL;
+    size_t off = 0;
+    int rc;
+
+    close(job->fd);
+    rc = waitpid_checked(job->pid, "lane", &errmsg);
+    /* a non-zero exit status means the errors have been reported already */
+    if (rc != 0 && rc != -3)
+        message(MESS_ERROR, "rotation of %s failed: %s\n", job->log->pattern, errmsg);
+    rc = rc != 0;
+
+    if (job->reportLen >= sizeof(struct adaptiveStats)) {
+        struct adaptiveStats st;
+        unsigned i;
+
+        memcpy(&st, job->report, sizeof(st));
+        off += sizeof(st);
+        for (i = 0; i < ADAPTIVE_CHOICES; i++) {
+            adaptiveStats.logs[i] += st.logs[i];
+            adaptiveStats.bytes[i] += st.bytes[i];
+        }
+    }
+
+    while (job->reportLen - off >= sizeof(struct laneState)) {
+        struct laneState ls;
+        struct logState *p;
+        char *fn;
+        char *catalog;
+        char *line;
+
+        memcpy(&ls, job->report + off, sizeof(ls));
+        off += sizeof(ls);
+        if (job->reportLen - off < ls.fnLen
+                || job->reportLen - off - ls.fnLen < ls.catalogLen)
+            break;
+
+        fn = strndup(job->report + off, ls.fnLen);
+        off += ls.fnLen;
+        if (fn == NULL) {
+            message_OOM();
+            rc = 1;
+            break;
+        }
+
+        p = findState(fn);
+        free(fn);
+        if (p == NULL) {
+            rc = 1;
+            break;
+        }
+        p->lastRotated = ls.lastRotated;
+        p->isUsed = ls.isUsed;
+
+        /* the catalog as left by the lane, one line after the other */
+        catalogClear(p);
+        catalog = strndup(job->report + off, ls.catalogLen);
+        off += ls.catalogLen;
+        if (catalog == NULL) {
+            message_OOM();
+            rc = 1;
+            break;
+        }
+        for (line = strtok(catalog, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+            if (readCatalogLine(line, &p) != 0) {
+                catalogClear(p);
+                break;
+            }
+        }
+        free(catalog);
+    }
+
+    free(job->report);
+    job->report = NULL;
+    job->pid = -1;
+    return rc;
+}
+
+/* number of lanes of dev currently running */
+static unsigned lanesRunning(const struct laneJob *jobs, size_t count, dev_t dev)
+{
+    unsigned running = 0;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (jobs[i].pid > 0 && jobs[i].dev == dev)
+            running++;
+    }
+    return running;
+}
+
+/* most lanes running at the same time: jobsPerDevice of every device, but
+ * no more than there are log sets of it */
+static unsigned lanesAtOnce(const struct laneJob *jobs, size_t count, unsigned jobsPerDevice)
+{
+    unsigned lanes = 0;
+    size_t i, j;
+
+    for (i = 0; i < count; i++) {
+        unsigned sets = 0;
+
+        for (j = 0; j < i && jobs[j].dev != jobs[i].dev; j++)
+            ;
+        if (j < i)
+            continue;   /* device counted already */
+        for (j = i; j < count; j++) {
+            if (jobs[j].dev == jobs[i].dev)
+                sets++;
+        }
+        lanes += sets < jobsPerDevice ? sets : jobsPerDevice;
+    }
+    return lanes;
+}
+
+/*
+ * Rotate all log sets, each in a child process of its own, so that logs on
+ * different devices are rotated in parallel.  Up to jobsPerDevice log sets of
+ * the same device are rotated at a time, in the order of the configuration.
+ * The children report the new states of their logs back through a pipe.
+ */
+static int rotateLanes(int force, unsigned jobsPerDevice)
+{
+    struct laneJob *jobs;
+    struct pollfd *pfds;
+    const struct logInfo *log;
+    size_t count = 0, finished = 0, i;
+    int rc = 0;
+
+    for (log = logs.tqh_first; log != NULL; log = log->list.tqe_next)
+        count++;
+
+    jobs = calloc(count ? count : 1, sizeof(*jobs));
+    pfds = calloc(count ? count : 1, sizeof(*pfds));
+    if (jobs == NULL || pfds == NULL) {
+        message_OOM();
+        free(jobs);
+        free(pfds);
+        return 1;
+    }
+
+    for (i = 0, log = logs.tqh_first; log != NULL; log = log->list.tqe_next, i++) {
+        jobs[i].log = log;
+        jobs[i].dev = logSetDevice(log);
+    }
+    /* compression threads of all lanes share the CPUs */
+    compressSetJobs(lanesAtOnce(jobs, count, jobsPerDevice));
+
+    while (finished < count) {
+        nfds_t npfds = 0;
+
+        for (i = 0; i < count; i++) {
+            if (jobs[i].pid != 0
+                || lanesRunning(jobs, count, jobs[i].dev) >= jobsPerDevice)
+                continue;
+
+            if (jobs[i].log->numFiles == 0 || startLane(&jobs[i], force) != 0) {
+                /* nothing to fork for, or fork failed */
+                rc |= rotateLogSet(jobs[i].log, force);
+                jobs[i].pid = -1;
+                finished++;
+            }
+        }
+
+        for (i = 0; i < count; i++) {
+            if (jobs[i].pid > 0) {
+                pfds[npfds].fd = jobs[i].fd;
+                pfds[npfds].events = POLLIN;
+                npfds++;
+            }
+        }
+        if (npfds == 0)
+            continue;
+
+        if (poll(pfds, npfds, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            message(MESS_ERROR, "error waiting for lanes: %s\n", strerror(errno));
+            rc = 1;
+            /* read the pipes blocking below */
+        }
+
+        for (i = 0, npfds = 0; i < count; i++) {
+            char buf[4096];
+            ssize_t n;
+            char *report;
+
+            if (jobs[i].pid <= 0)
+                continue;
+            if (pfds[npfds++].revents == 0)
+                continue;
+
+            n = read(jobs[i].fd, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                rc |= finishLane(&jobs[i]);
+                finished++;
+                continue;
+            }
+
+            report = realloc(jobs[i].report, jobs[i].reportLen + (size_t) n);
+            if (report == NULL) {
+                message_OOM();
+                rc = 1;
+                continue;
+            }
+            memcpy(report + jobs[i].reportLen, buf, (size_t) n);
+            jobs[i].report = report;
+            jobs[i].reportLen += (size_t) n;
+        }
+    }
+
+    free(pfds);
+    free(jobs);
+    return rc;
+}
 
-                /* It only makes sense to pass in a final rotated filename if scripts are not shared */
-                const char *logrotfn = (log->flags & LOG_FLAG_SHAREDSCRIPTS) ? NULL : rotNames[j]->finalName;
+/* empty the trash directory of files in dir unless it is in *dirs already */
+static int emptyTrashDirOnce(char ***dirs, size_t *count, const char *dir,
+                       const struct logInfo *log)
+{
+    char *path = trashPath(dir, log->trashDir);
+    char **newDirs;
+    off_t rate;
+    size_t i;
+    int rc;
 
-                message(MESS_DEBUG, "running postrotate script\n");
-                if (runScript(log, logfn, logrotfn, log->post, &errmsg) < 0) {
-                    if (log->flags & LOG_FLAG_SHAREDSCRIPTS)
-                        message(MESS_ERROR,
-                                "error running shared postrotate script "
-                                "for '%s': %s\n", log->pattern, errmsg);
-                    else {
-                        message(MESS_ERROR,
-                                "error running non-shared postrotate script "
-                                "for %s of '%s': %s\n", log->files[j], log->pattern, errmsg);
-                    }
-                    logHasErrors[j] = 1;
-                    hasErrors = 1;
-                }
-            }
-        }
+    if (path == NULL)
+        return 1;
 
-        for (i = j;
-                ((log->flags & LOG_FLAG_SHAREDSCRIPTS) && i < log->numFiles)
-                || (!(log->flags & LOG_FLAG_SHAREDSCRIPTS) && i == j); i++) {
-            if (! ( (logHasErrors[i] && !(log->flags & LOG_FLAG_SHAREDSCRIPTS))
-                        || (hasErrors && (log->flags & LOG_FLAG_SHAREDSCRIPTS)) ) ) {
-                logHasErrors[i] |=
-                    postrotateSingleLog(log, i, state[i], rotNames[i]);
-                hasErrors |= logHasErrors[i];
-            }
+    for (i = 0; i < *count; i++) {
+        if (!strcmp((*dirs)[i], path)) {
+            free(path);
+            return 0;
         }
+    }
 
+    newDirs = realloc(*dirs, (*count + 1) * sizeof(char *));
+    if (newDirs == NULL) {
+        message_OOM();
+        free(path);
+        return 1;
     }
+    newDirs[(*count)++] = path;
+    *dirs = newDirs;
 
-    for (i = 0; i < log->numFiles; i++) {
-        free(rotNames[i]->firstRotated);
-        free(rotNames[i]->disposeName);
-        free(rotNames[i]->finalName);
-        free(rotNames[i]->dirName);
-        free(rotNames[i]->baseName);
-        free(rotNames[i]);
+    /* the first log using a trash directory sets its budget and user */
+    rate = log->trashRate;
+    if (rate < 0) {
+        rate = ioLimitRate(log->iolimit);
+        if (rate == 0)
+            rate = TRASH_DEFAULT_RATE;
     }
-    free(rotNames);
-    free(state);
+    if ((log->flags & LOG_FLAG_SU)
+            && switch_user(log->suUid, log->suGid) != 0)
+        return 1;
+    rc = trashEmpty(path, rate);
+    if ((log->flags & LOG_FLAG_SU) && switch_user_back() != 0)
+        rc = 1;
+    return rc;
+}
 
-    if (log->last) {
-        if (!numRotated) {
-            message(MESS_DEBUG, "not running last action script, "
-                    "since no logs will be rotated\n");
-        } else {
-            message(MESS_DEBUG, "running last action script\n");
-            if (runScript(log, log->pattern, NULL, log->last, &errmsg) < 0) {
-                message(MESS_ERROR, "error running last action script "
-                        "for %s: %s\n", log->pattern, errmsg);
-                hasErrors = 1;
+/* Release the files removed into trash directories, including those left
+ * over by an interrupted run, next to the logs and in their olddir. */
+static int emptyTrashDirs(void)
+{
+    const struct logInfo *log;
+    char **dirs = NULL;
+    size_t count = 0, i;
+    int rc = 0;
+
+    for (log = logs.tqh_first; log != NULL; log = log->list.tqe_next) {
+        unsigned j;
+
+        if (log->trashDir == NULL)
+            continue;
+
+        for (j = 0; j < log->numFiles; j++) {
+            char *logpath = strdup(log->files[j]);
+            const char *ld;
+
+            if (logpath == NULL) {
+                message_OOM();
+                rc = 1;
+                continue;
             }
-        }
-    }
+            ld = dirname(logpath);
+            rc |= emptyTrashDirOnce(&dirs, &count, ld, log);
 
-    if (log->flags & LOG_FLAG_SU) {
-        if (switch_user_back() != 0) {
-            free(logHasErrors);
-            return 1;
+            if (log->oldDir) {
+                char *od = NULL;
+
+                if (log->oldDir[0] == '/')
+                    od = strdup(log->oldDir);
+                else if (asprintf(&od, "%s/%s", ld, log->oldDir) < 0)
+                    od = NULL;
+                if (od == NULL) {
+                    message_OOM();
+                    rc = 1;
+                } else {
+                    rc |= emptyTrashDirOnce(&dirs, &count, od, log);
+                }
+                free(od);
+            }
+            free(logpath);
         }
     }
-    free(logHasErrors);
-    return hasErrors;
+
+    for (i = 0; i < count; i++)
+        free(dirs[i]);
+    free(dirs);
+    return rc;
 }
 
 static int writeState(const char *stateFilename)
 {
     struct logState *p;
     FILE *f;
-    char *chptr;
     unsigned int i = 0;
     int error = 0;
     int bytes = 0;
@@ -2885,29 +5713,7 @@ static int writeState(const char *stateFilename)
                 continue;
             }
 
-            error = fputc('"', f) == EOF;
-            for (chptr = p->fn; *chptr && error == 0; chptr++) {
-                switch (*chptr) {
-                    case '"':
-                    case '\\':
-                        error = fputc('\\', f) == EOF;
-                        break;
-                    case '\n':
-                        error = fputc('\\', f) == EOF;
-                        if (error == 0) {
-                            error = fputc('n', f) == EOF;
-                        }
-                        continue;
-                    default:
-                        break;
-                }
-                if (error == 0 && fputc(*chptr, f) == EOF) {
-                    error = 1;
-                }
-            }
-
-            if (error == 0 && fputc('"', f) == EOF)
-                error = 1;
+            error = writeQuoted(f, p->fn);
 
             if (error == 0) {
                 bytes = fprintf(f, " %d-%d-%d-%d:%d:%d\n",
@@ -2961,6 +5767,145 @@ static int writeState(const char *stateFilename)
     return error;
 }
 
+/* Write the catalogs of rotated logs to the file next to the state file,
+ * or remove it if no catalogs are kept. */
+static int writeCatalog(const char *stateFilename)
+{
+    struct logState *p;
+    char *catalogFilename = NULL;
+    char *tmpFilename = NULL;
+    struct stat sb;
+    unsigned int i;
+    size_t kept = 0;
+    int error = 0;
+    int fd;
+    FILE *f;
+
+    if (!strcmp(stateFilename, "/dev/null"))
+        return 0;
+
+    for (i = 0; i < hashSize; i++) {
+        for (p = states[i]->head.lh_first; p != NULL; p = p->list.le_next) {
+            /* gone with the state of a log gone for a year */
+            if (p->catalogScanned && !p->isUsed
+                    && difftime(nowSecs, p->catalogScanned) > SECONDS_IN_YEAR)
+                catalogClear(p);
+            if (p->catalogScanned)
+                kept++;
+        }
+    }
+
+    if (asprintf(&catalogFilename, "%s%s", stateFilename, CATALOG_EXT) < 0
+            || asprintf(&tmpFilename, "%s%s.tmp", stateFilename, CATALOG_EXT) < 0) {
+        message_OOM();
+        free(catalogFilename);
+        return 1;
+    }
+
+    if (kept == 0) {
+        if (unlink(catalogFilename) != 0 && errno != ENOENT) {
+            message(MESS_ERROR, "error removing %s: %s\n", catalogFilename,
+                    strerror(errno));
+            error = 1;
+        }
+        goto out;
+    }
+
+    /* as accessible as the state file */
+    if (stat(stateFilename, &sb) != 0) {
+        message(MESS_ERROR, "error stating %s: %s\n", stateFilename, strerror(errno));
+        error = 1;
+        goto out;
+    }
+    unlink(tmpFilename);
+    fd = createOutputFile(tmpFilename, O_WRONLY, &sb, NULL, 0);
+    if (fd < 0) {
+        error = 1;
+        goto out;
+    }
+    f = fdopen(fd, "w");
+    if (f == NULL) {
+        message(MESS_ERROR, "error creating %s: %s\n", tmpFilename, strerror(errno));
+        close(fd);
+        unlink(tmpFilename);
+        error = 1;
+        goto out;
+    }
+
+    error = fputs("logrotate catalog -- version 1\n", f) == EOF;
+    for (i = 0; i < hashSize && error == 0; i++) {
+        for (p = states[i]->head.lh_first; p != NULL && error == 0; p = p->list.le_next)
+            error = writeCatalogOf(f, p);
+    }
+    if (error == 0)
+        error = fflush(f) != 0 || fsync(fd) != 0;
+    if (fclose(f) != 0)
+        error = 1;
+
+    if (error == 0 && rename(tmpFilename, catalogFilename) != 0)
+        error = 1;
+    if (error) {
+        message(MESS_ERROR, "error writing %s: %s\n", catalogFilename, strerror(errno));
+        unlink(tmpFilename);
+    }
+
+out:
+    free(tmpFilename);
+    free(catalogFilename);
+    return error;
+}
+
+/* Read the catalogs of rotated logs written by writeCatalog().  They only
+ * spare searching directories, so one that cannot be read is ignored. */
+static void readCatalog(const char *stateFilename)
+{
+    struct logState *current = NULL;
+    char *catalogFilename;
+    char *buf = NULL;
+    size_t bufSize = 0;
+    ssize_t len;
+    int line = 0;
+    FILE *f;
+
+    if (!strcmp(stateFilename, "/dev/null"))
+        return;
+
+    if (asprintf(&catalogFilename, "%s%s", stateFilename, CATALOG_EXT) < 0) {
+        message_OOM();
+        return;
+    }
+
+    f = fopen(catalogFilename, "r");
+    if (f == NULL) {
+        if (errno != ENOENT)
+            message(MESS_WARN, "error opening %s, searching the directories "
+                    "of rotated logs: %s\n", catalogFilename, strerror(errno));
+        free(catalogFilename);
+        return;
+    }
+
+    message(MESS_DEBUG, "Reading catalog of rotated logs from %s\n", catalogFilename);
+
+    while ((len = getline(&buf, &bufSize, f)) > 0) {
+        line++;
+        if (buf[len - 1] != '\n')
+            break;
+        buf[len - 1] = '\0';
+        if (line == 1 ? strcmp(buf, "logrotate catalog -- version 1") != 0
+                : buf[0] != '\0' && readCatalogLine(buf, &current) != 0)
+            break;
+    }
+    if (len > 0) {
+        message(MESS_WARN, "bad line %d in %s, searching the directories of "
+                "rotated logs\n", line, catalogFilename);
+        catalogClearAll();
+    }
+
+    free(buf);
+    fclose(f);
+    free(catalogFilename);
+}
+
 static int readState(const char *stateFilename)
 {
     FILE *f;
@@ -3256,6 +6201,95 @@ static int lockState(const char *stateFilename, int skip_state_lock, int wait_fo
     return 0;
 }
 
+/* parse the value of --io-limit, with the units of the iolimit directive */
+static int parseIoLimit(const char *str, off_t *rate)
+{
+    unsigned long long value;
+    unsigned long multiplier = 1;
+    char *end;
+
+    if (!isdigit((unsigned char)str[0]))
+        return 1;
+
+    errno = 0;
+    value = strtoull(str, &end, 0);
+    if (errno != 0)
+        return 1;
+
+    if (*end == 'k' || *end == 'K')
+        multiplier = 1024;
+    else if (*end == 'M')
+        multiplier = 1024 * 1024;
+    else if (*end == 'G')
+        multiplier = 1024 * 1024 * 1024;
+    if (multiplier != 1)
+        end++;
+    if (*end != '\0')
+        return 1;
+
+    *rate = (off_t) (multiplier * value);
+    return *rate < 0;
+}
+
+/* --cat: write the compressed logs in files uncompressed to stdout, each
+ * from the uncompressed offset on */
+static int catLogs(const char **files, off_t offset)
+{
+    int rc = 0;
+
+    for (; *files; files++) {
+        const struct compressBackend *backend = compressFindBackendByExt(*files);
+        int fd;
+
+        if (backend == NULL) {
+            message(MESS_ERROR, "%s is not compressed by a built-in compressor (%s)\n",
+                    *files, compressBackendList());
+            rc = 1;
+            continue;
+        }
+
+        if ((fd = open(*files, O_RDONLY)) < 0) {
+            message(MESS_ERROR, "error opening %s: %s\n", *files, strerror(errno));
+            rc = 1;
+            continue;
+        }
+        if (uncompressFdFrom(backend, fd, *files, STDOUT_FILENO, "standard output", offset))
+            rc = 1;
+        close(fd);
+    }
+
+    return rc;
+}
+
+/* --query: list the logs in files which may hold token, that is those with
+ * a bloom filter holding it and those without a usable one */
+static int queryLogs(const char **files, const char *token)
+{
+    for (; *files; files++) {
+        char *filterName;
+        int fd;
+        int found = 1;
+
+        if (asprintf(&filterName, "%s%s", *files, BLOOM_EXT) < 0) {
+            message_OOM();
+            return 1;
+        }
+        if ((fd = open(filterName, O_RDONLY)) < 0) {
+            message(MESS_DEBUG, "no bloom filter %s: %s\n", filterName,
+                    strerror(errno));
+        } else {
+            found = bloomQuery(fd, filterName, token) != 0;
+            close(fd);
+        }
+        free(filterName);
+
+        if (found)
+            printf("%s\n", *files);
+    }
+
+    return fflush(stdout) != 0;
+}
+
 int main(int argc, const char **argv)
 {
     int force = 0;
@@ -3263,6 +6297,12 @@ int main(int argc, const char **argv)
     int wait_for_state_lock = 0;
     const char *stateFile = STATEFILE;
     const char *logFile = NULL;
+    const char *ioEngine = NULL;
+    const char *ioLimit = NULL;
+    int deviceJobs = 0;
+    int cat = 0;
+    const char *catOffset = NULL;
+    const char *queryToken = NULL;
     FILE *logFd = NULL;
     int rc = 0;
     int arg;
@@ -3282,6 +6322,20 @@ int main(int argc, const char **argv)
             "statefile"},
         {"skip-state-lock", '\0', POPT_ARG_NONE, &skip_state_lock, 0, "Do not lock the state file", NULL},
         {"wait-for-state-lock", '\0', POPT_ARG_NONE, &wait_for_state_lock, 0, "Wait for lock on the state file", NULL},
+        {"io-engine", '\0', POPT_ARG_STRING, &ioEngine, 0,
+            "I/O engine for copying and compressing logs", "uring|sync"},
+        {"io-limit", '\0', POPT_ARG_STRING, &ioLimit, 0,
+            "Limit copying, compressing and shredding to bytes per second and device",
+            "bytes"},
+        {"device-jobs", '\0', POPT_ARG_INT, &deviceJobs, 0,
+            "Rotate logs on different devices in parallel, up to count log sets per device",
+            "count"},
+        {"cat", '\0', POPT_ARG_NONE, &cat, 0,
+            "Write the given compressed logs to standard output uncompressed", NULL},
+        {"offset", '\0', POPT_ARG_STRING, &catOffset, 0,
+            "Start --cat at this uncompressed offset, seeking in seekable logs", "bytes"},
+        {"query", '\0', POPT_ARG_STRING, &queryToken, 0,
+            "List the given compressed logs whose bloom filter may hold token", "token"},
         {"verbose", 'v', 0, NULL, 'v', "Display messages during rotation", NULL},
         {"log", 'l', POPT_ARG_STRING, &logFile, 'l', "Log file or 'syslog' to log to syslog",
             "logfile"},
@@ -3328,6 +6382,8 @@ int main(int argc, const char **argv)
                 printf("    Default compress command:   %s\n", COMPRESS_COMMAND);
                 printf("    Default uncompress command: %s\n", UNCOMPRESS_COMMAND);
                 printf("    Default compress extension: %s\n", COMPRESS_EXT);
+                printf("    Internal compressors:       %s\n", compressBackendList());
+                printf("    io_uring engine:            %s\n", uringSupported() ? "yes" : "no");
                 printf("    Default state file path:    %s\n", STATEFILE);
 #ifdef WITH_ACL
                 printf("    ACL support:                yes\n");
@@ -3366,6 +6422,31 @@ int main(int argc, const char **argv)
         exit(1);
     }
 
+    if (cat) {
+        intmax_t offset = 0;
+
+        if (catOffset) {
+            char *end;
+
+            errno = 0;
+            offset = strtoimax(catOffset, &end, 10);
+            if (errno || *catOffset == '\0' || *end != '\0' || offset < 0) {
+                fprintf(stderr, "logrotate: bad offset '%s'\n", catOffset);
+                poptFreeContext(optCon);
+                exit(1);
+            }
+        }
+        rc = catLogs(files, (off_t) offset);
+        poptFreeContext(optCon);
+        return rc;
+    }
+
+    if (queryToken) {
+        rc = queryLogs(files, queryToken);
+        poptFreeContext(optCon);
+        return rc;
+    }
+
     if (skip_state_lock && wait_for_state_lock) {
         fprintf(stderr, "logrotate: options --skip-state-lock and"
                 " --wait-for-state-lock are mutually exclusive\n");
@@ -3373,6 +6454,38 @@ int main(int argc, const char **argv)
         exit(1);
     }
 
+    if (ioEngine && strcmp(ioEngine, "sync") != 0) {
+        if (strcmp(ioEngine, "uring") != 0) {
+            fprintf(stderr, "logrotate: unknown I/O engine '%s'"
+                    " (expected uring or sync)\n", ioEngine);
+            poptFreeContext(optCon);
+            exit(1);
+        }
+        if (uringInit() != 0)
+            message(MESS_WARN, "io_uring engine not available (%s),"
+                    " using synchronous I/O\n", strerror(errno));
+    }
+
+    if (ioLimit) {
+        off_t rate;
+
+        if (parseIoLimit(ioLimit, &rate) != 0) {
+            fprintf(stderr, "logrotate: bad I/O limit '%s'\n", ioLimit);
+            poptFreeContext(optCon);
+            exit(1);
+        }
+        ioLimitSetDefault(rate);
+    }
+
+    if (deviceJobs < 0) {
+        fprintf(stderr, "logrotate: bad number of jobs per device %d\n", deviceJobs);
+        poptFreeContext(optCon);
+        exit(1);
+    }
+    /* parallel lanes of one device share its I/O limit */
+    if (deviceJobs > 1)
+        ioLimitSetShares((unsigned) deviceJobs);
+
 #ifdef WITH_SELINUX
     selinux_enabled = (is_selinux_enabled() > 0);
     selinux_enforce = security_getenforce();
@@ -3392,8 +6505,12 @@ int main(int argc, const char **argv)
         exit(3);
     }
 
+    /* dictionaries of compressdict are kept next to the state */
+    zstdDictSetDir(stateFile);
+
     if (readState(stateFile))
         rc = 1;
+    readCatalog(stateFile);
 
     message(MESS_DEBUG, "\nHandling %d logs\n", numLogs);
 
@@ -3403,12 +6520,25 @@ int main(int argc, const char **argv)
     if (signal(SIGCHLD, SIG_DFL) == SIG_ERR)
         message(MESS_WARN, "failed to reset SIGCHLD handler: %s\n", strerror(errno));
 
-    for (log = logs.tqh_first; log != NULL; log = log->list.tqe_next)
-        rc |= rotateLogSet(log, force);
+    if (deviceJobs > 0)
+        rc |= rotateLanes(force, (unsigned) deviceJobs);
+    else
+        for (log = logs.tqh_first; log != NULL; log = log->list.tqe_next)
+            rc |= rotateLogSet(log, force);
+
+    reportAdaptiveStats();
+
+    if (!debug)
+        rc |= emptyTrashDirs();
 
     if (!debug)
         rc |= writeState(stateFile);
 
+    if (!debug)
+        rc |= writeCatalog(stateFile);
+
+    uringFree();
+
     return (rc != 0);
 }
 
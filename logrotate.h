@@ -1,8 +1,10 @@
 #ifndef H_LOGROTATE
 #define H_LOGROTATE
 
+#include <limits.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <time.h>
 #include "queue.h"
 #include <glob.h>
 
@@ -29,6 +31,19 @@
 #define LOG_FLAG_DATEHOURAGO      (1U << 15)
 #define LOG_FLAG_ALLOWHARDLINK    (1U << 16)
 #define LOG_FLAG_IGNOREDUPLICATES (1U << 17)
+#define LOG_FLAG_DROPCACHE        (1U << 18)
+#define LOG_FLAG_COMPRESSINPLACE  (1U << 19)
+#define LOG_FLAG_SEEKABLE         (1U << 20)
+#define LOG_FLAG_ADAPTIVECOMPRESS (1U << 21)
+#define LOG_FLAG_COMPRESSDICT     (1U << 22)
+#define LOG_FLAG_STREAMCOMPRESS   (1U << 23)
+
+#define CHILD_NICE_UNSET        INT_MIN
+
+/* I/O scheduling classes for ioclass, as used by ioprio_set(2) */
+#define CHILD_IOCLASS_REALTIME    1
+#define CHILD_IOCLASS_BEST_EFFORT 2
+#define CHILD_IOCLASS_IDLE        3
 
 #define NO_MODE ((mode_t) -1)
 #define NO_UID  ((uid_t) -1)
@@ -52,11 +67,23 @@ enum criterium {
     ROT_MINUTES
 };
 
+/* longest dateext suffix */
+#define DATEEXT_LEN 64
+
+/* dateext suffix, compiled from dateformat when the configuration is read */
+struct dateExt {
+    char *format;                   /* for strftime(3) and strptime(3) */
+    char *pattern;                  /* glob(7) pattern matching the suffixes */
+    size_t length;                  /* of every suffix matching pattern */
+    int sortByDate;                 /* 0 if the names of rotated logs sort by date */
+};
+
 struct logInfo {
     char *pattern;
     char **files;
     unsigned numFiles;
     char *oldDir;
+    char *trashDir;                 /* removed files are released from here gradually */
     enum criterium criterium;
     unsigned weekday; /* used by ROT_WEEKLY only */
     unsigned monthday; /* used by ROT_MONTHLY only */
@@ -64,9 +91,17 @@ struct logInfo {
     off_t threshold;
     off_t maxsize;
     off_t minsize;
+    off_t iolimit;                  /* bytes per second and device, -1 if unset */
+    off_t trashRate;                /* bytes released from trashDir per second, -1 if unset */
+    off_t truncateStep;             /* copytruncate punches holes of this size, 0 if off */
+    off_t copyTail;                 /* copytruncate re-copies tails of this size, 0 if off */
+    off_t indexInterval;            /* bytes between two entries of the time index */
     int rotateCount;
     int rotateMinAge;
     int rotateAge;
+    int recompressAge;              /* days after which archives are recompressed */
+    int packOlder;                  /* generations kept outside of packs, 0 if off */
+    int catalogDays;                /* days between scans for rotated logs, 0 if off */
     int logStart;
     char *pre, *post, *first, *last, *preremove;
     char *logAddress;
@@ -75,7 +110,11 @@ struct logInfo {
     char *compress_prog;
     char *uncompress_prog;
     char *compress_ext;
+    int compressThreads;            /* threads of built-in compressors, 0 for one per CPU, -1 if unset */
     char *dateformat;               /* specify format for strftime (for dateext) */
+    struct dateExt *dateExt;        /* compiled dateformat, NULL without dateext */
+    char *indexFormat;              /* strptime format of timestamps for index, NULL if off */
+    char *bloomPattern;             /* regex of tokens put into a bloom filter, NULL if off */
     uint32_t flags;
     int shred_cycles;               /* if !=0, pass -n shred_cycles to GNU shred */
     mode_t createMode;              /* if any/all of these are -1, we use the */
@@ -83,12 +122,19 @@ struct logInfo {
     gid_t createGid;
     uid_t suUid;                    /* switch user to this uid and group to this gid */
     gid_t suGid;
+    int childNice;                  /* niceness of children, CHILD_NICE_UNSET if unset */
+    int childIoClass;               /* CHILD_IOCLASS_* of children, 0 if unset */
+    int childIoPriority;            /* 0-7 within childIoClass, -1 if unset */
+    char *childCpuAffinity;         /* list of CPUs children may run on */
+    char *childCgroup;              /* cgroup v2 directory children are moved to */
     mode_t olddirMode;
     uid_t olddirUid;
     uid_t olddirGid;
     /* these are at the end so they end up nil */
     const char **compress_options_list;
     int compress_options_count;
+    const char **recompress_list;   /* recompress command and its options */
+    int recompress_count;
     TAILQ_ENTRY(logInfo) list;
 };
 
@@ -101,6 +147,9 @@ extern int debug;
 int switch_user(uid_t user, gid_t group);
 int switch_user_back(void);
 int readAllConfigPaths(const char **paths);
+const char *matchDateExt(const struct dateExt *dext, const char *str,
+                         struct tm *tm);
+size_t full_write(int fd, const void *buf, size_t count);
 #if !defined(asprintf) && !defined(_FORTIFY_SOURCE)
 int asprintf(char **string_ptr, const char *format, ...);
 #endif
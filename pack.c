@@ -0,0 +1,547 @@
+#include "queue.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "logrotate.h"
+#include "pack.h"
+
+/*
+ * With packolder, rotated logs past a number of generations are moved into
+ * a pack shared by the logs of a stanza in a directory, one per day, so
+ * they take one inode instead of one each.  A pack is an uncompressed ustar
+ * archive of the rotated logs as they were, usually compressed already, so
+ * it can be read with tar(1); numbers too large for ustar, like sizes of
+ * 8 GiB and more, are stored in base-256 as GNU tar does.  Its headers serve as the index: they are
+ * read once per run, 512 bytes per member, without reading any data.
+ *
+ * A member is appended by writing its data and a new end of the archive
+ * behind the current end first, and its header over the old end last, so
+ * an interrupted append leaves the pack as it was.  Members removed by
+ * retention are only marked while logs are rotated; packFlush() rewrites
+ * each pack holding any of them once, or removes it if none are left.
+ */
+
+#define PACK_BLOCK 512
+#define PACK_COPY_SIZE (128 * 1024)
+
+struct pack {
+    char *name;
+    struct packMember *members;     /* sorted by name */
+    size_t count;
+    size_t alloc;
+    off_t end;                      /* offset of the end of archive marker */
+    int dirty;                      /* members were removed */
+    LIST_ENTRY(pack) list;
+};
+
+static LIST_HEAD(packHead, pack) packs = LIST_HEAD_INITIALIZER(packs);
+
+static const char zeroBlocks[2 * PACK_BLOCK];
+
+/* ustar header of a regular file */
+struct packHeader {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+};
+
+static unsigned headerChecksum(const struct packHeader *h)
+{
+    const unsigned char *p = (const unsigned char *) h;
+    unsigned sum = 0;
+    size_t i;
+
+    for (i = 0; i < sizeof(*h); i++) {
+        if (i >= offsetof(struct packHeader, chksum)
+                && i < offsetof(struct packHeader, chksum) + sizeof(h->chksum))
+            sum += ' ';
+        else
+            sum += p[i];
+    }
+    return sum;
+}
+
+/* parse a number field, in octal or in the base-256 of GNU tar */
+static uintmax_t parseNumber(const char *field, size_t len)
+{
+    uintmax_t v = 0;
+    size_t i = 0;
+
+    if ((unsigned char) field[0] == 0x80) {
+        for (i = 1; i < len; i++)
+            v = v << 8 | (unsigned char) field[i];
+        return v;
+    }
+
+    while (i < len && field[i] == ' ')
+        i++;
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+        v = v * 8 + (uintmax_t) (field[i] - '0');
+    return v;
+}
+
+static off_t roundBlock(off_t size)
+{
+    return (size + PACK_BLOCK - 1) / PACK_BLOCK * PACK_BLOCK;
+}
+
+static int compareName(const void *a, const void *b)
+{
+    return strcmp(((const struct packMember *) a)->name,
+                  ((const struct packMember *) b)->name);
+}
+
+static int compareOffset(const void *a, const void *b)
+{
+    const off_t x = ((const struct packMember *) a)->offset;
+    const off_t y = ((const struct packMember *) b)->offset;
+
+    return (x > y) - (x < y);
+}
+
+/* first member of pack with a name not sorting before key */
+static size_t lowerBound(const struct pack *pack, const char *key)
+{
+    size_t lo = 0, hi = pack->count;
+
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+
+        if (strcmp(pack->members[mid].name, key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* make sure there is room for one more member */
+static int reserveMember(struct pack *pack)
+{
+    if (pack->count == pack->alloc) {
+        const size_t alloc = pack->alloc ? pack->alloc * 2 : 64;
+        struct packMember *members = realloc(pack->members, alloc * sizeof(*members));
+
+        if (members == NULL) {
+            message_OOM();
+            return 1;
+        }
+        pack->members = members;
+        pack->alloc = alloc;
+    }
+    return 0;
+}
+
+/* insert a member into the room made by reserveMember() at index pos */
+static struct packMember *insertMember(struct pack *pack, size_t pos)
+{
+    memmove(pack->members + pos + 1, pack->members + pos,
+            (pack->count - pos) * sizeof(*pack->members));
+    pack->count++;
+    memset(pack->members + pos, 0, sizeof(*pack->members));
+    pack->members[pos].pack = pack;
+    pack->members[pos].packName = pack->name;
+    return pack->members + pos;
+}
+
+static void freePack(struct pack *pack)
+{
+    size_t i;
+
+    for (i = 0; i < pack->count; i++)
+        free(pack->members[i].name);
+    free(pack->members);
+    free(pack->name);
+    free(pack);
+}
+
+/* read the headers of the pack in fd */
+static int scanPack(struct pack *pack, int fd)
+{
+    off_t off = 0;
+
+    for (;;) {
+        struct packHeader h;
+        struct packMember *m;
+        char name[sizeof(h.prefix) + 1 + sizeof(h.name) + 1];
+        const ssize_t n = pread(fd, &h, sizeof(h), off);
+
+        if (n == 0)
+            break;
+        if (n != (ssize_t) sizeof(h)) {
+            message(MESS_ERROR, "error reading %s at offset %jd: %s\n", pack->name,
+                    (intmax_t) off, n < 0 ? strerror(errno) : "truncated header");
+            return 1;
+        }
+        if (memcmp(&h, zeroBlocks, sizeof(h)) == 0)
+            break;
+        if (memcmp(h.magic, "ustar", 5) != 0
+                || parseNumber(h.chksum, sizeof(h.chksum)) != headerChecksum(&h)) {
+            message(MESS_ERROR, "%s has no valid tar header at offset %jd\n",
+                    pack->name, (intmax_t) off);
+            return 1;
+        }
+
+        if (h.prefix[0])
+            snprintf(name, sizeof(name), "%.*s/%.*s", (int) sizeof(h.prefix), h.prefix,
+                     (int) sizeof(h.name), h.name);
+        else
+            snprintf(name, sizeof(name), "%.*s", (int) sizeof(h.name), h.name);
+
+        if (reserveMember(pack) != 0)
+            return 1;
+        m = insertMember(pack, pack->count);
+        if ((m->name = strdup(name)) == NULL) {
+            message_OOM();
+            return 1;
+        }
+        m->mtime = (time_t) parseNumber(h.mtime, sizeof(h.mtime));
+        m->size = (off_t) parseNumber(h.size, sizeof(h.size));
+        m->offset = off;
+        off += PACK_BLOCK + roundBlock(m->size);
+    }
+
+    pack->end = off;
+    qsort(pack->members, pack->count, sizeof(*pack->members), compareName);
+    return 0;
+}
+
+/* the pack name as read at the first use in this run, NULL on errors */
+static struct pack *getPack(const char *name, int fd)
+{
+    struct pack *pack;
+    int ownFd = -1;
+
+    LIST_FOREACH(pack, &packs, list) {
+        if (!strcmp(pack->name, name))
+            return pack;
+    }
+
+    pack = calloc(1, sizeof(*pack));
+    if (pack == NULL || (pack->name = strdup(name)) == NULL) {
+        message_OOM();
+        free(pack);
+        return NULL;
+    }
+
+    if (fd < 0 && (fd = ownFd = open(name, O_RDONLY | O_CLOEXEC)) < 0) {
+        message(MESS_ERROR, "error opening %s: %s\n", name, strerror(errno));
+        freePack(pack);
+        return NULL;
+    }
+    if (scanPack(pack, fd) != 0) {
+        if (ownFd >= 0)
+            close(ownFd);
+        freePack(pack);
+        return NULL;
+    }
+    if (ownFd >= 0)
+        close(ownFd);
+
+    LIST_INSERT_HEAD(&packs, pack, list);
+    return pack;
+}
+
+/* Write v into the number field of len bytes, in octal with a terminating
+ * NUL if it fits, otherwise in the base-256 of GNU tar, which stores the
+ * value big-endian after a first byte of 0x80. */
+static void putNumber(char *field, size_t len, uintmax_t v)
+{
+    size_t i;
+
+    if ((len - 1) * 3 >= sizeof(v) * 8 || v >> (len - 1) * 3 == 0) {
+        snprintf(field, len, "%0*jo", (int) (len - 1), v);
+        return;
+    }
+    for (i = len - 1; i > 0; i--) {
+        field[i] = (char) (v & 0xff);
+        v >>= 8;
+    }
+    field[0] = (char) 0x80;
+}
+
+static int fillHeader(struct packHeader *h, const char *member, const struct stat *sb)
+{
+    const size_t len = strlen(member);
+
+    memset(h, 0, sizeof(*h));
+    if (len <= sizeof(h->name)) {
+        memcpy(h->name, member, len);
+    } else {
+        /* split at a slash into prefix and name */
+        const char *slash = member + len - sizeof(h->name) - 1;
+
+        while (*slash && *slash != '/')
+            slash++;
+        if (*slash == '\0' || (size_t) (slash - member) > sizeof(h->prefix))
+            return 1;
+        memcpy(h->prefix, member, (size_t) (slash - member));
+        memcpy(h->name, slash + 1, len - (size_t) (slash - member) - 1);
+    }
+
+    snprintf(h->mode, sizeof(h->mode), "%07o", (unsigned) (sb->st_mode & 07777));
+    putNumber(h->uid, sizeof(h->uid), (uintmax_t) sb->st_uid);
+    putNumber(h->gid, sizeof(h->gid), (uintmax_t) sb->st_gid);
+    putNumber(h->size, sizeof(h->size), (uintmax_t) sb->st_size);
+    putNumber(h->mtime, sizeof(h->mtime), (uintmax_t) sb->st_mtime);
+    h->typeflag = '0';
+    memcpy(h->magic, "ustar", 6);
+    memcpy(h->version, "00", 2);
+    snprintf(h->chksum, sizeof(h->chksum), "%06o", headerChecksum(h));
+    h->chksum[7] = ' ';
+    return 0;
+}
+
+/* copy len bytes from inFd at inOff to outFd at outOff */
+static int copyRange(int inFd, const char *inName, off_t inOff, int outFd,
+                     const char *outName, off_t outOff, off_t len)
+{
+    char *buf = malloc(PACK_COPY_SIZE);
+
+    if (buf == NULL) {
+        message_OOM();
+        return 1;
+    }
+    while (len > 0) {
+        const size_t want = len < PACK_COPY_SIZE ? (size_t) len : PACK_COPY_SIZE;
+        const ssize_t n = pread(inFd, buf, want, inOff);
+
+        if (n <= 0) {
+            message(MESS_ERROR, "error reading %s: %s\n", inName,
+                    n < 0 ? strerror(errno) : "unexpected end of file");
+            free(buf);
+            return 1;
+        }
+        if (pwrite(outFd, buf, (size_t) n, outOff) != n) {
+            message(MESS_ERROR, "error writing %s: %s\n", outName, strerror(errno));
+            free(buf);
+            return 1;
+        }
+        inOff += n;
+        outOff += n;
+        len -= n;
+    }
+    free(buf);
+    return 0;
+}
+
+/* Append the file fileName open as fd with the attributes sb to the existing
+ * pack packName as member, returns 0 once it is synced. */
+int packAdd(const char *packName, int fd, const char *fileName,
+            const struct stat *sb, const char *member)
+{
+    struct packHeader h;
+    struct pack *pack;
+    struct packMember *m;
+    char *name = NULL;
+    off_t dataEnd;
+    int packFd;
+    int failed = 1;
+
+    if (fillHeader(&h, member, sb) != 0) {
+        message(MESS_ERROR, "name %s is too long for %s\n", member, packName);
+        return 1;
+    }
+
+    if ((packFd = open(packName, O_RDWR | O_CLOEXEC)) < 0) {
+        message(MESS_ERROR, "error opening %s: %s\n", packName, strerror(errno));
+        return 1;
+    }
+    /* the cache is updated without failing once the member is written */
+    if ((pack = getPack(packName, packFd)) == NULL || reserveMember(pack) != 0)
+        goto out;
+    if ((name = strdup(member)) == NULL) {
+        message_OOM();
+        goto out;
+    }
+
+    dataEnd = pack->end + PACK_BLOCK + roundBlock(sb->st_size);
+    if (copyRange(fd, fileName, 0, packFd, packName, pack->end + PACK_BLOCK, sb->st_size))
+        goto out;
+    if (pwrite(packFd, zeroBlocks, (size_t) (dataEnd - pack->end - PACK_BLOCK - sb->st_size),
+               pack->end + PACK_BLOCK + sb->st_size) < 0
+            || pwrite(packFd, zeroBlocks, sizeof(zeroBlocks), dataEnd) != sizeof(zeroBlocks)
+            || fsync(packFd) != 0
+            || pwrite(packFd, &h, sizeof(h), pack->end) != sizeof(h)
+            || fsync(packFd) != 0) {
+        message(MESS_ERROR, "error writing %s: %s\n", packName, strerror(errno));
+        goto out;
+    }
+
+    m = insertMember(pack, lowerBound(pack, member));
+    m->name = name;
+    name = NULL;
+    m->mtime = sb->st_mtime;
+    m->size = sb->st_size;
+    m->offset = pack->end;
+    pack->end = dataEnd;
+    failed = 0;
+
+out:
+    free(name);
+    close(packFd);
+    return failed;
+}
+
+/* Add the members of the pack packName with names starting with prefix to
+ * the array *members of *count entries.  They stay valid until the next
+ * packAdd() or packFlush(). */
+int packFind(const char *packName, const char *prefix,
+             struct packMember ***members, size_t *count)
+{
+    const size_t prefixLen = strlen(prefix);
+    struct pack *pack = getPack(packName, -1);
+    size_t i;
+
+    if (pack == NULL)
+        return 1;
+
+    for (i = lowerBound(pack, prefix); i < pack->count
+            && !strncmp(pack->members[i].name, prefix, prefixLen); i++) {
+        struct packMember **more = realloc(*members, (*count + 1) * sizeof(**members));
+
+        if (more == NULL) {
+            message_OOM();
+            return 1;
+        }
+        *members = more;
+        (*members)[(*count)++] = pack->members + i;
+    }
+    return 0;
+}
+
+/* drop member from its pack by the next packFlush() */
+void packRemove(struct packMember *member)
+{
+    member->removed = 1;
+    member->pack->dirty = 1;
+}
+
+/* write pack without its removed members */
+static int rewritePack(struct pack *pack)
+{
+    struct stat sb;
+    char *tmpName;
+    int inFd, outFd;
+    off_t off = 0;
+    size_t i;
+    int failed = 1;
+
+    if ((inFd = open(pack->name, O_RDONLY | O_CLOEXEC)) < 0) {
+        message(MESS_ERROR, "error opening %s: %s\n", pack->name, strerror(errno));
+        return 1;
+    }
+    if (fstat(inFd, &sb) != 0) {
+        message(MESS_ERROR, "fstat of %s failed: %s\n", pack->name, strerror(errno));
+        close(inFd);
+        return 1;
+    }
+    if (asprintf(&tmpName, "%s.tmp", pack->name) < 0) {
+        message_OOM();
+        close(inFd);
+        return 1;
+    }
+
+    /* left over by an interrupted run */
+    unlink(tmpName);
+    outFd = open(tmpName, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (outFd < 0) {
+        message(MESS_ERROR, "error creating %s: %s\n", tmpName, strerror(errno));
+        goto out;
+    }
+    if (fchmod(outFd, sb.st_mode & 07777) != 0
+            || (geteuid() == ROOT_UID && fchown(outFd, sb.st_uid, sb.st_gid) != 0)) {
+        message(MESS_ERROR, "error setting owner and mode of %s: %s\n", tmpName,
+                strerror(errno));
+        goto out;
+    }
+
+    qsort(pack->members, pack->count, sizeof(*pack->members), compareOffset);
+    for (i = 0; i < pack->count; i++) {
+        const struct packMember *m = pack->members + i;
+        const off_t len = PACK_BLOCK + roundBlock(m->size);
+
+        if (m->removed)
+            continue;
+        if (copyRange(inFd, pack->name, m->offset, outFd, tmpName, off, len))
+            goto out;
+        off += len;
+    }
+    if (pwrite(outFd, zeroBlocks, sizeof(zeroBlocks), off) != sizeof(zeroBlocks)
+            || fsync(outFd) != 0) {
+        message(MESS_ERROR, "error writing %s: %s\n", tmpName, strerror(errno));
+        goto out;
+    }
+    if (rename(tmpName, pack->name) != 0) {
+        message(MESS_ERROR, "error renaming %s to %s: %s\n", tmpName, pack->name,
+                strerror(errno));
+        goto out;
+    }
+    failed = 0;
+
+out:
+    if (outFd >= 0)
+        close(outFd);
+    if (failed)
+        unlink(tmpName);
+    close(inFd);
+    free(tmpName);
+    return failed;
+}
+
+/* Rewrite the packs members were removed from, and forget about all packs
+ * read so far.  Returns 0 on success. */
+int packFlush(void)
+{
+    int failed = 0;
+
+    while (!LIST_EMPTY(&packs)) {
+        struct pack *pack = LIST_FIRST(&packs);
+        size_t kept = 0;
+        size_t i;
+
+        for (i = 0; i < pack->count; i++)
+            kept += !pack->members[i].removed;
+
+        if (pack->dirty && kept == 0) {
+            message(MESS_DEBUG, "removing %s, no members are left\n", pack->name);
+            if (unlink(pack->name) != 0 && errno != ENOENT) {
+                message(MESS_ERROR, "error removing %s: %s\n", pack->name,
+                        strerror(errno));
+                failed = 1;
+            }
+        } else if (pack->dirty) {
+            message(MESS_DEBUG, "rewriting %s with %zu of %zu members\n", pack->name,
+                    kept, pack->count);
+            failed |= rewritePack(pack);
+        }
+
+        LIST_REMOVE(pack, list);
+        freePack(pack);
+    }
+
+    return failed;
+}
+
+/* vim: set et sw=4 ts=4: */
@@ -0,0 +1,32 @@
+#ifndef H_PACK
+#define H_PACK
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* suffix of the archives rotated logs are packed into with packolder */
+#define PACK_EXT ".tar"
+
+struct pack;
+
+struct packMember {
+    struct pack *pack;
+    const char *packName;
+    char *name;
+    time_t mtime;
+    off_t offset;           /* of its header */
+    off_t size;
+    int removed;
+};
+
+int packAdd(const char *packName, int fd, const char *fileName,
+            const struct stat *sb, const char *member);
+int packFind(const char *packName, const char *prefix,
+             struct packMember ***members, size_t *count);
+void packRemove(struct packMember *member);
+int packFlush(void);
+
+#endif
+
+/* vim: set et sw=4 ts=4: */
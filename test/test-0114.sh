@@ -0,0 +1,24 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+if ! $LOGROTATE --version | grep "Internal compressors:.*gzip" >/dev/null; then
+  echo "Skipping test 114: no internal gzip compressor"
+  exit 77
+fi
+
+cleanup 114
+
+# ------------------------------- Test 114 -----------------------------------
+# compresscmd/uncompresscmd internal:gzip compress in-process and produce
+# output readable by gunzip
+preptest test.log 114 2 1
+$RLR test-config.114 --force || exit 23
+
+checkoutput <<EOF2
+test.log 0
+test.log.1.gz 1 zero
+test.log.2.gz 1 first
+EOF2
+
+checkmail test.log.3.gz second
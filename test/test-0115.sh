@@ -0,0 +1,23 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+cleanup 115
+
+# ------------------------------- Test 115 -----------------------------------
+# the compress command sees the name of the file being compressed even if
+# LOGROTATE_COMPRESSED_FILENAME is already set in the environment
+preptest test.log 115 1
+LOGROTATE_COMPRESSED_FILENAME=stale $RLR test-config.115 --force || exit 23
+
+checkoutput <<EOF2
+test.log 0
+test.log.1.Z 1 zero
+EOF2
+
+if [ "$(grep -c '^LOGROTATE_COMPRESSED_FILENAME=' compress-env)" != 1 ] ||
+   ! grep -Eq '^LOGROTATE_COMPRESSED_FILENAME=.+/test.log.1$' compress-env; then
+      echo "LOGROTATE_COMPRESSED_FILENAME environment variable not set correctly."
+      cat compress-env
+      exit 3
+fi
@@ -0,0 +1,37 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+cleanup 116
+
+# ------------------------------- Test 116 -----------------------------------
+# copytruncate copies a log with whatever copy method is available and the
+# copy matches the original byte for byte
+preptest test.log 116 1 0
+
+i=0
+while [ $i -lt 2000 ]; do
+    echo "line $i of a log that is copied by the kernel if possible"
+    i=$((i + 1))
+done > test.log
+cp test.log test.example
+
+$RLR test-config.116 --force 2>output || { cat output; exit 23; }
+
+if ! grep -Eq "copied .*/test.log to .*/test.log.1 using (reflink|copy_file_range|sendfile|read/write)" output; then
+    echo "copy method not reported"
+    cat output
+    exit 3
+fi
+
+if ! cmp test.example test.log.1; then
+    echo "test.log.1 differs from the original log"
+    exit 3
+fi
+
+if [ -s test.log ]; then
+    echo "test.log has not been truncated"
+    exit 3
+fi
+
+rm -f test.example output
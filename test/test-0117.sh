@@ -0,0 +1,47 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+cleanup 117
+
+# ------------------------------- Test 117 -----------------------------------
+# Rotate sparse file with several data extents and a trailing hole
+preptest test.log 117 1 0
+
+printf zero > test.log
+truncate -s 4M test.log
+printf middle >> test.log
+truncate -s 8M test.log
+printf end >> test.log
+truncate -s 12M test.log
+
+cp test.log test.example
+
+SIZE_SPARSE_OLD=$(du test.log|awk '{print $1}')
+if [ $SIZE_SPARSE_OLD -gt 100 ]; then
+    echo "unable to create (or detect) sparse files"
+    exit 77
+fi
+
+$RLR test-config.117 --force 2>output || { cat output; exit 23; }
+
+if ! cmp test.example test.log.1; then
+    echo "test.log.1 differs from the original log"
+    exit 3
+fi
+
+SIZE_SPARSE_NEW=$(du test.log.1|awk '{print $1}')
+if [ $SIZE_SPARSE_NEW -gt 100 ]; then
+    echo "Bad size of sparse logs"
+    echo "test.log: $SIZE_SPARSE_OLD"
+    echo "test.log.1: $SIZE_SPARSE_NEW"
+    cat output
+    exit 3
+fi
+
+if [ -s test.log ]; then
+    echo "test.log has not been truncated"
+    exit 3
+fi
+
+rm -f test.example output
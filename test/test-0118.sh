@@ -0,0 +1,52 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+if ! command -v fincore > /dev/null 2>&1; then
+  echo "Skipping test 118: fincore(1) not available"
+  exit 77
+fi
+
+if [ "$(stat -f -c %T . 2>/dev/null)" = tmpfs ]; then
+  echo "Skipping test 118: page cache of tmpfs cannot be dropped"
+  exit 77
+fi
+
+cleanup 118
+
+# ------------------------------- Test 118 -----------------------------------
+# dropcache evicts copied and compressed logs from the page cache
+preptest test.log 118 1 0
+
+i=0
+while [ $i -lt 20000 ]; do
+    echo "line $i of a log that should not stay in the page cache"
+    i=$((i + 1))
+done > test.log
+cp test.log test2.log
+cat test.log test2.log > /dev/null
+
+resident() {
+    fincore --bytes --noheadings -o RES "$1" | tr -d ' '
+}
+
+BEFORE=$(resident test.log)
+if [ "$BEFORE" = 0 ]; then
+    echo "unable to populate the page cache"
+    exit 77
+fi
+
+echo "test.log: $BEFORE bytes resident before rotation"
+
+$RLR test-config.118 --force || exit 23
+
+for f in test.log test.log.1 test2.log.1.gz; do
+    AFTER=$(resident $f)
+    echo "$f: $AFTER bytes resident after rotation"
+    if [ "$AFTER" != 0 ]; then
+        echo "$f is still in the page cache"
+        exit 3
+    fi
+done
+
+cmp test.log test.log.1 || exit 3
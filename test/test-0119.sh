@@ -0,0 +1,41 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+if ! $LOGROTATE --version | grep "io_uring engine:.*yes" >/dev/null ||
+   ! $LOGROTATE --version | grep "Internal compressors:.*gzip" >/dev/null; then
+  echo "Skipping test 119: no io_uring engine or internal gzip compressor"
+  exit 77
+fi
+
+cleanup 119
+
+# ------------------------------- Test 119 -----------------------------------
+# --io-engine=uring copies and feeds the internal compressor through io_uring
+preptest test.log 119 1 0
+
+i=0
+while [ $i -lt 50000 ]; do
+    echo "line $i of a log that is read through io_uring"
+    i=$((i + 1))
+done > test.log
+cp test.log test2.log
+cp test.log test.example
+
+$RLR --io-engine=uring test-config.119 --force 2>output || { cat output; exit 23; }
+
+if grep "io_uring engine not available" output >/dev/null; then
+    echo "Skipping test 119: io_uring not permitted"
+    exit 77
+fi
+
+if ! grep -q "copied .*/test.log to .*/test.log.1 using io_uring" output; then
+    echo "io_uring not used for copying"
+    cat output
+    exit 3
+fi
+
+cmp test.example test.log.1 || exit 3
+gunzip -c test2.log.1.gz | cmp test.example - || exit 3
+
+rm -f test.example output
@@ -0,0 +1,35 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+cleanup 120
+
+# ------------------------------- Test 120 -----------------------------------
+# iolimit throttles copying and shredding per device
+preptest test.log 120 1 0
+
+head -c 1048576 /dev/zero | tr '\0' 'x' > test.log
+cp test.log test2.log
+cp test.log copy
+
+$RLR test-config.120 --io-limit=bogus --force && exit 3
+
+START=$(date +%s)
+OUTPUT=$($RLR test-config.120 --force 2>&1) || exit 23
+END=$(date +%s)
+
+# shred runs once per pass, each waiting for the limit
+[ "$(echo "$OUTPUT" | grep -c "shred command (pid")" = 2 ] || exit 3
+
+# 2 passes over 1M shredded and 1M copied at 1M/s, with 1M of initial burst
+if [ $((END - START)) -lt 1 ]; then
+    echo "rotation took less than a second despite iolimit"
+    exit 3
+fi
+
+cmp copy test2.log.1 || exit 3
+
+checkoutput <<EOF
+test.log 0
+test2.log 0
+EOF
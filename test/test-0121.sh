@@ -0,0 +1,18 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+cleanup 121
+
+# ------------------------------- Test 121 -----------------------------------
+# nice, ioclass and cpuaffinity apply to scripts, whose resource usage is shown
+preptest test.log 121 1 0
+
+OUTPUT=$($RLR test-config.121 --force 2>&1) || exit 23
+
+if [ "$(cat scriptout)" != 5 ]; then
+    echo "postrotate script did not run with nice 5"
+    exit 3
+fi
+
+echo "$OUTPUT" | grep -q "^sub-shell (pid [0-9]*) used .* CPU time" || exit 3
@@ -0,0 +1,33 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+cleanup 122
+
+# ------------------------------- Test 122 -----------------------------------
+# --device-jobs rotates log sets in lanes and merges their states
+preptest test.log 122 1 0
+preptest test2.log 122 1 0
+preptest test3.log 122 1 0
+
+$RLR test-config.122 --force --device-jobs=-1 && exit 3
+$RLR test-config.122 --force --device-jobs=2 || exit 23
+
+checkoutput <<EOF
+test.log 0
+test.log.1 0 zero
+test2.log 0
+test2.log.1 0 zero
+test3.log 0
+test3.log.1 0 zero
+EOF
+
+# test3.log has been rotated while the script of test2.log was still running
+if [ "$(tr '\n' ' ' < scriptout)" != "test.log test3.log test2.log " ]; then
+    echo "log sets were not rotated in parallel: $(cat scriptout)"
+    exit 3
+fi
+
+for log in test.log test2.log test3.log; do
+    grep -q "/$log\" $(date +%Y-%-m-%-d)" state || { echo "$log missing from state"; exit 3; }
+done
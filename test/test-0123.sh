@@ -0,0 +1,59 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+cleanup 123
+
+# ------------------------------- Test 123 -----------------------------------
+# trashdir moves removed logs aside and releases them, also after a crash
+preptest test.log 123 1
+preptest test2.log 123 1
+
+rm -rf trash
+mkdir trash
+# left over by an interrupted run
+head -c 100000 /dev/zero > trash/12345.test.log.3
+echo keep > trash/unrelated
+
+# the data of a removed log with another link must survive
+ln test2.log.1 test2.saved
+
+$RLR test-config.123 --force || exit 23
+
+checkoutput <<EOF
+test.log 0
+test.log.1 0 zero
+test2.log 0
+test2.log.1 0 zero
+test2.saved 0 first
+trash/unrelated 0 keep
+EOF
+
+if [ "$(ls trash)" != unrelated ]; then
+    echo "trash has not been emptied: $(ls trash)"
+    exit 3
+fi
+
+# a trash directory replaced by a symbolic link is left alone
+rm -rf trash elsewhere
+mkdir elsewhere
+echo victim > elsewhere/1.victim
+ln -s elsewhere trash
+$RLR test-config.123 --force 2> test.error.log && exit 3
+grep -q "error opening trash directory .*/trash" test.error.log || exit 3
+[ "$(cat elsewhere/1.victim)" = victim ] || exit 3
+[ "$(ls elsewhere)" = 1.victim ] || exit 3
+
+# trashrate paces the release, here of 300000 bytes at 64 KiB per second
+rm -rf trash elsewhere
+mkdir trash
+head -c 300000 /dev/zero > trash/12346.test.log.4
+start=$(date +%s)
+$RLR test-config.123 --force || exit 23
+if [ $(($(date +%s) - start)) -lt 3 ]; then
+    echo "trash has been released too fast"
+    exit 3
+fi
+[ -e trash/12346.test.log.4 ] && exit 3
+
+exit 0
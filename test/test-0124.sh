@@ -0,0 +1,34 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+cleanup 124
+
+# ------------------------------- Test 124 -----------------------------------
+# truncatestep releases the copied data of a copytruncate log in steps
+preptest test.log 124 1
+
+i=0
+while [ $i -lt 5000 ]; do
+    echo "line $i of a large live log"
+    i=$((i + 1))
+done > test.log
+cp test.log copy
+
+OUTPUT=$($RLR test-config.124 --force 2>&1) || exit 23
+
+cmp copy test.log.1 || exit 3
+if [ -s test.log ]; then
+    echo "test.log has not been truncated"
+    exit 3
+fi
+
+if echo "$OUTPUT" | grep -q "cannot punch holes"; then
+    echo "Skipping test 124: file system cannot punch holes"
+    exit 77
+fi
+
+echo "$OUTPUT" | grep -q "released [0-9]* copied bytes of .*test.log in steps of 16384" || exit 3
+
+# what is appended while holes are punched is copied before the truncation
+echo "$OUTPUT" | grep -q "0 bytes of .*test.log at risk by truncating it" || exit 3
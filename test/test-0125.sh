@@ -0,0 +1,36 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+cleanup 125
+
+# ------------------------------- Test 125 -----------------------------------
+# copytail copies what is appended during a slow copytruncate before truncating
+preptest test.log 125 1
+
+head -c 2097152 /dev/zero | tr '\0' 'x' | fold -w 63 > test.log
+
+# keep appending numbered lines while the log is copied
+(
+    i=0
+    while [ $i -lt 200 ]; do
+        echo "appended $i" >> test.log
+        i=$((i + 1))
+        sleep 0.01
+    done
+) &
+WRITER=$!
+
+OUTPUT=$($RLR test-config.125 --force 2>&1) || { kill $WRITER; exit 23; }
+wait $WRITER
+
+echo "$OUTPUT" | grep -q "copied [0-9]* bytes appended to .*test.log during the copy" || exit 3
+echo "$OUTPUT" | grep -q "[0-9]* bytes of .*test.log at risk by truncating it" || exit 3
+
+if [ "$(tail -c 1 test.log.1 | od -An -c | tr -d ' ')" != '\n' ]; then
+    echo "test.log.1 does not end with a complete line"
+    exit 3
+fi
+
+# the appended lines in the copy have no gaps
+grep appended test.log.1 | awk '$2 != NR - 1 { print "missing line " NR - 1; exit 1 }' || exit 3
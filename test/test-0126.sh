@@ -0,0 +1,32 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+cleanup 126
+
+# ------------------------------- Test 126 -----------------------------------
+# copytruncate with compress and streamcompress writes only the compressed
+# copy of the live log, compress commands still get the rotated name
+preptest test.log 126 0
+preptest test2.log 126 0
+
+OUTPUT=$($RLR test-config.126 --force 2>&1) || exit 23
+
+echo "$OUTPUT" | grep -q "compressing .*/test.log directly into .*test.log.1.gz" || exit 3
+grep -Eq '^LOGROTATE_COMPRESSED_FILENAME=.+/test.log.1$' compress-env || exit 3
+
+if [ -e test.log.1 ]; then
+    echo "uncompressed copy test.log.1 left behind"
+    exit 3
+fi
+
+# without streamcompress an uncompressed copy is compressed as before
+echo "$OUTPUT" | grep -q "compressing .*test2.log directly" && exit 3
+echo "$OUTPUT" | grep -q "copying .*/test2.log to .*/test2.log.1" || exit 3
+
+checkoutput <<EOF
+test.log 0
+test.log.1.gz 1 zero
+test2.log 0
+test2.log.1.gz 1 zero
+EOF
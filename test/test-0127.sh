@@ -0,0 +1,81 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+if ! $LOGROTATE --version | grep "Internal compressors:.*gzip" >/dev/null; then
+  echo "Skipping test 127: no internal gzip compressor"
+  exit 77
+fi
+
+cleanup 127
+
+# ------------------------------- Test 127 -----------------------------------
+# compressinplace releases the compressed parts of a log while compressing it
+preptest test.log 127 0
+
+seq 1 3000000 > test.log
+cp test.log test.copy.log
+
+OUTPUT=$($RLR test-config.127 --force 2>&1) || exit 23
+
+gunzip -c test.log.1.gz | cmp test.copy.log - || exit 3
+if [ -e test.log.1 ] || [ -e test.log.1.gz.partial ]; then
+    echo "test.log.1 or test.log.1.gz.partial left behind"
+    exit 3
+fi
+
+if echo "$OUTPUT" | grep -q "cannot punch holes"; then
+    echo "Skipping test 127: file system cannot punch holes"
+    exit 77
+fi
+
+echo "$OUTPUT" | grep -q "released 16777216 bytes of .*test.log.1 while compressing it" || exit 3
+
+# a partial file left by a crash refills the released start of its log,
+# which is then compressed again
+rm -f test.log.1.gz
+seq 1 3000000 > test.log.1
+cp test.log.1 test.copy.log
+head -c 16777216 test.log.1 | gzip -1 > test.log.1.gz.partial
+head -c 1000 /dev/urandom >> test.log.1.gz.partial
+fallocate -p -o 0 -l 16777216 test.log.1 || exit 3
+echo new > test.log
+
+$RLR test-config.127 --force || exit 23
+
+gunzip -c test.log.2.gz | cmp test.copy.log - || exit 3
+gunzip -c test.log.1.gz | grep -qx new || exit 3
+if [ -e test.log.2 ] || [ -e test.log.1.gz.partial ] || [ -e test.log.2.gz.partial ]; then
+    echo "recovered files left behind"
+    exit 3
+fi
+
+# a partial file of a log with nothing released is removed
+rm -f test.log.2.gz
+echo older > test.log.2
+echo stale > test.log.2.gz.partial
+echo newest > test.log
+
+$RLR test-config.127 --force || exit 23
+
+if [ -e test.log.2 ] || [ -e test.log.2.gz.partial ]; then
+    echo "test.log.2 or test.log.2.gz.partial left behind"
+    exit 3
+fi
+gunzip -c test.log.2.gz | grep -qx new || exit 3
+gunzip -c test.log.1.gz | grep -qx newest || exit 3
+
+# partial files of other logs starting with the same name are left alone, one
+# of a log which is gone is removed
+echo other > test.log2.1
+echo other > test.log2.1.gz.partial
+echo orphan > test.log.5.gz.partial
+echo latest > test.log
+
+$RLR test-config.127 --force || exit 23
+
+[ -e test.log.5.gz.partial ] && exit 3
+[ "$(cat test.log2.1)" = other ] || exit 3
+[ "$(cat test.log2.1.gz.partial)" = other ] || exit 3
+
+exit 0
@@ -0,0 +1,22 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+if ! $LOGROTATE --version | grep "Internal compressors:.*gzip" >/dev/null; then
+  echo "Skipping test 128: no internal gzip compressor"
+  exit 77
+fi
+
+cleanup 128
+
+# ------------------------------- Test 128 -----------------------------------
+# compressthreads compresses gzip in chunks which gunzip reads as one file
+preptest test.log 128 0
+
+seq 1 1000000 > test.log
+cp test.log test.copy.log
+
+OUTPUT=$($RLR test-config.128 --force 2>&1) || exit 23
+
+echo "$OUTPUT" | grep -q "compressing .*test.log.1 internally with gzip, level 6, [12] thread(s)" || exit 3
+gunzip -c test.log.1.gz | cmp test.copy.log - || exit 3
@@ -0,0 +1,26 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+if ! $LOGROTATE --version | grep "Internal compressors:.*gzip" >/dev/null; then
+  echo "Skipping test 129: no internal gzip compressor"
+  exit 77
+fi
+
+cleanup 129
+
+# ------------------------------- Test 129 -----------------------------------
+# seekable writes an indexed gzip file, which --cat --offset seeks in
+preptest test.log 129 0
+
+seq 1 1500000 > test.log
+cp test.log test.copy.log
+
+$RLR test-config.129 --force || exit 23
+
+gunzip -c test.log.1.gz | cmp test.copy.log - || exit 3
+
+# the second frame starts at 4 MiB
+OUTPUT=$($LOGROTATE -v --cat --offset 5000000 test.log.1.gz 2>&1 >test.tail.log) || exit 23
+echo "$OUTPUT" | grep -q "frame at offset [0-9]* of test.log.1.gz holds offset 5000000" || exit 3
+tail -c +5000001 test.copy.log | cmp - test.tail.log || exit 3
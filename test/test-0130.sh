@@ -0,0 +1,58 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+if ! $LOGROTATE --version | grep "Internal compressors:.*gzip" >/dev/null; then
+  echo "Skipping test 130: no internal gzip compressor"
+  exit 77
+fi
+
+cleanup 130
+
+# ------------------------------- Test 130 -----------------------------------
+# index notes the timestamp of a line every indexinterval bytes while the log
+# is compressed, the index follows the log when it is rotated further
+preptest test.log 130 0
+
+TZ=UTC
+export TZ
+
+# 64 byte lines, one second apart, so that every 4096th line is indexed
+awk 'BEGIN { for (i = 0; i < 20000; i++)
+    printf "2024-01-01T%02d:%02d:%02d line %038d\n", i / 3600, i / 60 % 60, i % 60, i }' > test.log
+cp test.log test.copy.log
+
+$RLR test-config.130 --force || exit 23
+
+gunzip -c test.log.1.gz | cmp test.copy.log - || exit 3
+
+cat > test.expected.log <<EOT
+LRTIME1 %Y-%m-%dT%H:%M:%S
+1704067200 0
+1704071296 262144
+1704075392 524288
+1704079488 786432
+1704083584 1048576
+EOT
+cmp test.expected.log test.log.1.gz.idx || exit 3
+
+# the offsets are the ones --cat --offset takes
+$LOGROTATE --cat --offset 524288 test.log.1.gz | head -n 1 > test.tail.log
+echo "2024-01-01T02:16:32 line 00000000000000000000000000000000008192" | cmp - test.tail.log || exit 3
+
+# a log without timestamps gets an index without entries
+echo more > test.log
+$RLR test-config.130 --force || exit 23
+
+cmp test.expected.log test.log.2.gz.idx || exit 3
+head -n 1 test.expected.log | cmp - test.log.1.gz.idx || exit 3
+
+# the index is removed with its log
+echo more > test.log
+$RLR test-config.130 --force || exit 23
+
+head -n 1 test.expected.log | cmp - test.log.2.gz.idx || exit 3
+[ -e test.log.3.gz ] && exit 3
+[ -e test.log.3.gz.idx ] && exit 3
+
+exit 0
@@ -0,0 +1,53 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+if ! $LOGROTATE --version | grep "Internal compressors:.*gzip" >/dev/null; then
+  echo "Skipping test 131: no internal gzip compressor"
+  exit 77
+fi
+
+cleanup 131
+
+# ------------------------------- Test 131 -----------------------------------
+# bloom writes a bloom filter of the ids in a log while it is compressed,
+# --query lists the logs which may hold an id
+preptest test.log 131 0
+
+awk 'BEGIN { for (i = 0; i < 50000; i++)
+    printf "GET /item/%d id=%08x%08x status=200\n", i, i * 7919, i }' > test.log
+
+$RLR test-config.131 --force || exit 23
+
+[ -s test.log.1.gz.bloom ] || exit 3
+head -c 9 test.log.1.gz.bloom | grep -q "^LRBLOOM1 " || exit 3
+
+echo "id=00000001ffffffff" > test.log
+$RLR test-config.131 --force || exit 23
+
+# the filter went along with its log
+[ -e test.log.2.gz.bloom ] || exit 3
+
+$LOGROTATE --query 0005ebbf00000031 test.log.1.gz test.log.2.gz > test.found.log || exit 3
+echo test.log.2.gz | cmp - test.found.log || exit 3
+
+$LOGROTATE --query 00000001ffffffff test.log.1.gz test.log.2.gz > test.found.log || exit 3
+echo test.log.1.gz | cmp - test.found.log || exit 3
+
+# the literal start of the pattern is not part of the ids
+$LOGROTATE --query id=00000001ffffffff test.log.1.gz test.log.2.gz > test.found.log || exit 3
+[ -s test.found.log ] && exit 3
+
+# logs without a filter may hold anything
+gzip -c test.log.2.gz > test.plain.log.gz
+$LOGROTATE --query 00000001ffffffff test.plain.log.gz > test.found.log || exit 3
+echo test.plain.log.gz | cmp - test.found.log || exit 3
+
+# a bitmap starting with a byte scanf takes for white space
+echo "id=00000002" > test.log
+$RLR test-config.131 --force || exit 23
+[ "$(od -An -tx1 -j14 -N1 test.log.1.gz.bloom)" = " 20" ] || exit 3
+$LOGROTATE --query 00000002 test.log.1.gz > test.found.log || exit 3
+echo test.log.1.gz | cmp - test.found.log || exit 3
+
+exit 0
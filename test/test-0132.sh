@@ -0,0 +1,37 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+if ! $LOGROTATE --version | grep "Internal compressors:.*gzip" >/dev/null; then
+  echo "Skipping test 132: no internal gzip compressor"
+  exit 77
+fi
+
+cleanup 132
+
+# ------------------------------- Test 132 -----------------------------------
+# adaptivecompress stores incompressible logs with the built-in gzip standing
+# in for the external one, and compresses others as configured
+preptest test.log 132 0
+preptest test.random.log 132 0
+
+seq 1 100000 > test.log
+cp test.log test.copy.log
+head -c 1000000 /dev/urandom > test.random.log
+cp test.random.log test.random.copy.log
+
+OUTPUT=$($RLR test-config.132 --force 2>&1) || exit 23
+
+echo "$OUTPUT" | grep -q "adaptivecompress: .*/test.log.1 has [0-9.]* bits of entropy per byte, compressing it as configured" || exit 3
+echo "$OUTPUT" | grep -q "adaptivecompress: .*/test.random.log.1 has [0-9.]* bits of entropy per byte, storing it with the least compression" || exit 3
+echo "$OUTPUT" | grep -q "compressing .*/test.random.log.1 internally with gzip, level 0" || exit 3
+echo "$OUTPUT" | grep -q "adaptivecompress: 1 log(s) of 588895 bytes compressed as configured, 0 of 0 bytes at the fastest level, 1 of 1000000 bytes stored" || exit 3
+
+gunzip -c test.log.1.gz | cmp test.copy.log - || exit 3
+gunzip -c test.random.log.1.gz | cmp test.random.copy.log - || exit 3
+
+# the stored log did not shrink
+[ "$(wc -c < test.random.log.1.gz)" -gt 1000000 ] || exit 3
+[ "$(wc -c < test.log.1.gz)" -lt 588895 ] || exit 3
+
+exit 0
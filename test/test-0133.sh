@@ -0,0 +1,67 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+if ! $LOGROTATE --version | grep "Internal compressors:.*gzip" >/dev/null; then
+  echo "Skipping test 133: no internal gzip compressor"
+  exit 77
+fi
+
+cleanup 133
+
+# ------------------------------- Test 133 -----------------------------------
+# recompress compresses archives older than its age once more, keeping their
+# times, with a built-in or an external command
+preptest test.log 133 0
+preptest test.ext.log 133 0
+preptest test.fail.log 133 0
+
+seq 1 100000 | awk '{ print "Oct 19 12:00:00 host app[" $1 % 97 "]: request " $1 " served in " ($1 * 7) % 113 " ms" }' > test.copy.log
+for l in test test.ext test.fail; do
+  gzip -1 -c test.copy.log > $l.log.1.gz
+  gzip -1 -c test.copy.log > $l.log.2.gz
+done
+touch -d '5 days ago' test.log.1.gz
+touch -r test.log.1.gz test.ext.log.1.gz
+touch -r test.log.1.gz test.fail.log.1.gz
+OLDSIZE=$(wc -c < test.log.1.gz)
+OLDTIME=$(stat -c %Y test.log.1.gz)
+
+OUTPUT=$($RLR test-config.133 --force 2>&1) || exit 23
+
+echo "$OUTPUT" | grep -q "recompressing .*/test.log.1.gz with internal:gzip" || exit 3
+echo "$OUTPUT" | grep -q "recompressing .*/test.ext.log.1.gz with gzip" || exit 3
+echo "$OUTPUT" | grep -q "recompressing .*/test.log.2.gz" && exit 3
+
+for l in test test.ext; do
+  # the recompressed archive moved on with its marker
+  gunzip -c $l.log.2.gz | cmp test.copy.log - || exit 3
+  gunzip -c $l.log.3.gz | cmp test.copy.log - || exit 3
+  [ -f $l.log.2.gz.recompressed ] || exit 3
+  [ -f $l.log.3.gz.recompressed ] && exit 3
+  [ "$(wc -c < $l.log.2.gz)" -lt "$OLDSIZE" ] || exit 3
+  [ "$(stat -c %Y $l.log.2.gz)" = "$OLDTIME" ] || exit 3
+  [ -f $l.log.2.gz.recompress ] && exit 3
+done
+
+# a failed recompression leaves the archive alone and does not stop rotation
+echo "$OUTPUT" | grep -q "test.fail.log.1.gz not recompressed" || exit 3
+gunzip -c test.fail.log.1.gz | grep -q zero || exit 3
+gunzip -c test.fail.log.2.gz | cmp test.copy.log - || exit 3
+gunzip -c test.fail.log.3.gz | cmp test.copy.log - || exit 3
+[ "$(stat -c %Y test.fail.log.2.gz)" = "$OLDTIME" ] || exit 3
+[ -f test.fail.log.2.gz.recompressed ] && exit 3
+[ -f test.fail.log.2.gz.recompress ] && exit 3
+
+# an archive is only recompressed once
+echo more > test.log
+echo more > test.ext.log
+echo more > test.fail.log
+OUTPUT=$($RLR test-config.133 --force 2>&1) || exit 23
+echo "$OUTPUT" | grep "recompressing" | grep -qv "/test.fail.log" && exit 3
+# the failed one is tried again
+echo "$OUTPUT" | grep -q "recompressing .*/test.fail.log.2.gz with false" || exit 3
+[ -f test.log.3.gz.recompressed ] || exit 3
+gunzip -c test.log.3.gz | cmp test.copy.log - || exit 3
+
+exit 0
@@ -0,0 +1,53 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+if ! $LOGROTATE --version | grep "Internal compressors:.*zstd" >/dev/null; then
+  echo "Skipping test 134: no internal zstd compressor"
+  exit 77
+fi
+
+cleanup 134
+rm -rf state.dicts
+
+# ------------------------------- Test 134 -----------------------------------
+# compressdict collects samples of the logs of a stanza, trains a zstd
+# dictionary from them and compresses the following logs with it, writing a
+# manifest next to them which decompression finds the dictionary by
+preptest test.1.log 134 0
+
+for i in $(seq 1 40); do
+  seq 1 250 | awk -v s=$i '{ print "10.0." s "." $1 " - - [19/Oct/2026:12:00:" $1 % 60 " +0000] \"GET /api/v1/items/" ($1 * s) % 977 " HTTP/1.1\" 200 " ($1 * 13) % 5000 }' > test.$i.log
+  cp test.$i.log test.$i.copy
+done
+
+OUTPUT=$($RLR test-config.134 --force 2>&1) || exit 23
+
+echo "$OUTPUT" | grep -q "trained dictionary state.dicts/[0-9a-f]*.dict of [0-9]* bytes for .*/test.\*.log from 32 samples" || exit 3
+[ "$(echo "$OUTPUT" | grep -c "added [0-9]* bytes of .* to the dictionary samples")" = 32 ] || exit 3
+[ "$(echo "$OUTPUT" | grep -c "compressing .* with dictionary")" = 9 ] || exit 3
+[ -f state.dicts/*.samples ] && exit 3
+
+DICTS=0
+for i in $(seq 1 40); do
+  $LOGROTATE --cat test.$i.log.1.zst | cmp test.$i.copy - || exit 3
+  if [ -f test.$i.log.1.zst.dict ]; then
+    grep -q "^LRDICT1 [0-9]* /.*/state.dicts/[0-9a-f]*.dict$" test.$i.log.1.zst.dict || exit 3
+    DICTS=$((DICTS + 1))
+  fi
+done
+[ "$DICTS" = 9 ] || exit 3
+
+# the manifests follow the logs, which stay readable
+for i in $(seq 1 40); do
+  echo more > test.$i.log
+done
+OUTPUT=$($RLR test-config.134 --force 2>&1) || exit 23
+echo "$OUTPUT" | grep -q "added [0-9]* bytes" && exit 3
+[ "$(ls test.*.log.2.zst.dict | wc -l)" = 9 ] || exit 3
+for i in $(seq 1 40); do
+  $LOGROTATE --cat test.$i.log.2.zst | cmp test.$i.copy - || exit 3
+  [ -f test.$i.log.1.zst.dict ] || exit 3
+done
+
+exit 0
@@ -0,0 +1,66 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+cleanup 135
+
+# ------------------------------- Test 135 -----------------------------------
+# packolder moves rotated logs past its count into per day packs, which
+# rotate and maxage prune
+preptest test.log 135 0
+preptest test.date.log 135 0
+rm -f logrotate-*.tar
+
+for d in 1 2 3; do
+  echo "numbered $d" > test.log.$d
+  touch -d "$d days ago" test.log.$d
+  DATE=$(date -d "$d days ago" +%Y%m%d)
+  echo "dated $d" > test.date.log-${DATE}120000
+  touch -d "$d days ago" test.date.log-${DATE}120000
+done
+D1=$(date -d '1 days ago' +%Y%m%d)
+D2=$(date -d '2 days ago' +%Y%m%d)
+D3=$(date -d '3 days ago' +%Y%m%d)
+
+$RLR test-config.135 --force || exit 23
+
+# only the newest rotated logs are left outside of packs
+checkoutput <<EOF
+test.log 0
+test.log.1 0 zero
+EOF
+[ -f test.log.2 ] && exit 3
+[ -f test.date.log-${D1}120000 ] || exit 3
+[ -f test.date.log-${D2}120000 ] && exit 3
+[ "$(ls logrotate-*-${D1}.tar logrotate-*-${D2}.tar logrotate-*-${D3}.tar | wc -l)" = 5 ] || exit 3
+
+members() {
+  cat "$@" | tar tif -
+}
+
+members logrotate-*-${D3}.tar > packed
+grep -q "^test.log/test.log-${D3}[0-9]*$" packed || exit 3
+grep -q "^test.date.log/test.date.log-${D3}120000$" packed || exit 3
+for d in 1 2 3; do
+  DATE=$(date -d "$d days ago" +%Y%m%d)
+  [ "$(cat logrotate-*-$DATE.tar | tar xOif - --wildcards 'test.log/*')" = "numbered $d" ] || exit 3
+done
+
+# the pack of the day before yesterday loses the oldest numbered log beyond
+# rotate 4 and the oldest dated one beyond maxage 2, so it goes away
+sed -i 's/maxage 10/maxage 2/' test-config.135
+config_crc=$(${MD5SUM} test-config.135)
+echo again > test.log
+echo again > test.date.log
+sleep 1
+$RLR test-config.135 --force || exit 23
+
+checkoutput <<EOF
+test.log.1 0 again
+EOF
+ls logrotate-*-${D3}.tar 2>/dev/null && exit 3
+members logrotate-*-${D1}.tar | grep -q "^test.date.log/test.date.log-${D1}120000$" || exit 3
+[ "$(members logrotate-*.tar | grep -c '^test.log/')" = 3 ] || exit 3
+[ "$(ls test.date.log-* | wc -l)" = 2 ] || exit 3
+
+exit 0
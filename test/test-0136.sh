@@ -0,0 +1,67 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+cleanup 136
+
+# ------------------------------- Test 136 -----------------------------------
+# catalog applies rotate to the rotated logs it knows about without searching
+# the directory, until the catalog is older than its days
+preptest test.num.log 136 0
+preptest test.log 136 0
+rm -f state.catalog
+
+for d in 1 2 3; do
+  echo "old $d" > test.log-2026010${d}120000
+done
+
+OUTPUT=$($RLR test-config.136 --force 2>&1) || exit 23
+echo "$OUTPUT" | grep -q "cataloged 3 rotated logs" || exit 3
+[ -f test.log-20260101120000 ] && exit 3
+grep -q "^  \".*/test.log-20260102120000\" 0 " state.catalog || exit 3
+[ "$(grep -c '^  ".*/test.log-' state.catalog)" = 3 ] || exit 3
+grep -q "^  \".*/test.num.log.1\" 1 " state.catalog || exit 3
+
+# logs added or removed by others are not noticed while the catalog is used
+echo "added" > test.log-20260104120000
+rm -f test.log-20260102120000
+echo new > test.log
+sleep 1
+OUTPUT=$($RLR test-config.136 --force 2>&1) || exit 23
+echo "$OUTPUT" | grep -q "using the catalog of 3 rotated logs" || exit 3
+[ -f test.log-20260103120000 ] || exit 3
+[ -f test.log-20260104120000 ] || exit 3
+[ "$(ls test.log-* | wc -l)" = 4 ] || exit 3
+
+# but numbered logs missing from the catalog are still renamed, not overwritten
+echo stray > test.num.log.2
+echo new > test.num.log
+OUTPUT=$($RLR test-config.136 --force 2>&1) || exit 23
+echo "$OUTPUT" | grep -q "using the catalog of 1 rotated logs" || exit 3
+
+checkoutput <<EOF
+test.num.log.1 0 new
+test.num.log.2 0 zero
+test.num.log.3 0 stray
+EOF
+
+# a stale catalog is built anew from the directory
+sed -i 's/^\(".*\/test.log"\) [0-9]* /\1 1 /' state.catalog
+echo newer > test.log
+sleep 1
+OUTPUT=$($RLR test-config.136 --force 2>&1) || exit 23
+echo "$OUTPUT" | grep -q "cataloged 4 rotated logs" || exit 3
+[ -f test.log-20260103120000 ] && exit 3
+[ -f test.log-20260104120000 ] && exit 3
+[ "$(ls test.log-* | wc -l)" = 3 ] || exit 3
+
+# without catalog it goes away
+sed -i '/catalog/d' test-config.136
+config_crc=$(${MD5SUM} test-config.136)
+echo newest > test.log
+echo newest > test.num.log
+sleep 1
+$RLR test-config.136 --force || exit 23
+[ -f state.catalog ] && exit 3
+
+exit 0
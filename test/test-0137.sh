@@ -0,0 +1,31 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+if [ ! -e /usr/share/zoneinfo/America/New_York ]; then
+  echo "Skipping test 137: no time zone America/New_York"
+  exit 77
+fi
+
+cleanup 137
+
+# ------------------------------- Test 137 -----------------------------------
+# dated logs are sorted by their time, also across the end of daylight saving
+# time, where the later one may show the earlier local time
+TZ=America/New_York
+export TZ
+preptest test.log 137 0
+
+# 01:30 EDT and then 01:00 EST on 2 November 2025
+echo older > test.log-1762061400
+echo newer > test.log-1762063200
+
+$RLR test-config.137 --force || exit 23
+
+[ -f test.log-1762061400 ] && exit 3
+
+checkoutput <<EOF
+test.log-1762063200 0 newer
+EOF
+
+exit 0
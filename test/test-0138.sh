@@ -0,0 +1,31 @@
+#!/bin/sh
+
+. ./test-common.sh
+
+if [ "$(id -u)" != 0 ] || ! getent passwd 65534 >/dev/null \
+        || ! getent group 65534 >/dev/null; then
+  echo "Skipping test 138: needs root and user and group 65534"
+  exit 77
+fi
+
+cleanup 138
+
+# ------------------------------- Test 138 -----------------------------------
+# the resource profile of an su stanza is applied with the privileges to set
+# it, here a negative nice value, before the children run as the su user
+preptest test.log 138 0
+chmod 0777 .
+chown 65534:65534 test.log
+
+$RLR test-config.138 --force || exit 23
+
+if [ "$(cat scriptout)" != -5 ]; then
+    echo "postrotate script did not run with nice -5"
+    exit 3
+fi
+
+checkoutput <<EOF
+test.log.1.gz 1 zero
+EOF
+
+exit 0
@@ -0,0 +1,245 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "logrotate.h"
+#include "timeindex.h"
+
+/* longest leading part of a line handed to strptime() */
+#define TIME_INDEX_LINE 256
+
+/* lines in a row without a timestamp after which an interval is given up */
+#define TIME_INDEX_MAX_MISSES 64
+
+/*
+ * With index, the uncompressed data of a log is passed through
+ * timeIndexFeed() while it is compressed.  Once every interval bytes, the
+ * timestamp at the start of the next line is parsed with strptime() and
+ * noted with the offset of that line, so the index costs no extra read of
+ * the log.  Between two entries only the newline ending the interval is
+ * searched for with memchr(), which glibc implements with vector
+ * instructions; everything else is skipped without looking at it.
+ *
+ * The index is written as a text file with the header "LRTIME1 <format>",
+ * followed by one line "<seconds since the epoch> <offset>" per entry.  The
+ * offsets are into the uncompressed log, as taken by --cat --offset.
+ */
+
+struct timeIndexEntry {
+    time_t when;
+    off_t offset;
+};
+
+struct timeIndex {
+    char *format;
+    off_t interval;
+    time_t now;
+    off_t pos;                  /* uncompressed bytes fed so far */
+    off_t next;                 /* lines starting from here are indexed */
+    off_t lineStart;            /* offset of the line in line */
+    int collecting;             /* line is being filled, else skip to a newline */
+    size_t lineLen;
+    unsigned misses;
+    int failed;                 /* out of memory, nothing is written */
+    struct timeIndexEntry *entries;
+    size_t count;
+    size_t alloc;
+    char line[TIME_INDEX_LINE];
+};
+
+struct timeIndex *timeIndexNew(const char *format, off_t interval, time_t now)
+{
+    struct timeIndex *index = calloc(1, sizeof(*index));
+
+    if (index == NULL) {
+        message_OOM();
+        return NULL;
+    }
+    index->format = strdup(format);
+    if (index->format == NULL) {
+        message_OOM();
+        free(index);
+        return NULL;
+    }
+    index->interval = interval > 0 ? interval : 1;
+    index->now = now;
+    /* the first line is always indexed */
+    index->collecting = 1;
+    return index;
+}
+
+/* Parse the timestamp at the start of line.  Fields missing from the format
+ * are taken from the current time; a date without a year lying more than a
+ * day in the future is taken to be from the year before, as syslog writes
+ * timestamps without a year. */
+static int parseTime(const struct timeIndex *index, const char *line, time_t *when)
+{
+    struct tm now;
+    struct tm tm;
+
+    localtime_r(&index->now, &now);
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = tm.tm_mon = tm.tm_mday = -1;
+
+    if (strptime(line, index->format, &tm) == NULL)
+        return 1;
+
+    if (tm.tm_mon == -1)
+        tm.tm_mon = now.tm_mon;
+    if (tm.tm_mday == -1)
+        tm.tm_mday = now.tm_mday;
+    tm.tm_isdst = -1;
+    if (tm.tm_year == -1) {
+        tm.tm_year = now.tm_year;
+        *when = mktime(&tm);
+        if (*when != (time_t) -1 && *when > index->now + 24 * 60 * 60) {
+            tm.tm_year = now.tm_year - 1;
+            tm.tm_isdst = -1;
+            *when = mktime(&tm);
+        }
+    } else {
+        *when = mktime(&tm);
+    }
+
+    return *when == (time_t) -1;
+}
+
+static void addEntry(struct timeIndex *index, time_t when)
+{
+    if (index->count == index->alloc) {
+        const size_t alloc = index->alloc ? index->alloc * 2 : 64;
+        struct timeIndexEntry *entries = realloc(index->entries,
+                                                 alloc * sizeof(*entries));
+        if (entries == NULL) {
+            message_OOM();
+            index->failed = 1;
+            return;
+        }
+        index->entries = entries;
+        index->alloc = alloc;
+    }
+    index->entries[index->count].when = when;
+    index->entries[index->count].offset = index->lineStart;
+    index->count++;
+}
+
+/* the line collected is complete or as long as it is parsed */
+static void endLine(struct timeIndex *index)
+{
+    time_t when;
+
+    index->line[index->lineLen] = '\0';
+    if (parseTime(index, index->line, &when) == 0) {
+        addEntry(index, when);
+        index->next = index->lineStart + index->interval;
+        index->misses = 0;
+    } else if (++index->misses >= TIME_INDEX_MAX_MISSES) {
+        index->next = index->lineStart + index->interval;
+        index->misses = 0;
+    }
+    index->collecting = 0;
+    index->lineLen = 0;
+}
+
+/* compressParams tap: account for the next len bytes of the log */
+void timeIndexFeed(void *arg, const void *buf, size_t len)
+{
+    struct timeIndex *index = arg;
+    const char *ptr = buf;
+    const char *end = ptr + len;
+
+    if (index->failed)
+        return;
+
+    while (ptr < end) {
+        if (index->collecting) {
+            const size_t room = sizeof(index->line) - 1 - index->lineLen;
+            const size_t avail = (size_t) (end - ptr) < room
+                ? (size_t) (end - ptr) : room;
+            const char *nl = memchr(ptr, '\n', avail);
+            const size_t n = nl ? (size_t) (nl - ptr) : avail;
+
+            memcpy(index->line + index->lineLen, ptr, n);
+            index->lineLen += n;
+            ptr += n;
+            if (nl) {
+                endLine(index);
+                /* the following line may need a try as well */
+                ptr++;
+                index->lineStart = index->pos + (ptr - (const char *) buf);
+                index->collecting = index->lineStart >= index->next;
+            } else if (index->lineLen == sizeof(index->line) - 1) {
+                endLine(index);
+            }
+        } else {
+            /* the first line starting at or after next follows a newline
+             * at next - 1 or later, so nothing before is looked at */
+            const off_t skip = index->next - 1 - index->pos - (ptr - (const char *) buf);
+            const char *nl;
+
+            if (skip > 0) {
+                if (skip >= end - ptr)
+                    break;
+                ptr += skip;
+            }
+            nl = memchr(ptr, '\n', (size_t) (end - ptr));
+            if (nl == NULL)
+                break;
+            ptr = nl + 1;
+            index->lineStart = index->pos + (ptr - (const char *) buf);
+            index->collecting = 1;
+        }
+    }
+
+    index->pos += (off_t) len;
+}
+
+/* write the index to fd and close it, returns 0 on success */
+int timeIndexWrite(const struct timeIndex *index, int fd, const char *name)
+{
+    FILE *f;
+    size_t i;
+    int failed;
+
+    if (index->failed) {
+        close(fd);
+        return 1;
+    }
+
+    f = fdopen(fd, "w");
+    if (f == NULL) {
+        message(MESS_ERROR, "error writing %s: %s\n", name, strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    fprintf(f, "LRTIME1 %s\n", index->format);
+    for (i = 0; i < index->count; i++)
+        fprintf(f, "%jd %jd\n", (intmax_t) index->entries[i].when,
+                (intmax_t) index->entries[i].offset);
+
+    failed = fflush(f) != 0 || ferror(f) || fsync(fd) != 0;
+    if (failed)
+        message(MESS_ERROR, "error writing %s: %s\n", name, strerror(errno));
+    if (fclose(f) != 0 && !failed) {
+        message(MESS_ERROR, "error writing %s: %s\n", name, strerror(errno));
+        failed = 1;
+    }
+    return failed;
+}
+
+void timeIndexFree(struct timeIndex *index)
+{
+    if (index == NULL)
+        return;
+    free(index->entries);
+    free(index->format);
+    free(index);
+}
+
+/* vim: set et sw=4 ts=4: */
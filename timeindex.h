@@ -0,0 +1,19 @@
+#ifndef H_TIMEINDEX
+#define H_TIMEINDEX
+
+#include <sys/types.h>
+#include <time.h>
+
+/* suffix of the time index written next to a compressed log */
+#define TIME_INDEX_EXT ".idx"
+
+struct timeIndex;
+
+struct timeIndex *timeIndexNew(const char *format, off_t interval, time_t now);
+void timeIndexFeed(void *index, const void *buf, size_t len);
+int timeIndexWrite(const struct timeIndex *index, int fd, const char *name);
+void timeIndexFree(struct timeIndex *index);
+
+#endif
+
+/* vim: set et sw=4 ts=4: */
@@ -0,0 +1,213 @@
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "iolimit.h"
+#include "log.h"
+#include "logrotate.h"
+#include "trash.h"
+
+/* largest amount of space released at once, with trashrate 0 */
+#define TRASH_STEP ((size_t) 256 * 1024 * 1024)
+
+/*
+ * Deleting a large file frees all its extents in one go, which can stall the
+ * journal of the file system for a noticeable time.  Files removed with
+ * trashdir are renamed into a trash directory on the same file system
+ * instead, and trashEmpty() later shrinks them step by step with ftruncate()
+ * before unlinking them.  As everything left in a trash directory is picked
+ * up again, an interrupted run is resumed by the next one.
+ */
+
+/* trash directory for files in dir, trashDir may be relative to dir */
+char *trashPath(const char *dir, const char *trashDir)
+{
+    char *path;
+
+    if (trashDir[0] == '/')
+        path = strdup(trashDir);
+    else if (asprintf(&path, "%s/%s", dir, trashDir) < 0)
+        path = NULL;
+
+    if (path == NULL)
+        message_OOM();
+    return path;
+}
+
+/* Move path into trashDir as <inode>.<name>.  Returns 0 on success and -1
+ * if path has to be unlinked right away instead. */
+int trashFile(const char *path, const char *trashDir)
+{
+    char *pathCopy, *dir, *target;
+    const char *base;
+    struct stat sb, dirSb;
+    int rc = -1;
+
+    if (lstat(path, &sb) != 0)
+        return -1;
+
+    /* other links keep the data alive, there is nothing to release */
+    if (!S_ISREG(sb.st_mode) || sb.st_nlink > 1)
+        return -1;
+
+    pathCopy = strdup(path);
+    if (pathCopy == NULL) {
+        message_OOM();
+        return -1;
+    }
+    dir = trashPath(dirname(pathCopy), trashDir);
+    free(pathCopy);
+    if (dir == NULL)
+        return -1;
+
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        message(MESS_ERROR, "error creating trash directory %s: %s\n", dir,
+                strerror(errno));
+        free(dir);
+        return -1;
+    }
+    /* trashEmpty() would not release anything from elsewhere */
+    if (lstat(dir, &dirSb) != 0 || !S_ISDIR(dirSb.st_mode)) {
+        message(MESS_DEBUG, "trash %s is no directory, unlinking %s\n", dir,
+                path);
+        free(dir);
+        return -1;
+    }
+
+    base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    if (asprintf(&target, "%s/%ju.%s", dir, (uintmax_t) sb.st_ino, base) < 0) {
+        message_OOM();
+        free(dir);
+        return -1;
+    }
+
+    if (access(target, F_OK) == 0) {
+        errno = EEXIST;
+    } else if (rename(path, target) == 0) {
+        message(MESS_DEBUG, "moved %s to trash %s\n", path, target);
+        rc = 0;
+    }
+
+    if (rc != 0)
+        message(MESS_DEBUG, "cannot move %s to trash %s: %s, unlinking it\n",
+                path, dir, strerror(errno));
+    free(target);
+    free(dir);
+    return rc;
+}
+
+/* shrink the file name in dirFd step by step, then unlink it */
+static int releaseFile(int dirFd, const char *trashDir, const char *name, off_t rate)
+{
+    struct ioLimit lim;
+    struct stat sb;
+    off_t size;
+    int fd;
+
+    fd = openat(dirFd, name, O_WRONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &sb) != 0) {
+        message(MESS_ERROR, "error opening %s/%s: %s\n", trashDir, name,
+                strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return 1;
+    }
+
+    if (!S_ISREG(sb.st_mode)) {
+        close(fd);
+        return 0;
+    }
+
+    ioLimitInit(&lim, rate, -1, fd);
+    size = sb.st_nlink > 1 ? 0 : sb.st_size;
+    while (size > 0) {
+        const size_t step = ioLimitChunk(&lim, TRASH_STEP);
+        const off_t newSize = size > (off_t) step ? size - (off_t) step : 0;
+
+        if (ftruncate(fd, newSize) != 0) {
+            message(MESS_ERROR, "error truncating %s/%s: %s\n", trashDir, name,
+                    strerror(errno));
+            close(fd);
+            return 1;
+        }
+        ioLimitTransfer(&lim, 0, (size_t) (size - newSize));
+        size = newSize;
+    }
+    close(fd);
+
+    if (unlinkat(dirFd, name, 0) != 0 && errno != ENOENT) {
+        message(MESS_ERROR, "error unlinking %s/%s: %s\n", trashDir, name,
+                strerror(errno));
+        return 1;
+    }
+
+    message(MESS_DEBUG, "released %jd bytes of %s/%s\n", (intmax_t) sb.st_size,
+            trashDir, name);
+    return 0;
+}
+
+/* Release all files in trashDir within rate bytes per second (0 for no
+ * limit).  The directory has to be a real one, owned by root or by the user
+ * running this, so that nothing else is released through a symlink. */
+int trashEmpty(const char *trashDir, off_t rate)
+{
+    DIR *dir;
+    struct dirent *ent;
+    struct stat sb;
+    int rc = 0;
+    int fd;
+
+    fd = open(trashDir, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT)
+            return 0;
+        message(MESS_ERROR, "error opening trash directory %s: %s\n", trashDir,
+                strerror(errno));
+        return 1;
+    }
+
+    if (fstat(fd, &sb) != 0) {
+        message(MESS_ERROR, "error opening trash directory %s: %s\n", trashDir,
+                strerror(errno));
+        close(fd);
+        return 1;
+    }
+    if (sb.st_uid != 0 && sb.st_uid != geteuid()) {
+        message(MESS_ERROR, "trash directory %s is owned by uid %u, not "
+                "emptying it\n", trashDir, (unsigned) sb.st_uid);
+        close(fd);
+        return 1;
+    }
+
+    dir = fdopendir(fd);
+    if (dir == NULL) {
+        message(MESS_ERROR, "error opening trash directory %s: %s\n", trashDir,
+                strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    while ((ent = readdir(dir)) != NULL) {
+        const char *p = ent->d_name;
+
+        /* only touch what trashFile() put there */
+        while (isdigit((unsigned char) *p))
+            p++;
+        if (p == ent->d_name || *p != '.')
+            continue;
+        rc |= releaseFile(dirfd(dir), trashDir, ent->d_name, rate);
+    }
+
+    closedir(dir);
+    return rc;
+}
+
+/* vim: set et sw=4 ts=4: */
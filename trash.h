@@ -0,0 +1,16 @@
+#ifndef H_TRASH
+#define H_TRASH
+
+#include <sys/types.h>
+
+/* bytes per second released from a trash directory if neither trashrate
+ * nor iolimit is set for its log */
+#define TRASH_DEFAULT_RATE ((off_t) 128 * 1024 * 1024)
+
+char *trashPath(const char *dir, const char *trashDir);
+int trashFile(const char *path, const char *trashDir);
+int trashEmpty(const char *trashDir, off_t rate);
+
+#endif
+
+/* vim: set et sw=4 ts=4: */
@@ -0,0 +1,471 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#include "uring.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup) \
+    && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define URING_SUPPORTED 1
+#endif
+
+#ifdef URING_SUPPORTED
+
+/* number of requests kept in flight and size of the buffer of each */
+#define URING_DEPTH 8
+#define URING_BUFSIZE (128 * 1024)
+
+/* user_data of a request: buffer slot and whether it is a write */
+#define URING_DATA(slot, isWrite) (((__u64) (slot) << 1) | (__u64) (isWrite))
+
+struct uring {
+    int fd;
+    unsigned char *sqRing;
+    size_t sqRingSize;
+    unsigned char *cqRing;
+    size_t cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+    unsigned toSubmit;
+    /* URING_DEPTH buffers registered with the kernel */
+    unsigned char *bufs;
+};
+
+/* state of a buffer slot in uringCopy() and uringReadAll() */
+struct uringSlot {
+    off_t off;      /* source offset of the data in the buffer */
+    size_t len;     /* bytes requested by the read, then bytes read */
+    size_t done;    /* bytes written so far */
+    int res;        /* result of the read for uringReadAll() */
+    int ready;
+};
+
+static struct uring *ring;
+
+static void uringDestroy(struct uring *r)
+{
+    if (r->sqes != MAP_FAILED)
+        munmap(r->sqes, r->sqesSize);
+    if (r->cqRing != MAP_FAILED && r->cqRing != r->sqRing)
+        munmap(r->cqRing, r->cqRingSize);
+    if (r->sqRing != MAP_FAILED)
+        munmap(r->sqRing, r->sqRingSize);
+    if (r->fd >= 0)
+        close(r->fd);
+    free(r->bufs);
+    free(r);
+}
+
+static void *uringMap(int fd, size_t size, off_t offset)
+{
+    return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                fd, offset);
+}
+
+/* set up the ring and register the buffers, -1 with errno set on failure */
+int uringInit(void)
+{
+    struct io_uring_params p;
+    struct iovec iov[URING_DEPTH];
+    struct uring *r;
+    int saved_errno;
+    unsigned i;
+
+    if (ring)
+        return 0;
+
+    r = calloc(1, sizeof(*r));
+    if (r == NULL)
+        return -1;
+    r->fd = -1;
+    r->sqRing = r->cqRing = MAP_FAILED;
+    r->sqes = MAP_FAILED;
+
+    memset(&p, 0, sizeof(p));
+    r->fd = (int) syscall(__NR_io_uring_setup, URING_DEPTH, &p);
+    if (r->fd < 0)
+        goto fail;
+
+    r->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if ((p.features & IORING_FEAT_SINGLE_MMAP) && r->cqRingSize > r->sqRingSize)
+        r->sqRingSize = r->cqRingSize;
+
+    r->sqRing = uringMap(r->fd, r->sqRingSize, IORING_OFF_SQ_RING);
+    if (r->sqRing == MAP_FAILED)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->cqRing = r->sqRing;
+    else if ((r->cqRing = uringMap(r->fd, r->cqRingSize, IORING_OFF_CQ_RING)) == MAP_FAILED)
+        goto fail;
+
+    r->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = uringMap(r->fd, r->sqesSize, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        goto fail;
+
+    r->sqTail = (unsigned *) (r->sqRing + p.sq_off.tail);
+    r->sqMask = *(unsigned *) (r->sqRing + p.sq_off.ring_mask);
+    r->sqArray = (unsigned *) (r->sqRing + p.sq_off.array);
+    r->cqHead = (unsigned *) (r->cqRing + p.cq_off.head);
+    r->cqTail = (unsigned *) (r->cqRing + p.cq_off.tail);
+    r->cqMask = *(unsigned *) (r->cqRing + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *) (r->cqRing + p.cq_off.cqes);
+
+    if (posix_memalign((void **) &r->bufs, 4096, URING_DEPTH * URING_BUFSIZE) != 0) {
+        r->bufs = NULL;
+        errno = ENOMEM;
+        goto fail;
+    }
+
+    for (i = 0; i < URING_DEPTH; i++) {
+        iov[i].iov_base = r->bufs + i * URING_BUFSIZE;
+        iov[i].iov_len = URING_BUFSIZE;
+    }
+    if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS, iov,
+                URING_DEPTH) < 0)
+        goto fail;
+
+    ring = r;
+    return 0;
+
+fail:
+    saved_errno = errno;
+    uringDestroy(r);
+    errno = saved_errno;
+    return -1;
+}
+
+void uringFree(void)
+{
+    if (ring) {
+        /* closing the ring cancels whatever might still be in flight */
+        uringDestroy(ring);
+        ring = NULL;
+    }
+}
+
+int uringEnabled(void)
+{
+    return ring != NULL;
+}
+
+int uringSupported(void)
+{
+    return 1;
+}
+
+/* queue a read into or a write from buffer slot, starting at bufOff */
+static void uringQueue(struct uring *r, int isWrite, int fd, unsigned slot,
+                       size_t bufOff, size_t len, off_t off)
+{
+    const unsigned tail = *r->sqTail;
+    const unsigned idx = tail & r->sqMask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (__u8) (isWrite ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED);
+    sqe->fd = fd;
+    sqe->addr = (__u64) (uintptr_t) (r->bufs + slot * URING_BUFSIZE + bufOff);
+    sqe->len = (__u32) len;
+    sqe->off = (__u64) off;
+    sqe->buf_index = (__u16) slot;
+    sqe->user_data = URING_DATA(slot, isWrite);
+
+    r->sqArray[idx] = idx;
+    __atomic_store_n(r->sqTail, tail + 1, __ATOMIC_RELEASE);
+    r->toSubmit++;
+}
+
+/* submit what is queued and wait for the next completion */
+static int uringWait(struct uring *r, unsigned *slot, int *isWrite, int *res)
+{
+    for (;;) {
+        const unsigned head = *r->cqHead;
+        int rc;
+
+        if (r->toSubmit == 0
+            && head != __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE)) {
+            const struct io_uring_cqe *cqe = &r->cqes[head & r->cqMask];
+
+            *slot = (unsigned) (cqe->user_data >> 1);
+            *isWrite = (int) (cqe->user_data & 1);
+            *res = cqe->res;
+            __atomic_store_n(r->cqHead, head + 1, __ATOMIC_RELEASE);
+            return 0;
+        }
+
+        rc = (int) syscall(__NR_io_uring_enter, r->fd, r->toSubmit, 1,
+                           IORING_ENTER_GETEVENTS, NULL, 0);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        r->toSubmit -= (unsigned) rc;
+    }
+}
+
+/*
+ * Copy from srcFd at start to destFd at start + delta until a read comes
+ * back short or limit (if not negative) is reached.  Reads are issued ahead
+ * for all slots and every completed read is written out right away, so up to
+ * URING_DEPTH requests are in flight.  *end is set to the source offset the
+ * copy ends at; anything written beyond it by reads that raced with a
+ * growing file is cut off again.
+ */
+static int uringCopyRound(struct uring *r, int srcFd, int destFd, off_t start,
+                          off_t limit, off_t delta, off_t *end)
+{
+    struct uringSlot slots[URING_DEPTH];
+    off_t next = start;
+    off_t stop = limit;
+    off_t written = start;
+    unsigned active = 0;
+    unsigned i;
+    int err = 0;
+
+    for (i = 0; i < URING_DEPTH && (stop < 0 || next < stop); i++) {
+        slots[i].off = next;
+        slots[i].len = URING_BUFSIZE;
+        if (stop >= 0 && stop - next < URING_BUFSIZE)
+            slots[i].len = (size_t) (stop - next);
+        uringQueue(r, 0, srcFd, i, 0, slots[i].len, next);
+        next += (off_t) slots[i].len;
+        active++;
+    }
+
+    while (active) {
+        struct uringSlot *s;
+        int isWrite, res;
+
+        if (uringWait(r, &i, &isWrite, &res) < 0) {
+            uringFree();
+            return -1;
+        }
+        active--;
+        s = &slots[i];
+
+        if (res < 0) {
+            if (!err)
+                err = -res;
+            continue;
+        }
+
+        if (!isWrite) {
+            if ((size_t) res < s->len) {
+                /* end of file, do not read behind it anymore */
+                const off_t eof = s->off + res;
+                if (stop < 0 || eof < stop)
+                    stop = eof;
+            }
+            if (res == 0 || err)
+                continue;
+            s->len = (size_t) res;
+            s->done = 0;
+            uringQueue(r, 1, destFd, i, 0, s->len, s->off + delta);
+            active++;
+            continue;
+        }
+
+        if (res == 0 && !err)
+            err = ENOSPC;
+        s->done += (size_t) res;
+        if (err)
+            continue;
+        if (s->done < s->len) {
+            uringQueue(r, 1, destFd, i, s->done, s->len - s->done,
+                       s->off + (off_t) s->done + delta);
+            active++;
+            continue;
+        }
+
+        if (s->off + (off_t) s->len > written)
+            written = s->off + (off_t) s->len;
+
+        if (stop < 0 || next < stop) {
+            s->off = next;
+            s->len = URING_BUFSIZE;
+            if (stop >= 0 && stop - next < URING_BUFSIZE)
+                s->len = (size_t) (stop - next);
+            uringQueue(r, 0, srcFd, i, 0, s->len, next);
+            next += (off_t) s->len;
+            active++;
+        }
+    }
+
+    if (err) {
+        errno = err;
+        return -1;
+    }
+
+    *end = stop >= 0 ? stop : next;
+    if (written > *end && ftruncate(destFd, *end + delta) < 0)
+        return -1;
+    return 0;
+}
+
+/* copy len bytes (or up to the end of file if len is negative) from the
+ * current offset of srcFd to the current offset of destFd */
+int uringCopy(int srcFd, int destFd, off_t len)
+{
+    off_t start, delta, end;
+
+    if (ring == NULL) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    if ((start = lseek(srcFd, 0, SEEK_CUR)) < 0
+        || (delta = lseek(destFd, 0, SEEK_CUR)) < 0)
+        return -1;
+    delta -= start;
+
+    for (;;) {
+        if (uringCopyRound(ring, srcFd, destFd, start, len < 0 ? -1 : start + len,
+                           delta, &end) < 0)
+            return -1;
+        /* like a read(2) loop, pick up what has been appended meanwhile */
+        if (len >= 0 || end == start)
+            break;
+        start = end;
+    }
+
+    if (lseek(srcFd, end, SEEK_SET) < 0 || lseek(destFd, end + delta, SEEK_SET) < 0)
+        return -1;
+    return 0;
+}
+
+/* Pass everything readable from fd to consume() in file order, with reads
+ * for the following chunks already in flight.  Returns 0 at end of file, -1
+ * with errno set on a read error or the non-zero value of consume(). */
+int uringReadAll(int fd, uringConsumer consume, void *arg)
+{
+    struct uringSlot slots[URING_DEPTH];
+    off_t next;
+    unsigned active = 0;
+    unsigned cur = 0;
+    unsigned i;
+    int finished = 0;
+    int rc = 0;
+
+    if (ring == NULL) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    if ((next = lseek(fd, 0, SEEK_CUR)) < 0)
+        return -1;
+
+    for (i = 0; i < URING_DEPTH; i++) {
+        slots[i].off = next;
+        slots[i].len = URING_BUFSIZE;
+        slots[i].ready = 0;
+        uringQueue(ring, 0, fd, i, 0, URING_BUFSIZE, next);
+        next += URING_BUFSIZE;
+        active++;
+    }
+
+    while (active) {
+        int isWrite, res;
+
+        if (uringWait(ring, &i, &isWrite, &res) < 0) {
+            uringFree();
+            return -1;
+        }
+        active--;
+        slots[i].res = res;
+        slots[i].ready = 1;
+
+        /* hand out completed chunks in order, refilling their slots */
+        while (!finished && slots[cur].ready) {
+            struct uringSlot *s = &slots[cur];
+
+            s->ready = 0;
+            if (s->res < 0) {
+                errno = -s->res;
+                rc = -1;
+                finished = 1;
+                break;
+            }
+            if (s->res > 0
+                && (rc = consume(arg, ring->bufs + cur * URING_BUFSIZE, (size_t) s->res)) != 0) {
+                finished = 1;
+                break;
+            }
+            if ((size_t) s->res < s->len) {
+                finished = 1;
+                lseek(fd, s->off + s->res, SEEK_SET);
+                break;
+            }
+
+            s->off = next;
+            uringQueue(ring, 0, fd, cur, 0, URING_BUFSIZE, next);
+            next += URING_BUFSIZE;
+            active++;
+            cur = (cur + 1) % URING_DEPTH;
+        }
+    }
+
+    return rc;
+}
+
+#else /* URING_SUPPORTED */
+
+int uringInit(void)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+void uringFree(void)
+{
+}
+
+int uringEnabled(void)
+{
+    return 0;
+}
+
+int uringSupported(void)
+{
+    return 0;
+}
+
+int uringCopy(int srcFd, int destFd, off_t len)
+{
+    (void) srcFd;
+    (void) destFd;
+    (void) len;
+    errno = ENOSYS;
+    return -1;
+}
+
+int uringReadAll(int fd, uringConsumer consume, void *arg)
+{
+    (void) fd;
+    (void) consume;
+    (void) arg;
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif /* URING_SUPPORTED */
+
+/* vim: set et sw=4 ts=4: */
@@ -0,0 +1,20 @@
+#ifndef H_URING
+#define H_URING
+
+#include <sys/types.h>
+
+/* called by uringReadAll() for every chunk read, in file order; a non-zero
+ * return value stops reading */
+typedef int (*uringConsumer)(void *arg, const void *buf, size_t len);
+
+int uringSupported(void);
+int uringInit(void);
+int uringEnabled(void);
+void uringFree(void);
+
+int uringCopy(int srcFd, int destFd, off_t len);
+int uringReadAll(int fd, uringConsumer consume, void *arg);
+
+#endif
+
+/* vim: set et sw=4 ts=4: */
@@ -0,0 +1,465 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+#include "log.h"
+#include "logrotate.h"
+#include "zstddict.h"
+
+/*
+ * Small logs compress badly on their own, as every file starts without any
+ * history to refer back to.  With compressdict, the start of the logs of a
+ * stanza compressed with internal:zstd is collected as samples, and once
+ * there are enough of them a zstd dictionary is trained from them, which
+ * the following logs of the stanza are compressed with.
+ *
+ * Samples and dictionaries are kept in a directory next to the state file,
+ * "<state file>.dicts", named after a hash of the file patterns of the
+ * stanza: "<hash>.samples" holds the samples, each preceded by its length
+ * as a host-order uint32_t, and "<hash>.dict" the dictionary.  A dictionary
+ * is trained once and used from then on; removing it starts the collection
+ * of samples over, but makes the logs compressed with it unreadable.
+ *
+ * Every log compressed with a dictionary gets a manifest next to it, a text
+ * file "LRDICT1 <dictionary id> <path of the dictionary>", which the
+ * built-in decompression reads when a frame needs a dictionary.  The path
+ * can be passed to "zstd -D" as well.
+ */
+
+/* largest dictionary trained; logs worth a dictionary are small */
+#define ZSTD_DICT_MAX_SIZE (32 * 1024)
+/* leading part of a log taken as a sample */
+#define ZSTD_DICT_SAMPLE_SIZE (64 * 1024)
+/* samples and bytes of them collected before a dictionary is trained */
+#define ZSTD_DICT_MIN_SAMPLES 32
+#define ZSTD_DICT_MIN_BYTES (8 * ZSTD_DICT_MAX_SIZE)
+
+#define ZSTD_DICT_MAGIC "LRDICT1"
+
+/* "<state file>.dicts", NULL if not set */
+static char *dictDir;
+
+void zstdDictSetDir(const char *stateFilename)
+{
+    free(dictDir);
+    if (asprintf(&dictDir, "%s.dicts", stateFilename) < 0) {
+        message_OOM();
+        dictDir = NULL;
+    }
+}
+
+void zstdDictFree(struct zstdDict *dict)
+{
+    if (dict == NULL)
+        return;
+    free(dict->path);
+    free(dict->data);
+    free(dict);
+}
+
+#ifdef HAVE_LIBZSTD
+
+/* path of the file of stanza with extension ext in the dictionary directory */
+static char *stanzaPath(const char *stanza, const char *ext)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const unsigned char *p;
+    char *path;
+
+    /* FNV-1a */
+    for (p = (const unsigned char *) stanza; *p; p++) {
+        hash ^= *p;
+        hash *= 0x100000001b3ULL;
+    }
+
+    if (asprintf(&path, "%s/%016" PRIx64 "%s", dictDir, hash, ext) < 0) {
+        message_OOM();
+        return NULL;
+    }
+    return path;
+}
+
+/* read all of fd, at most max bytes, into a malloc()ed buffer */
+static int readAll(int fd, const char *name, size_t max, unsigned char **data,
+                   size_t *size)
+{
+    struct stat sb;
+    size_t len = 0;
+
+    if (fstat(fd, &sb) != 0) {
+        message(MESS_ERROR, "fstat of %s failed: %s\n", name, strerror(errno));
+        return 1;
+    }
+    if ((uintmax_t) sb.st_size > max) {
+        message(MESS_ERROR, "%s is larger than %zu bytes\n", name, max);
+        return 1;
+    }
+
+    *data = malloc((size_t) sb.st_size + 1);
+    if (*data == NULL) {
+        message_OOM();
+        return 1;
+    }
+    while (len < (size_t) sb.st_size) {
+        const ssize_t n = pread(fd, *data + len, (size_t) sb.st_size - len,
+                                (off_t) len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            message(MESS_ERROR, "error reading %s: %s\n", name,
+                    n < 0 ? strerror(errno) : "unexpected end of file");
+            free(*data);
+            return 1;
+        }
+        len += (size_t) n;
+    }
+    (*data)[len] = '\0';
+    *size = len;
+    return 0;
+}
+
+static struct zstdDict *loadDict(const char *path)
+{
+    struct zstdDict *dict;
+    unsigned char *data;
+    size_t size;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        message(MESS_ERROR, "cannot open dictionary %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (readAll(fd, path, 16 * ZSTD_DICT_MAX_SIZE, &data, &size) != 0) {
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+
+    dict = calloc(1, sizeof(*dict));
+    if (dict == NULL) {
+        message_OOM();
+        free(data);
+        return NULL;
+    }
+    dict->data = data;
+    dict->size = size;
+    dict->id = ZDICT_getDictID(data, size);
+    if (dict->id == 0) {
+        message(MESS_ERROR, "%s is not a zstd dictionary\n", path);
+        zstdDictFree(dict);
+        return NULL;
+    }
+    dict->path = realpath(path, NULL);
+    if (dict->path == NULL) {
+        message(MESS_ERROR, "cannot resolve %s: %s\n", path, strerror(errno));
+        zstdDictFree(dict);
+        return NULL;
+    }
+    return dict;
+}
+
+/* the dictionary trained for stanza, or NULL if there is none yet */
+struct zstdDict *zstdDictForStanza(const char *stanza)
+{
+    struct zstdDict *dict;
+    char *path;
+
+    if (dictDir == NULL || (path = stanzaPath(stanza, ".dict")) == NULL)
+        return NULL;
+    if (access(path, F_OK) != 0) {
+        free(path);
+        return NULL;
+    }
+    dict = loadDict(path);
+    free(path);
+    return dict;
+}
+
+/* Train the dictionary at path from the samples in data, read from
+ * samplesPath.  Returns -1 if there are not enough samples yet, 0 once the
+ * dictionary is written and 1 if the samples are of no use. */
+static int train(const char *stanza, const char *path, const char *samplesPath,
+                 const unsigned char *data, size_t size)
+{
+    unsigned char *samples = NULL;
+    size_t *sizes = NULL;
+    unsigned char *dictBuf = NULL;
+    unsigned count = 0;
+    size_t total = 0;
+    size_t pos;
+    size_t dictSize;
+    char *tmpPath = NULL;
+    int fd = -1;
+    int rc = 1;
+
+    /* count the samples first, then copy them next to each other */
+    for (pos = 0; pos + sizeof(uint32_t) <= size; count++) {
+        uint32_t len;
+
+        memcpy(&len, data + pos, sizeof(len));
+        if (len > size - pos - sizeof(len)) {
+            message(MESS_ERROR, "%s is truncated\n", samplesPath);
+            return 1;
+        }
+        pos += sizeof(len) + len;
+        total += len;
+    }
+    if (count < ZSTD_DICT_MIN_SAMPLES || total < ZSTD_DICT_MIN_BYTES)
+        return -1;
+
+    samples = malloc(total);
+    sizes = malloc(count * sizeof(*sizes));
+    dictBuf = malloc(ZSTD_DICT_MAX_SIZE);
+    if (samples == NULL || sizes == NULL || dictBuf == NULL) {
+        message_OOM();
+        goto out;
+    }
+    total = 0;
+    count = 0;
+    for (pos = 0; pos + sizeof(uint32_t) <= size; count++) {
+        uint32_t len;
+
+        memcpy(&len, data + pos, sizeof(len));
+        memcpy(samples + total, data + pos + sizeof(len), len);
+        sizes[count] = len;
+        pos += sizeof(len) + len;
+        total += len;
+    }
+
+    dictSize = ZDICT_trainFromBuffer(dictBuf, ZSTD_DICT_MAX_SIZE, samples, sizes,
+                                     count);
+    if (ZDICT_isError(dictSize)) {
+        message(MESS_DEBUG, "cannot train a dictionary for %s from %u samples: %s, "
+                "collecting samples over again\n", stanza, count,
+                ZDICT_getErrorName(dictSize));
+        goto out;
+    }
+
+    if (asprintf(&tmpPath, "%s.tmp", path) < 0) {
+        message_OOM();
+        tmpPath = NULL;
+        goto out;
+    }
+    fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0 || full_write(fd, dictBuf, dictSize) != dictSize || fsync(fd) != 0) {
+        message(MESS_ERROR, "error writing %s: %s\n", tmpPath, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        unlink(tmpPath);
+        goto out;
+    }
+    close(fd);
+    if (rename(tmpPath, path) != 0) {
+        message(MESS_ERROR, "error renaming %s to %s: %s\n", tmpPath, path,
+                strerror(errno));
+        unlink(tmpPath);
+        goto out;
+    }
+    message(MESS_DEBUG, "trained dictionary %s of %zu bytes for %s from %u samples "
+            "of %zu bytes\n", path, dictSize, stanza, count, total);
+    rc = 0;
+
+out:
+    free(tmpPath);
+    free(dictBuf);
+    free(sizes);
+    free(samples);
+    return rc;
+}
+
+/* Add the start of the log in fd to the samples of stanza, and train its
+ * dictionary once there are enough.  Failures are only reported, the log is
+ * compressed without a dictionary anyway. */
+void zstdDictAddSample(const char *stanza, int fd, const char *name)
+{
+    unsigned char *buf;
+    unsigned char *data = NULL;
+    char *samplesPath = NULL;
+    char *path = NULL;
+    uint32_t len = 0;
+    size_t size;
+    int samplesFd = -1;
+
+    if (dictDir == NULL)
+        return;
+    if (mkdir(dictDir, 0700) != 0 && errno != EEXIST) {
+        message(MESS_ERROR, "error creating %s: %s\n", dictDir, strerror(errno));
+        return;
+    }
+
+    buf = malloc(sizeof(len) + ZSTD_DICT_SAMPLE_SIZE);
+    if (buf == NULL) {
+        message_OOM();
+        return;
+    }
+    while (len < ZSTD_DICT_SAMPLE_SIZE) {
+        const ssize_t n = pread(fd, buf + sizeof(len) + len,
+                                ZSTD_DICT_SAMPLE_SIZE - len, (off_t) len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            message(MESS_ERROR, "error reading %s: %s\n", name, strerror(errno));
+            goto out;
+        }
+        if (n == 0)
+            break;
+        len += (uint32_t) n;
+    }
+    if (len == 0)
+        goto out;
+    memcpy(buf, &len, sizeof(len));
+
+    if ((samplesPath = stanzaPath(stanza, ".samples")) == NULL
+            || (path = stanzaPath(stanza, ".dict")) == NULL)
+        goto out;
+    samplesFd = open(samplesPath, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (samplesFd < 0) {
+        message(MESS_ERROR, "error opening %s: %s\n", samplesPath, strerror(errno));
+        goto out;
+    }
+    if (full_write(samplesFd, buf, sizeof(len) + len) != sizeof(len) + len) {
+        message(MESS_ERROR, "error writing %s: %s\n", samplesPath, strerror(errno));
+        goto out;
+    }
+    message(MESS_DEBUG, "added %u bytes of %s to the dictionary samples in %s\n",
+            (unsigned) len, name, samplesPath);
+
+    /* the samples are done with once they were tried */
+    if (readAll(samplesFd, samplesPath, SIZE_MAX - 1, &data, &size) == 0
+            && train(stanza, path, samplesPath, data, size) >= 0)
+        unlink(samplesPath);
+
+out:
+    if (samplesFd >= 0)
+        close(samplesFd);
+    free(data);
+    free(path);
+    free(samplesPath);
+    free(buf);
+}
+
+/* write the manifest of a log compressed with dict to fd and close it,
+ * returns 0 on success */
+int zstdDictWriteManifest(const struct zstdDict *dict, int fd, const char *name)
+{
+    FILE *f;
+    int failed;
+
+    f = fdopen(fd, "w");
+    if (f == NULL) {
+        message(MESS_ERROR, "error writing %s: %s\n", name, strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    fprintf(f, ZSTD_DICT_MAGIC " %u %s\n", dict->id, dict->path);
+
+    failed = fflush(f) != 0 || ferror(f) || fsync(fd) != 0;
+    if (failed)
+        message(MESS_ERROR, "error writing %s: %s\n", name, strerror(errno));
+    if (fclose(f) != 0 && !failed) {
+        message(MESS_ERROR, "error writing %s: %s\n", name, strerror(errno));
+        failed = 1;
+    }
+    return failed;
+}
+
+/* the dictionary with id the log name was compressed with, as named by its
+ * manifest; NULL after logging an error */
+struct zstdDict *zstdDictForArchive(const char *name, unsigned id)
+{
+    struct zstdDict *dict = NULL;
+    unsigned char *data = NULL;
+    char *manifest;
+    char *path, *end;
+    size_t size;
+    unsigned long recorded;
+    int fd;
+
+    if (asprintf(&manifest, "%s%s", name, ZSTD_DICT_EXT) < 0) {
+        message_OOM();
+        return NULL;
+    }
+    if ((fd = open(manifest, O_RDONLY | O_CLOEXEC)) < 0) {
+        message(MESS_ERROR, "%s needs zstd dictionary %u, but %s cannot be "
+                "opened: %s\n", name, id, manifest, strerror(errno));
+        free(manifest);
+        return NULL;
+    }
+    if (readAll(fd, manifest, PATH_MAX + 64, &data, &size) != 0)
+        goto out;
+
+    if (strncmp((char *) data, ZSTD_DICT_MAGIC " ", sizeof(ZSTD_DICT_MAGIC)) != 0)
+        goto bad;
+    recorded = strtoul((char *) data + sizeof(ZSTD_DICT_MAGIC), &path, 10);
+    if (*path != ' ' || (end = strchr(++path, '\n')) == NULL || end == path)
+        goto bad;
+    *end = '\0';
+    if (recorded != id) {
+        message(MESS_ERROR, "%s needs zstd dictionary %u, but %s names %lu\n",
+                name, id, manifest, recorded);
+        goto out;
+    }
+
+    dict = loadDict(path);
+    if (dict && dict->id != id) {
+        message(MESS_ERROR, "%s needs zstd dictionary %u, but %s is %u\n",
+                name, id, path, dict->id);
+        zstdDictFree(dict);
+        dict = NULL;
+    }
+    goto out;
+
+bad:
+    message(MESS_ERROR, "%s is not a dictionary manifest\n", manifest);
+out:
+    close(fd);
+    free(data);
+    free(manifest);
+    return dict;
+}
+
+#else /* HAVE_LIBZSTD */
+
+struct zstdDict *zstdDictForStanza(const char *stanza)
+{
+    (void) stanza;
+    return NULL;
+}
+
+void zstdDictAddSample(const char *stanza, int fd, const char *name)
+{
+    (void) stanza;
+    (void) fd;
+    (void) name;
+}
+
+int zstdDictWriteManifest(const struct zstdDict *dict, int fd, const char *name)
+{
+    (void) dict;
+    (void) name;
+    close(fd);
+    return 1;
+}
+
+struct zstdDict *zstdDictForArchive(const char *name, unsigned id)
+{
+    (void) name;
+    (void) id;
+    return NULL;
+}
+
+#endif /* HAVE_LIBZSTD */
+
+/* vim: set et sw=4 ts=4: */
@@ -0,0 +1,25 @@
+#ifndef H_ZSTDDICT
+#define H_ZSTDDICT
+
+#include <sys/types.h>
+
+/* suffix of the manifest naming the dictionary a log was compressed with */
+#define ZSTD_DICT_EXT ".dict"
+
+struct zstdDict {
+    unsigned id;
+    char *path;         /* absolute, as recorded in manifests */
+    void *data;
+    size_t size;
+};
+
+void zstdDictSetDir(const char *stateFilename);
+struct zstdDict *zstdDictForStanza(const char *stanza);
+void zstdDictAddSample(const char *stanza, int fd, const char *name);
+int zstdDictWriteManifest(const struct zstdDict *dict, int fd, const char *name);
+struct zstdDict *zstdDictForArchive(const char *name, unsigned id);
+void zstdDictFree(struct zstdDict *dict);
+
+#endif
+
+/* vim: set et sw=4 ts=4: */